@@ -29,6 +29,21 @@
  * VteRing: A buffer ring
  */
 
+/* Number of stream pages the frozen part of the ring is split into.  Pages
+ * are released as soon as all their rows scroll off the start of the ring,
+ * so the disk usage overshoots max rows by at most one page. */
+#define VTE_RING_PAGES 4
+
+/* Number of rows per reflow page.  Frozen rows are laid out for a new width
+ * a page at a time, as they are needed. */
+#define VTE_RING_REFLOW_PAGE_ROWS 1024
+
+/* Bytes of frozen text per search index block, and bits of its filter */
+#define VTE_RING_INDEX_BLOCK 2048
+#define VTE_RING_INDEX_BITS 4096
+/* Trigrams of a literal looked up at most */
+#define VTE_RING_INDEX_MAX_TRIGRAMS 32
+
 #ifdef VTE_DEBUG
 static void
 _vte_ring_validate (VteRing * ring)
@@ -50,6 +65,50 @@ _vte_ring_validate (VteRing * ring)
 #endif
 
 
+typedef struct _VteRowRecord {
+	gsize text_offset;
+	gsize attr_offset;
+} VteRowRecord;
+
+/* A run of frozen rows that gets laid out for a new width as a unit.  The
+ * text stream doesn't depend on the layout, so a page only needs new row
+ * records when it is reflowed. */
+typedef struct _VteRingPage {
+	gulong position;	/* Index of the first row */
+	gulong n_rows;
+	gulong columns;		/* Width the rows are laid out for */
+	gulong max_columns;	/* Bound on the length of the rows */
+	gulong row_start;	/* Row stream index of the first row */
+	gsize text_start, text_end, attr_start;
+	GArray *records;	/* Row records, or NULL if still in the row stream */
+} VteRingPage;
+
+#define _vte_ring_page(ring, i) (&g_array_index ((ring)->reflow_pages, VteRingPage, (i)))
+
+/* Search index:
+ *
+ * The frozen text is split into blocks of VTE_RING_INDEX_BLOCK bytes at
+ * fixed text offsets, and each block gets a bloom filter of the byte
+ * trigrams ending in it, ASCII lowercased.  A literal of up to
+ * VTE_RING_INDEX_MAX_TRIGRAMS + 2 bytes can only occur where each of its
+ * trigrams is in the block its first trigram ends in or the one after, so a
+ * search skips the rows of other blocks without thawing them.  The blocks
+ * follow the text stream, which doesn't change on reflow.
+ */
+typedef struct _VteRingIndexBlock {
+	guint32 bits[VTE_RING_INDEX_BITS / 32];
+} VteRingIndexBlock;
+
+#define _vte_ring_index_block(ring, i) (&g_array_index ((ring)->index_blocks, VteRingIndexBlock, (i)))
+
+static void
+_vte_ring_page_free (VteRingPage *page)
+{
+	if (page->records)
+		g_array_free (page->records, TRUE);
+	page->records = NULL;
+}
+
 void
 _vte_ring_init (VteRing *ring, gulong max_rows)
 {
@@ -76,6 +135,8 @@ _vte_ring_init (VteRing *ring, gulong max_rows)
 	_vte_ring_validate(ring);
 }
 
+static void _vte_ring_rewind_writers (VteRing *ring, gsize text_offset);
+
 void
 _vte_ring_fini (VteRing *ring)
 {
@@ -85,6 +146,19 @@ _vte_ring_fini (VteRing *ring)
 		_vte_row_data_fini (&ring->array[i]);
 
 	g_free (ring->array);
+	_vte_row_arena_free (ring->arena);
+
+	if (ring->reflow_pages) {
+		for (i = 0; i < ring->reflow_pages->len; i++)
+			_vte_ring_page_free (&g_array_index (ring->reflow_pages, VteRingPage, i));
+		g_array_free (ring->reflow_pages, TRUE);
+	}
+
+	if (ring->index_blocks)
+		g_array_free (ring->index_blocks, TRUE);
+
+	_vte_ring_rewind_writers (ring, G_MAXSIZE);
+	g_slist_free (ring->writers);
 
 	g_object_unref (ring->attr_stream);
 	g_object_unref (ring->text_stream);
@@ -95,15 +169,91 @@ _vte_ring_fini (VteRing *ring)
 	_vte_row_data_fini (&ring->cached_row);
 }
 
-typedef struct _VteRowRecord {
-	gsize text_offset;
-	gsize attr_offset;
-} VteRowRecord;
+static gboolean
+_vte_ring_read_stream_record (VteRing *ring, VteRowRecord *record, gulong index)
+{
+	return _vte_stream_read (ring->row_stream, index * sizeof (*record), (char *) record, sizeof (*record));
+}
+
+static VteRingPage *
+_vte_ring_find_page (VteRing *ring, gulong position)
+{
+	VteRingPage *page;
+	guint lo, hi;
+
+	if (G_LIKELY (!ring->reflow_pages || !ring->reflow_pages->len))
+		return NULL;
+
+	lo = 0;
+	hi = ring->reflow_pages->len;
+	page = _vte_ring_page (ring, hi - 1);
+	if (position >= page->position + page->n_rows)
+		return NULL;
+
+	while (hi - lo > 1) {
+		guint mid = (lo + hi) / 2;
+		if (_vte_ring_page (ring, mid)->position <= position)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	page = _vte_ring_page (ring, lo);
+	return position >= page->position ? page : NULL;
+}
+
+/* Reads the record of the frozen row at @position, and the text offset
+ * where the row ends if @text_end is not %NULL. */
+static gboolean
+_vte_ring_read_row_span (VteRing *ring, gulong position, VteRowRecord *record, gsize *text_end)
+{
+	VteRingPage *page = _vte_ring_find_page (ring, position);
+	VteRowRecord next;
+	gulong index;
+
+	if (page) {
+		gulong i = position - page->position;
+
+		if (page->records) {
+			*record = g_array_index (page->records, VteRowRecord, i);
+			if (text_end)
+				*text_end = i + 1 < page->n_rows ?
+					    g_array_index (page->records, VteRowRecord, i + 1).text_offset :
+					    page->text_end;
+			return TRUE;
+		}
+
+		if (!_vte_ring_read_stream_record (ring, record, page->row_start + i))
+			return FALSE;
+		if (text_end) {
+			if (i + 1 < page->n_rows) {
+				if (!_vte_ring_read_stream_record (ring, &next, page->row_start + i + 1))
+					return FALSE;
+				*text_end = next.text_offset;
+			} else
+				*text_end = page->text_end;
+		}
+		return TRUE;
+	}
+
+	index = position - ring->row_delta;
+	if (!_vte_ring_read_stream_record (ring, record, index))
+		return FALSE;
+	if (text_end) {
+		if ((index + 1) * sizeof (next) < _vte_stream_head (ring->row_stream)) {
+			if (!_vte_ring_read_stream_record (ring, &next, index + 1))
+				return FALSE;
+			*text_end = next.text_offset;
+		} else
+			*text_end = _vte_stream_head (ring->text_stream);
+	}
+	return TRUE;
+}
 
 static gboolean
 _vte_ring_read_row_record (VteRing *ring, VteRowRecord *record, gulong position)
 {
-	return _vte_stream_read (ring->row_stream, position * sizeof (*record), (char *) record, sizeof (*record));
+	return _vte_ring_read_row_span (ring, position, record, NULL);
 }
 
 static void
@@ -112,6 +262,119 @@ _vte_ring_append_row_record (VteRing *ring, const VteRowRecord *record, gulong p
 	_vte_stream_append (ring->row_stream, (const char *) record, sizeof (*record));
 }
 
+static inline guint32
+_vte_ring_index_hash (guint32 trigram)
+{
+	return trigram * 2654435761u;
+}
+
+static inline void
+_vte_ring_index_block_add (VteRingIndexBlock *block, guint32 hash)
+{
+	guint a = hash >> 20, b = (hash >> 8) & (VTE_RING_INDEX_BITS - 1);
+
+	block->bits[a / 32] |= 1u << (a % 32);
+	block->bits[b / 32] |= 1u << (b % 32);
+}
+
+static inline gboolean
+_vte_ring_index_block_has (const VteRingIndexBlock *block, guint32 hash)
+{
+	guint a = hash >> 20, b = (hash >> 8) & (VTE_RING_INDEX_BITS - 1);
+
+	return (block->bits[a / 32] & (1u << (a % 32))) &&
+	       (block->bits[b / 32] & (1u << (b % 32)));
+}
+
+/* Adds the trigrams of @text, which continues the indexed text */
+static void
+_vte_ring_index_text (VteRing *ring, const char *text, gsize len)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		guchar c = text[i];
+		guint block;
+
+		/* Empty cells read back as spaces */
+		c = c ? g_ascii_tolower (c) : ' ';
+		ring->index_window = ((ring->index_window << 8) | c) & 0xffffff;
+		if (ring->index_fill < 2) {
+			ring->index_fill++;
+			continue;
+		}
+
+		block = (ring->index_head + i - ring->index_base) / VTE_RING_INDEX_BLOCK;
+		if (block >= ring->index_blocks->len)
+			g_array_set_size (ring->index_blocks, block + 1);
+		_vte_ring_index_block_add (_vte_ring_index_block (ring, block),
+					   _vte_ring_index_hash (ring->index_window));
+	}
+
+	ring->index_head += len;
+}
+
+/* Indexes the frozen text before @offset that isn't yet */
+static void
+_vte_ring_index_catch_up (VteRing *ring, gsize offset)
+{
+	char buf[4096];
+
+	if (ring->index_head < _vte_stream_tail (ring->text_stream)) {
+		ring->index_head = _vte_stream_tail (ring->text_stream);
+		ring->index_fill = 0;
+	}
+
+	while (ring->index_head < offset) {
+		gsize len = MIN (sizeof (buf), offset - ring->index_head);
+
+		if (!_vte_stream_read (ring->text_stream, ring->index_head, buf, len))
+			break;
+		_vte_ring_index_text (ring, buf, len);
+	}
+}
+
+/* Forgets the text from @offset on.  The last block keeps the bits of the
+ * dropped text, which only costs false positives. */
+static void
+_vte_ring_index_truncate (VteRing *ring, gsize offset)
+{
+	gsize start;
+	char buf[2];
+
+	if (!ring->index_blocks || offset >= ring->index_head)
+		return;
+
+	g_array_set_size (ring->index_blocks,
+			  MIN (ring->index_blocks->len,
+			       (offset - ring->index_base) / VTE_RING_INDEX_BLOCK + 1));
+
+	/* Read back the bytes the next trigrams start with */
+	start = MAX (offset - MIN (offset, 2), ring->index_base);
+	start = MAX (start, _vte_stream_tail (ring->text_stream));
+	ring->index_head = start;
+	ring->index_fill = 0;
+	if (offset <= start ||
+	    !_vte_stream_read (ring->text_stream, start, buf, offset - start))
+		ring->index_head = offset;
+	else
+		_vte_ring_index_text (ring, buf, offset - start);
+}
+
+/* Drops the blocks of the text before @offset */
+static void
+_vte_ring_index_advance_tail (VteRing *ring, gsize offset)
+{
+	guint n;
+
+	if (!ring->index_blocks || offset < ring->index_base)
+		return;
+
+	n = (offset - ring->index_base) / VTE_RING_INDEX_BLOCK;
+	g_array_remove_range (ring->index_blocks, 0, MIN (n, ring->index_blocks->len));
+	ring->index_base += (gsize) n * VTE_RING_INDEX_BLOCK;
+}
+
 static void
 _vte_ring_freeze_row (VteRing *ring, gulong position, const VteRowData *row)
 {
@@ -168,8 +431,46 @@ _vte_ring_freeze_row (VteRing *ring, gulong position, const VteRowData *row)
 	if (!row->attr.soft_wrapped)
 		g_string_append_c (buffer, '\n');
 
+	/* An index that fell behind catches up when searched */
+	if (ring->index_blocks && ring->index_head == record.text_offset)
+		_vte_ring_index_text (ring, buffer->str, buffer->len);
+
 	_vte_stream_append (ring->text_stream, buffer->str, buffer->len);
 	_vte_ring_append_row_record (ring, &record, position);
+
+	ring->frozen_max_columns = MAX (ring->frozen_max_columns, row->len);
+}
+
+/* Drops the record of the last frozen row, at @position, whose text
+ * starts at @text_offset. */
+static void
+_vte_ring_truncate_row_stream (VteRing *ring, gulong position, gsize text_offset)
+{
+	VteRingPage *page = _vte_ring_find_page (ring, position);
+	gulong i;
+
+	if (G_LIKELY (!page)) {
+		_vte_stream_truncate (ring->row_stream, (position - ring->row_delta) * sizeof (VteRowRecord));
+		return;
+	}
+
+	/* The row is the last one of the last page.  Rows frozen from now on
+	 * go right after the page. */
+	i = position - page->position;
+	if (page->records)
+		g_array_set_size (page->records, i);
+	else
+		_vte_stream_truncate (ring->row_stream, (page->row_start + i) * sizeof (VteRowRecord));
+	ring->row_delta = position - _vte_stream_head (ring->row_stream) / sizeof (VteRowRecord);
+
+	page->n_rows = i;
+	page->text_end = text_offset;
+	if (!page->n_rows) {
+		if (page->columns != ring->columns)
+			ring->reflow_pending--;
+		_vte_ring_page_free (page);
+		g_array_set_size (ring->reflow_pages, ring->reflow_pages->len - 1);
+	}
 }
 
 static void
@@ -188,13 +489,8 @@ _vte_ring_thaw_row (VteRing *ring, gulong position, VteRowData *row, gboolean do
 
 	attr_change.text_offset = 0;
 
-	if (!_vte_ring_read_row_record (ring, &records[0], position))
+	if (!_vte_ring_read_row_span (ring, position, &records[0], &records[1].text_offset))
 		return;
-	if ((position + 1) * sizeof (records[0]) < _vte_stream_head (ring->row_stream)) {
-		if (!_vte_ring_read_row_record (ring, &records[1], position + 1))
-			return;
-	} else
-		records[1].text_offset = _vte_stream_head (ring->text_stream);
 
 	g_string_set_size (buffer, records[1].text_offset - records[0].text_offset);
 	if (!_vte_stream_read (ring->text_stream, records[0].text_offset, buffer->str, buffer->len))
@@ -251,15 +547,62 @@ _vte_ring_thaw_row (VteRing *ring, gulong position, VteRowData *row, gboolean do
 	}
 
 	if (do_truncate) {
-		if (records[0].text_offset < ring->last_attr.text_offset)
+		if (records[0].text_offset < ring->last_attr.text_offset) {
 			if (!_vte_stream_read (ring->attr_stream, records[0].attr_offset, (char *) &ring->last_attr, sizeof (ring->last_attr))) {
 				ring->last_attr.text_offset = 0;
 				ring->last_attr.attr.i = basic_cell.i.attr;
+			} else if (records[0].attr_offset == 0) {
+				/* The stream's first run starts at its start */
+				ring->last_attr.text_offset = 0;
+			} else if (_vte_stream_read (ring->attr_stream, records[0].attr_offset - sizeof (attr_change),
+						     (char *) &attr_change, sizeof (attr_change))) {
+				/* The change may also cover the end of the previous
+				 * row, which must find it in last_attr now */
+				ring->last_attr.text_offset = attr_change.text_offset;
 			}
-		_vte_stream_truncate (ring->row_stream, position * sizeof (record));
+		}
+		_vte_ring_truncate_row_stream (ring, position, records[0].text_offset);
 		_vte_stream_truncate (ring->attr_stream, records[0].attr_offset);
 		_vte_stream_truncate (ring->text_stream, records[0].text_offset);
+		_vte_ring_index_truncate (ring, records[0].text_offset);
+		_vte_ring_rewind_writers (ring, records[0].text_offset);
+	}
+}
+
+/* Frees the first @n reflow pages */
+static void
+_vte_ring_drop_pages (VteRing *ring, guint n)
+{
+	guint i;
+
+	if (!ring->reflow_pages)
+		return;
+
+	n = MIN (n, ring->reflow_pages->len);
+	for (i = 0; i < n; i++) {
+		VteRingPage *page = _vte_ring_page (ring, i);
+		if (page->columns != ring->columns)
+			ring->reflow_pending--;
+		_vte_ring_page_free (page);
 	}
+	g_array_remove_range (ring->reflow_pages, 0, n);
+}
+
+/* Frees the reflow pages whose rows all scrolled off */
+static void
+_vte_ring_drop_old_pages (VteRing *ring)
+{
+	guint n = 0;
+
+	if (!ring->reflow_pages)
+		return;
+
+	while (n < ring->reflow_pages->len &&
+	       _vte_ring_page (ring, n)->position + _vte_ring_page (ring, n)->n_rows <= ring->start)
+		n++;
+
+	if (n)
+		_vte_ring_drop_pages (ring, n);
 }
 
 static void
@@ -270,11 +613,21 @@ _vte_ring_reset_streams (VteRing *ring, gulong position)
 	_vte_stream_reset (ring->row_stream, position * sizeof (VteRowRecord));
 	_vte_stream_reset (ring->text_stream, 0);
 	_vte_stream_reset (ring->attr_stream, 0);
+	_vte_ring_rewind_writers (ring, 0);
 
 	ring->last_attr.text_offset = 0;
 	ring->last_attr.attr.i = basic_cell.i.attr;
 
 	ring->last_page = position;
+	ring->row_delta = 0;
+
+	_vte_ring_drop_pages (ring, G_MAXUINT);
+
+	if (ring->index_blocks) {
+		g_array_set_size (ring->index_blocks, 0);
+		ring->index_base = ring->index_head = 0;
+		ring->index_fill = 0;
+	}
 }
 
 static void
@@ -289,6 +642,41 @@ _vte_ring_new_page (VteRing *ring)
 	ring->last_page = ring->writable;
 }
 
+static void
+_vte_ring_advance_tail (VteRing *ring)
+{
+	VteRowRecord record;
+	VteRingPage *page;
+	gulong index;
+
+	if (ring->start >= ring->writable)
+		return;
+
+	_vte_ring_drop_old_pages (ring);
+
+	/* Reflowed pages don't use the row stream, but keep it from their
+	 * first row on. */
+	page = _vte_ring_find_page (ring, ring->start);
+	if (page)
+		index = page->row_start + (page->records ? 0 : ring->start - page->position);
+	else
+		index = ring->start - ring->row_delta;
+
+	/* All streams start their pages at the same rows, so only look up the
+	 * row record when the row stream actually released a page. */
+	if (!_vte_stream_advance_tail (ring->row_stream, index * sizeof (record)))
+		return;
+
+	_vte_debug_print (VTE_DEBUG_RING, "Releasing stream pages before %lu.\n", ring->start);
+
+	if (!_vte_ring_read_row_record (ring, &record, ring->start))
+		return;
+
+	_vte_stream_advance_tail (ring->text_stream, record.text_offset);
+	_vte_stream_advance_tail (ring->attr_stream, record.attr_offset);
+	_vte_ring_index_advance_tail (ring, record.text_offset);
+}
+
 
 
 static inline VteRowData *
@@ -335,7 +723,8 @@ _vte_ring_freeze_one_row (VteRing *ring)
 
 	ring->writable++;
 
-	if (G_UNLIKELY (ring->writable == ring->last_page || ring->writable - ring->last_page >= ring->max))
+	if (G_UNLIKELY (ring->writable == ring->last_page ||
+			ring->writable - ring->last_page >= MAX (ring->max / VTE_RING_PAGES, 1)))
 		_vte_ring_new_page (ring);
 }
 
@@ -367,6 +756,8 @@ _vte_ring_discard_one_row (VteRing *ring)
 	}
 	if (ring->start > ring->writable)
 		ring->writable = ring->start;
+	else
+		_vte_ring_advance_tail (ring);
 }
 
 static void
@@ -408,6 +799,10 @@ _vte_ring_ensure_writable_room (VteRing *ring)
 		new_array[i & new_mask] = old_array[i & old_mask];
 
 	g_free (old_array);
+
+	if (ring->arena)
+		ring->arena = _vte_row_arena_rebuild (ring->arena, ring->array, ring->mask + 1,
+						      _vte_row_arena_get_width (ring->arena));
 }
 
 static void
@@ -436,129 +831,1188 @@ _vte_ring_resize (VteRing *ring, gulong max_rows)
 	_vte_ring_validate(ring);
 
 	/* Adjust the start of tail chunk now */
-	if ((gulong) _vte_ring_length (ring) > max_rows) {
-		ring->start = ring->end - max_rows;
-		if (ring->start >= ring->writable) {
-			_vte_ring_reset_streams (ring, 0);
-			ring->writable = ring->start;
-		}
-	}
+	if ((gulong) _vte_ring_length (ring) > max_rows)
+		_vte_ring_trim (ring, ring->end - max_rows);
 
 	ring->max = max_rows;
 }
 
+/**
+ * _vte_ring_set_columns:
+ * @ring: a #VteRing
+ * @columns: the width of the terminal
+ *
+ * Preallocates @columns cells for each writable row in a single block,
+ * releasing the previous block.  Rows that don't fit fall back to their
+ * own allocation.  A ring that was never reflowed also takes @columns as
+ * the width of its rows.
+ */
 void
-_vte_ring_shrink (VteRing *ring, gulong max_len)
+_vte_ring_set_columns (VteRing *ring, gulong columns)
 {
-	if ((gulong) _vte_ring_length (ring) <= max_len)
-		return;
-
-	_vte_debug_print(VTE_DEBUG_RING, "Shrinking to %lu.\n", max_len);
-	_vte_ring_validate(ring);
+	if (!ring->columns)
+		ring->columns = columns;
 
-	if (ring->writable - ring->start <= max_len)
-		ring->end = ring->start + max_len;
-	else {
-		while (ring->writable - ring->start > max_len) {
-			_vte_ring_ensure_writable (ring, ring->writable - 1);
-			ring->end = ring->writable;
-		}
-	}
+	if (_vte_row_arena_get_width (ring->arena) == columns)
+		return;
 
-	/* TODO May want to shrink down ring->array */
+	_vte_debug_print(VTE_DEBUG_RING, "Setting columns to %lu.\n", columns);
 
-	_vte_ring_validate(ring);
+	ring->arena = _vte_row_arena_rebuild (ring->arena, ring->array, ring->mask + 1, columns);
 }
 
-/**
- * _vte_ring_insert_internal:
- * @ring: a #VteRing
- * @position: an index
- *
- * Inserts a new, empty, row into @ring at the @position'th offset.
- * The item at that position and any items after that are shifted down.
- *
- * Return: the newly added row.
- */
-VteRowData *
-_vte_ring_insert (VteRing *ring, gulong position)
+/* Moves the frozen rows that are not in a reflow page yet into new pages,
+ * ending pages after hard line ends where possible. */
+static void
+_vte_ring_page_frozen_rows (VteRing *ring)
 {
-	gulong i;
-	VteRowData *row, tmp;
+	gulong position = ring->start;
+	VteRingPage page;
+	VteRowRecord record;
 
-	_vte_debug_print(VTE_DEBUG_RING, "Inserting at position %lu.\n", position);
-	_vte_ring_validate(ring);
+	if (ring->reflow_pages->len) {
+		VteRingPage *last = _vte_ring_page (ring, ring->reflow_pages->len - 1);
+		position = MAX (position, last->position + last->n_rows);
+	}
 
-	_vte_ring_maybe_discard_one_row (ring);
+	while (position < ring->writable) {
+		gulong end = MIN (position + VTE_RING_REFLOW_PAGE_ROWS, ring->writable);
+		guint tries;
 
-	_vte_ring_ensure_writable (ring, position);
-	_vte_ring_ensure_writable_room (ring);
+		for (tries = 0; end < ring->writable && tries < 64; tries++, end++) {
+			gsize text_end;
+			char c;
 
-	g_assert (position >= ring->writable && position <= ring->end);
+			if (!_vte_ring_read_row_span (ring, end - 1, &record, &text_end) ||
+			    (text_end > record.text_offset &&
+			     _vte_stream_read (ring->text_stream, text_end - 1, &c, 1) && c == '\n'))
+				break;
+		}
 
-	tmp = *_vte_ring_writable_index (ring, ring->end);
-	for (i = ring->end; i > position; i--)
-		*_vte_ring_writable_index (ring, i) = *_vte_ring_writable_index (ring, i - 1);
-	*_vte_ring_writable_index (ring, position) = tmp;
+		if (!_vte_ring_read_row_record (ring, &record, position))
+			break;
+
+		page.position = position;
+		page.n_rows = end - position;
+		page.columns = ring->columns;
+		page.max_columns = MAX (ring->frozen_max_columns, ring->columns);
+		page.row_start = position - ring->row_delta;
+		page.text_start = record.text_offset;
+		page.attr_start = record.attr_offset;
+		page.records = NULL;
+
+		if (end < ring->writable) {
+			if (!_vte_ring_read_row_record (ring, &record, end))
+				break;
+			page.text_end = record.text_offset;
+		} else
+			page.text_end = _vte_stream_head (ring->text_stream);
+
+		g_array_append_val (ring->reflow_pages, page);
+		position = end;
+	}
 
-	row = _vte_ring_writable_index (ring, position);
-	_vte_row_data_clear (row);
-	ring->end++;
+	ring->frozen_max_columns = 0;
+}
 
-	_vte_ring_maybe_freeze_one_row (ring);
+/* Returns how many rows @page can gain at most when laid out for @columns */
+static gulong
+_vte_ring_page_growth (const VteRingPage *page, gulong columns)
+{
+	/* Each new row but the last of a line takes at least columns - 1 columns,
+	 * as a double width character may not fit at the end. */
+	gulong per_column = MAX (columns, 2) - 1;
+	gulong rows_per_row = MAX ((page->max_columns + per_column - 1) / per_column, 1);
 
-	_vte_ring_validate(ring);
-	return row;
+	return page->n_rows * (rows_per_row - 1);
 }
 
-/**
- * _vte_ring_remove:
- * @ring: a #VteRing
- * @position: an index
- *
- * Removes the @position'th item from @ring.
- */
-void
-_vte_ring_remove (VteRing * ring, gulong position)
+/* Lays the rows of @page out for the ring's width.  Return the change in
+ * the number of rows of the page. */
+static glong
+_vte_ring_reflow_page (VteRing *ring, VteRingPage *page)
 {
-	gulong i;
-	VteRowData tmp;
+	GString *buffer = ring->utf8_buffer;
+	GArray *records;
+	VteRowRecord record;
+	VteCellAttrChange attr_change, changes[256];
+	gsize text_offset, attr_offset, attr_head;
+	guint n_changes = 0, next_change = 0;
+	gulong old_rows, columns = 0;
+	gboolean need_row = TRUE;
+	const char *p, *q, *end;
 
-	_vte_debug_print(VTE_DEBUG_RING, "Removing item at position %lu.\n", position);
-	_vte_ring_validate(ring);
+	_vte_debug_print (VTE_DEBUG_RING, "Reflowing page at %lu.\n", page->position);
+
+	/* Leave out the rows that already scrolled off */
+	if (page->position < ring->start) {
+		gulong skip = ring->start - page->position;
+
+		if (!_vte_ring_read_row_record (ring, &record, ring->start))
+			return 0;
+		if (!page->records)
+			page->row_start += skip;
+		else
+			g_array_remove_range (page->records, 0, skip);
+		page->position = ring->start;
+		page->n_rows -= skip;
+		page->text_start = record.text_offset;
+		page->attr_start = record.attr_offset;
+	}
+	old_rows = page->n_rows;
 
-	if (G_UNLIKELY (!_vte_ring_contains (ring, position)))
-		return;
+	g_string_set_size (buffer, page->text_end - page->text_start);
+	if (!_vte_stream_read (ring->text_stream, page->text_start, buffer->str, buffer->len))
+		return 0;
 
-	_vte_ring_ensure_writable (ring, position);
+	records = g_array_sized_new (FALSE, FALSE, sizeof (VteRowRecord), old_rows);
 
-	tmp = *_vte_ring_writable_index (ring, position);
-	for (i = position; i < ring->end - 1; i++)
-		*_vte_ring_writable_index (ring, i) = *_vte_ring_writable_index (ring, i + 1);
-	*_vte_ring_writable_index (ring, ring->end - 1) = tmp;
+	/* Walk the text and attributes like _vte_ring_thaw_row() does */
+	text_offset = page->text_start;
+	attr_offset = page->attr_start;
+	attr_head = _vte_stream_head (ring->attr_stream);
+	attr_change.text_offset = 0;
+	p = buffer->str;
+	end = p + buffer->len;
+	while (p < end) {
+		VteIntCellAttr attr;
+		gsize row_attr_offset;
+		gulong cell_columns;
 
-	if (ring->end > ring->writable)
-		ring->end--;
+		if (text_offset >= ring->last_attr.text_offset) {
+			attr = ring->last_attr.attr;
+			row_attr_offset = _vte_stream_head (ring->attr_stream);
+		} else {
+			if (text_offset >= attr_change.text_offset) {
+				/* Read the changes a block at a time */
+				if (next_change == n_changes) {
+					n_changes = MIN (G_N_ELEMENTS (changes),
+							 (attr_head - MIN (attr_offset, attr_head)) / sizeof (attr_change));
+					next_change = 0;
+					if (!n_changes ||
+					    !_vte_stream_read (ring->attr_stream, attr_offset, (char *) changes,
+							       n_changes * sizeof (attr_change)))
+						break;
+				}
+				attr_change = changes[next_change++];
+				attr_offset += sizeof (attr_change);
+			}
+			attr = attr_change.attr;
+			row_attr_offset = attr_offset - sizeof (attr_change);
+		}
 
-	_vte_ring_validate(ring);
+		cell_columns = *p == '\n' ? 0 : attr.s.columns;
+		if (need_row || (columns && columns + cell_columns > ring->columns)) {
+			record.text_offset = text_offset;
+			record.attr_offset = row_attr_offset;
+			g_array_append_val (records, record);
+			columns = 0;
+			need_row = FALSE;
+		}
+		columns += cell_columns;
+		need_row = *p == '\n';
+
+		q = g_utf8_next_char (p);
+		text_offset += q - p;
+		p = q;
+	}
+	if (!records->len) {
+		record.text_offset = page->text_start;
+		record.attr_offset = page->attr_start;
+		g_array_append_val (records, record);
+	}
+
+	_vte_ring_page_free (page);
+	page->records = records;
+	page->n_rows = records->len;
+	page->columns = ring->columns;
+	page->max_columns = MAX (ring->columns, 2);
+
+	return (glong) page->n_rows - (glong) old_rows;
 }
 
+/* Reflows the @i'th page, keeping the rows after it in place */
+static gboolean
+_vte_ring_reflow_page_at (VteRing *ring, guint i)
+{
+	VteRingPage *page = _vte_ring_page (ring, i);
+	gulong page_end = page->position + page->n_rows;
+	glong delta;
+	guint j;
+
+	/* The headroom left by _vte_ring_reflow() covers this, but never let
+	 * indices go below zero; keep the old layout instead, for good, so
+	 * that later calls don't keep coming back to it. */
+	if (G_UNLIKELY (_vte_ring_page_growth (page, ring->columns) > ring->start)) {
+		_vte_debug_print (VTE_DEBUG_RING, "Keeping the layout of page at %lu.\n", page->position);
+		page->columns = ring->columns;
+		ring->reflow_pending--;
+		return FALSE;
+	}
 
-/**
- * _vte_ring_append:
- * @ring: a #VteRing
- * @data: the new item
- *
- * Appends a new item to the ring.
+	delta = _vte_ring_reflow_page (ring, page);
+	ring->reflow_pending--;
+	ring->cached_row_num = (gulong) -1;
+
+	page->position = page_end - page->n_rows;
+	for (j = 0; j < i; j++)
+		_vte_ring_page (ring, j)->position -= delta;
+	ring->start -= delta;
+
+	return TRUE;
+}
+
+/* Rewraps the writable rows at @columns into a new array of rows.  If
+ * @cursor_row is in or after them, it becomes an index into the new rows
+ * and @cursor_col follows the text. */
+static GArray *
+_vte_ring_reflow_writable (VteRing *ring, gulong columns, glong *cursor_row, glong *cursor_col, gboolean *cursor_moved)
+{
+	GArray *rows = g_array_new (FALSE, FALSE, sizeof (VteRowData));
+	GArray *line = g_array_new (FALSE, FALSE, sizeof (VteCell));
+	gulong position = ring->writable;
+
+	*cursor_moved = FALSE;
+
+	while (position < ring->end) {
+		VteRowData *row, new_row;
+		gulong cursor_offset = G_MAXULONG, len, k, first = rows->len;
+		gboolean soft_wrapped;
+		VteIntCell *cells;
+
+		/* Gather the logical line */
+		g_array_set_size (line, 0);
+		do {
+			row = _vte_ring_writable_index (ring, position);
+			if ((gulong) *cursor_row == position) {
+				cursor_offset = line->len + *cursor_col;
+				*cursor_moved = TRUE;
+			}
+			g_array_append_vals (line, row->cells, row->len);
+			soft_wrapped = row->attr.soft_wrapped;
+			position++;
+		} while (soft_wrapped && position < ring->end);
+
+		/* Trailing cells that were never written to go away */
+		cells = (VteIntCell *) line->data;
+		len = line->len;
+		if (!soft_wrapped)
+			while (len && cells[len - 1].i.c == basic_cell.i.c && cells[len - 1].i.attr == basic_cell.i.attr)
+				len--;
+
+		_vte_row_data_init (&new_row);
+		for (k = 0; k < len; ) {
+			VteCell *cell = &g_array_index (line, VteCell, k);
+			gulong n = 1;
+
+			if (!cell->attr.fragment)
+				while (k + n < len && n < cell->attr.columns &&
+				       g_array_index (line, VteCell, k + n).attr.fragment)
+					n++;
+
+			if (new_row.len && new_row.len + n > columns) {
+				new_row.attr.soft_wrapped = 1;
+				g_array_append_val (rows, new_row);
+				_vte_row_data_init (&new_row);
+			}
+			if (cursor_offset >= k && cursor_offset < k + n) {
+				*cursor_row = rows->len;
+				*cursor_col = new_row.len;
+			}
+			for (; n; n--, k++)
+				_vte_row_data_append (&new_row, &g_array_index (line, VteCell, k));
+		}
+		if (cursor_offset != G_MAXULONG && cursor_offset >= len) {
+			*cursor_row = rows->len;
+			*cursor_col = MIN (new_row.len + (cursor_offset - len), MAX (columns, 1) - 1);
+		}
+		new_row.attr.soft_wrapped = soft_wrapped;
+		g_array_append_val (rows, new_row);
+
+		_vte_debug_print (VTE_DEBUG_RING, "Rewrapped line into %u rows.\n", rows->len - first);
+	}
+
+	if (!*cursor_moved && (gulong) *cursor_row >= ring->end) {
+		*cursor_row = rows->len + (*cursor_row - ring->end);
+		*cursor_moved = TRUE;
+	}
+
+	g_array_free (line, TRUE);
+
+	return rows;
+}
+
+/**
+ * _vte_ring_reflow:
+ * @ring: a #VteRing
+ * @columns: the new width of the terminal
+ * @cursor_row: the row of the cursor, updated on return
+ * @cursor_col: the column of the cursor, updated on return
+ *
+ * Rewraps the rows of @ring at @columns, following soft wraps.  The
+ * writable rows are rewrapped right away; frozen rows are laid out a page
+ * at a time when _vte_ring_reflow_range() asks for them.
+ *
+ * All indices move up by the returned amount, to leave room for the frozen
+ * rows to grow into.
+ *
+ * Return: the amount all row indices changed by.
+ */
+gulong
+_vte_ring_reflow (VteRing *ring, gulong columns, glong *cursor_row, glong *cursor_col)
+{
+	GArray *rows;
+	gulong shift = 0, i;
+	gboolean cursor_moved;
+
+	if (columns == ring->columns || !columns)
+		return 0;
+
+	if (!ring->columns) {
+		ring->columns = columns;
+		return 0;
+	}
+
+	_vte_debug_print(VTE_DEBUG_RING, "Reflowing from %lu to %lu columns.\n", ring->columns, columns);
+	_vte_ring_validate(ring);
+
+	/* Rewrap the line the frozen rows end in as a whole */
+	for (i = 0; i < VTE_RING_REFLOW_PAGE_ROWS && ring->writable > ring->start; i++) {
+		if (!_vte_ring_index (ring, ring->writable - 1)->attr.soft_wrapped)
+			break;
+		_vte_ring_ensure_writable (ring, ring->writable - 1);
+	}
+
+	if (!ring->reflow_pages)
+		ring->reflow_pages = g_array_new (FALSE, FALSE, sizeof (VteRingPage));
+	_vte_ring_drop_old_pages (ring);
+	_vte_ring_page_frozen_rows (ring);
+
+	ring->reflow_pending = 0;
+	for (i = 0; i < ring->reflow_pages->len; i++) {
+		VteRingPage *page = _vte_ring_page (ring, i);
+		shift += _vte_ring_page_growth (page, columns);
+		if (page->columns != columns)
+			ring->reflow_pending++;
+	}
+
+	rows = _vte_ring_reflow_writable (ring, columns, cursor_row, cursor_col, &cursor_moved);
+	for (i = ring->writable; i < ring->end; i++)
+		_vte_row_data_fini (_vte_ring_writable_index (ring, i));
+
+	ring->start += shift;
+	ring->writable += shift;
+	ring->last_page += shift;
+	ring->row_delta += shift;
+	for (i = 0; i < ring->reflow_pages->len; i++)
+		_vte_ring_page (ring, i)->position += shift;
+	ring->cached_row_num = (gulong) -1;
+
+	if (rows->len >= ring->mask) {
+		for (i = 0; i <= ring->mask; i++)
+			_vte_row_data_fini (&ring->array[i]);
+		g_free (ring->array);
+		ring->mask = (1 << g_bit_storage (rows->len + 1)) - 1;
+		ring->array = g_malloc0 (sizeof (ring->array[0]) * (ring->mask + 1));
+		if (ring->arena)
+			ring->arena = _vte_row_arena_rebuild (ring->arena, ring->array, ring->mask + 1,
+							      _vte_row_arena_get_width (ring->arena));
+	}
+	for (i = 0; i < rows->len; i++) {
+		VteRowData *row = _vte_ring_writable_index (ring, ring->writable + i);
+		_vte_row_data_fini (row);
+		*row = g_array_index (rows, VteRowData, i);
+	}
+	ring->end = ring->writable + rows->len;
+	g_array_free (rows, TRUE);
+
+	if (cursor_moved)
+		*cursor_row += ring->writable;
+	else
+		*cursor_row += shift;
+
+	ring->columns = columns;
+
+	if ((gulong) _vte_ring_length (ring) > ring->max)
+		_vte_ring_trim (ring, ring->end - ring->max);
+
+	_vte_ring_validate(ring);
+
+	return shift;
+}
+
+static gulong _vte_ring_find_row_by_offset (VteRing *ring, gulong lo, gulong hi, gsize offset);
+
+/**
+ * _vte_ring_reflow_range:
+ * @ring: a #VteRing
+ * @first: the first index to lay out
+ * @last: the index after the last one to lay out
+ * @last_moved: (allow-none): where to store how far the row at @last moved
+ *
+ * Lays out the frozen rows from @first to @last for the width given to
+ * _vte_ring_reflow(), if they aren't yet.  Rows are laid out a page at a
+ * time, and the rows after a page keep their indices; earlier ones, and
+ * the start of @ring, move as rows are rewrapped.  So rows from @last on
+ * keep their indices, except for those of a page that holds both row
+ * @last - 1 and row @last: the row holding the text that was at @last
+ * then moves by the amount stored in @last_moved.  If @first is at or
+ * before the start of @ring, all rows up to @last are laid out.
+ *
+ * Return: %TRUE if any row moved.
+ */
+gboolean
+_vte_ring_reflow_range (VteRing *ring, gulong first, gulong last, glong *last_moved)
+{
+	VteRowRecord record;
+	gboolean changed = FALSE, follow_last;
+	guint i;
+
+	if (last_moved)
+		*last_moved = 0;
+
+	if (G_LIKELY (!ring->reflow_pending))
+		return FALSE;
+
+	_vte_ring_drop_old_pages (ring);
+
+	/* Keep following the start as it moves */
+	if (first <= ring->start)
+		first = 0;
+
+	/* Find the row at @last again by its text afterwards */
+	follow_last = last_moved && last > ring->start && last < ring->writable &&
+		      _vte_ring_read_row_record (ring, &record, last);
+
+	i = ring->reflow_pages->len;
+	while (i--) {
+		VteRingPage *page = _vte_ring_page (ring, i);
+
+		if (page->position >= last)
+			continue;
+		if (page->position + page->n_rows <= MAX (first, ring->start))
+			break;
+		if (page->columns != ring->columns)
+			changed |= _vte_ring_reflow_page_at (ring, i);
+	}
+
+	if (changed && follow_last)
+		*last_moved = (glong) _vte_ring_find_row_by_offset (ring, ring->start, ring->writable,
+								   record.text_offset) - (glong) last;
+
+	if (changed && (gulong) _vte_ring_length (ring) > ring->max)
+		_vte_ring_trim (ring, ring->end - ring->max);
+
+	return changed;
+}
+
+/**
+ * _vte_ring_trim:
+ * @ring: a #VteRing
+ * @position: an index
+ *
+ * Discards all rows before the @position'th one.
+ */
+void
+_vte_ring_trim (VteRing *ring, gulong position)
+{
+	if (position <= ring->start)
+		return;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Trimming to %lu.\n", position);
+
+	ring->start = MIN (position, ring->end);
+	if (ring->start >= ring->writable) {
+		_vte_ring_reset_streams (ring, 0);
+		ring->writable = ring->start;
+	} else
+		_vte_ring_advance_tail (ring);
+
+	_vte_ring_validate(ring);
+}
+
+/**
+ * _vte_ring_drop_page:
+ * @ring: a #VteRing
+ * @limit: an index
+ *
+ * Discards about a page worth of the oldest rows in @ring, releasing their
+ * storage, but never the @limit'th row or any row after it.
+ *
+ * Return: the number of rows discarded.
+ */
+gulong
+_vte_ring_drop_page (VteRing *ring, gulong limit)
+{
+	gulong start = ring->start;
+
+	if (limit <= start)
+		return 0;
+
+	_vte_ring_trim (ring, MIN (start + MAX (ring->max / VTE_RING_PAGES, 1), limit));
+
+	return ring->start - start;
+}
+
+void
+_vte_ring_shrink (VteRing *ring, gulong max_len)
+{
+	if ((gulong) _vte_ring_length (ring) <= max_len)
+		return;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Shrinking to %lu.\n", max_len);
+	_vte_ring_validate(ring);
+
+	if (ring->writable - ring->start <= max_len)
+		ring->end = ring->start + max_len;
+	else {
+		while (ring->writable - ring->start > max_len) {
+			_vte_ring_ensure_writable (ring, ring->writable - 1);
+			ring->end = ring->writable;
+		}
+	}
+
+	/* TODO May want to shrink down ring->array */
+
+	_vte_ring_validate(ring);
+}
+
+/**
+ * _vte_ring_insert_internal:
+ * @ring: a #VteRing
+ * @position: an index
+ *
+ * Inserts a new, empty, row into @ring at the @position'th offset.
+ * The item at that position and any items after that are shifted down.
+ *
+ * Return: the newly added row.
+ */
+VteRowData *
+_vte_ring_insert (VteRing *ring, gulong position)
+{
+	gulong i;
+	VteRowData *row, tmp;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Inserting at position %lu.\n", position);
+	_vte_ring_validate(ring);
+
+	_vte_ring_maybe_discard_one_row (ring);
+
+	_vte_ring_ensure_writable (ring, position);
+	_vte_ring_ensure_writable_room (ring);
+
+	g_assert (position >= ring->writable && position <= ring->end);
+
+	tmp = *_vte_ring_writable_index (ring, ring->end);
+	for (i = ring->end; i > position; i--)
+		*_vte_ring_writable_index (ring, i) = *_vte_ring_writable_index (ring, i - 1);
+	*_vte_ring_writable_index (ring, position) = tmp;
+
+	row = _vte_ring_writable_index (ring, position);
+	_vte_row_data_clear (row);
+	ring->end++;
+
+	_vte_ring_maybe_freeze_one_row (ring);
+
+	_vte_ring_validate(ring);
+	return row;
+}
+
+/**
+ * _vte_ring_remove:
+ * @ring: a #VteRing
+ * @position: an index
+ *
+ * Removes the @position'th item from @ring.
+ */
+void
+_vte_ring_remove (VteRing * ring, gulong position)
+{
+	gulong i;
+	VteRowData tmp;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Removing item at position %lu.\n", position);
+	_vte_ring_validate(ring);
+
+	if (G_UNLIKELY (!_vte_ring_contains (ring, position)))
+		return;
+
+	_vte_ring_ensure_writable (ring, position);
+
+	tmp = *_vte_ring_writable_index (ring, position);
+	for (i = position; i < ring->end - 1; i++)
+		*_vte_ring_writable_index (ring, i) = *_vte_ring_writable_index (ring, i + 1);
+	*_vte_ring_writable_index (ring, ring->end - 1) = tmp;
+
+	if (ring->end > ring->writable)
+		ring->end--;
+
+	_vte_ring_validate(ring);
+}
+
+
+/**
+ * _vte_ring_append:
+ * @ring: a #VteRing
+ * @data: the new item
+ *
+ * Appends a new item to the ring.
+ *
+ * Return: the newly added row.
+ */
+VteRowData *
+_vte_ring_append (VteRing * ring)
+{
+	return _vte_ring_insert (ring, _vte_ring_next (ring));
+}
+
+/**
+ * _vte_ring_get_storage_size:
+ * @ring: a #VteRing
+ *
+ * Returns: the number of bytes the frozen rows of @ring currently take
+ * up in the backing streams.
+ */
+gsize
+_vte_ring_get_storage_size (VteRing *ring)
+{
+	return _vte_stream_head (ring->row_stream) - _vte_stream_tail (ring->row_stream)
+	     + _vte_stream_head (ring->text_stream) - _vte_stream_tail (ring->text_stream)
+	     + _vte_stream_head (ring->attr_stream) - _vte_stream_tail (ring->attr_stream);
+}
+
+
+/**
+ * _vte_ring_set_search_index:
+ * @ring: a #VteRing
+ * @enabled: whether to index the frozen text
+ *
+ * Turns the search index used by _vte_ring_search_skip() on or off.  Text
+ * frozen before is indexed on the first search.
+ */
+void
+_vte_ring_set_search_index (VteRing *ring, gboolean enabled)
+{
+	if (!enabled == !ring->index_blocks)
+		return;
+
+	if (!enabled) {
+		g_array_free (ring->index_blocks, TRUE);
+		ring->index_blocks = NULL;
+		return;
+	}
+
+	ring->index_blocks = g_array_new (FALSE, TRUE, sizeof (VteRingIndexBlock));
+	ring->index_head = _vte_stream_tail (ring->text_stream);
+	ring->index_base = ring->index_head - ring->index_head % VTE_RING_INDEX_BLOCK;
+	ring->index_fill = 0;
+}
+
+/**
+ * _vte_ring_update_search_index:
+ * @ring: a #VteRing
+ * @max_bytes: how much text to index at most
+ *
+ * Indexes up to @max_bytes of the frozen text the search index doesn't
+ * cover yet, so that the first search over a long history can be spread
+ * over several calls.
+ *
+ * Returns: whether the index is up to date
+ */
+gboolean
+_vte_ring_update_search_index (VteRing *ring, gsize max_bytes)
+{
+	gsize head, before;
+
+	if (!ring->index_blocks)
+		return TRUE;
+
+	head = _vte_stream_head (ring->text_stream);
+	before = ring->index_head;
+	_vte_ring_index_catch_up (ring, MIN (head, MAX (before, _vte_stream_tail (ring->text_stream)) + max_bytes));
+
+	/* A failed read leaves the rest to _vte_ring_search_skip() */
+	return ring->index_head >= head || ring->index_head == before;
+}
+
+/* Whether the lowercase @trigram only matches itself and its ASCII
+ * uppercase.  Non-ASCII characters have other cases with other bytes, and
+ * so do k and s: U+212A KELVIN SIGN and U+017F LATIN SMALL LETTER LONG S. */
+static gboolean
+_vte_ring_index_caseless_safe (guint32 trigram)
+{
+	int i;
+
+	for (i = 0; i < 3; i++, trigram >>= 8) {
+		guchar c = trigram & 0xff;
+
+		if (c >= 0x80 || c == 'k' || c == 's')
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Whether a literal whose first trigram ends in @block may occur */
+static gboolean
+_vte_ring_index_may_start (VteRing *ring, guint block,
+			   const guint32 *hashes, guint n_hashes)
+{
+	const VteRingIndexBlock *b = _vte_ring_index_block (ring, block);
+	const VteRingIndexBlock *next = NULL;
+	guint i;
+
+	if (block + 1 < ring->index_blocks->len)
+		next = _vte_ring_index_block (ring, block + 1);
+
+	for (i = 0; i < n_hashes; i++)
+		if (!_vte_ring_index_block_has (b, hashes[i]) &&
+		    !(next && _vte_ring_index_block_has (next, hashes[i])))
+			return FALSE;
+
+	return TRUE;
+}
+
+/* Returns the frozen row in [@lo, @hi) whose text holds @offset */
+static gulong
+_vte_ring_find_row_by_offset (VteRing *ring, gulong lo, gulong hi, gsize offset)
+{
+	VteRowRecord record;
+
+	while (hi - lo > 1) {
+		gulong mid = lo + (hi - lo) / 2;
+
+		if (!_vte_ring_read_row_record (ring, &record, mid))
+			break;
+		if (record.text_offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Whether the frozen row at @position ends a logical line */
+static gboolean
+_vte_ring_row_ends_line (VteRing *ring, gulong position)
+{
+	VteRowRecord record;
+	gsize text_end;
+	char c;
+
+	if (!_vte_ring_read_row_span (ring, position, &record, &text_end) ||
+	    text_end <= record.text_offset)
+		return TRUE;
+
+	return !_vte_stream_read (ring->text_stream, text_end - 1, &c, 1) || c == '\n';
+}
+
+/**
+ * _vte_ring_search_skip:
+ * @ring: a #VteRing
+ * @position: the first row to search, or the row after the last one if
+ *   @backward is %TRUE
+ * @limit: the row after the last row to search, or the first one if
+ *   @backward is %TRUE
+ * @backward: the direction of the search
+ * @literal: a string every match contains
+ * @caseless: whether matching ignores case
  *
- * Return: the newly added row.
+ * Skips the logical lines of frozen rows that can't contain @literal
+ * according to the search index.  Rows that are not frozen are never
+ * skipped.
+ *
+ * Returns: the row to go on searching from in the same sense as @position,
+ *   or @limit if no row before it can match
  */
-VteRowData *
-_vte_ring_append (VteRing * ring)
+gulong
+_vte_ring_search_skip (VteRing *ring, gulong position, gulong limit,
+		       gboolean backward,
+		       const char *literal, gboolean caseless)
 {
-	return _vte_ring_insert (ring, _vte_ring_next (ring));
+	guint32 hashes[VTE_RING_INDEX_MAX_TRIGRAMS], window = 0;
+	guint n_hashes = 0, block, first_block, i;
+	VteRowRecord record;
+	gsize start, end, target;
+	gulong row;
+
+	if (!ring->index_blocks || position == limit)
+		return position;
+	if (backward ? (position > ring->writable) : (position >= ring->writable))
+		return position;
+
+	for (i = 0; literal[i] && n_hashes < G_N_ELEMENTS (hashes); i++) {
+		window = ((window << 8) | g_ascii_tolower ((guchar) literal[i])) & 0xffffff;
+		if (i < 2 || (caseless && !_vte_ring_index_caseless_safe (window)))
+			continue;
+		hashes[n_hashes++] = _vte_ring_index_hash (window);
+	}
+	if (!n_hashes)
+		return position;
+
+	_vte_ring_index_catch_up (ring, _vte_stream_head (ring->text_stream));
+
+	if (!backward) {
+		if (!_vte_ring_read_row_record (ring, &record, position) ||
+		    record.text_offset < ring->index_base)
+			return position;
+
+		first_block = (record.text_offset - ring->index_base) / VTE_RING_INDEX_BLOCK;
+		for (block = first_block; block < ring->index_blocks->len; block++)
+			if (_vte_ring_index_may_start (ring, block, hashes, n_hashes))
+				break;
+		if (block == first_block)
+			return position;
+
+		if (block < ring->index_blocks->len) {
+			/* A match may start two bytes before its first trigram ends */
+			target = ring->index_base + (gsize) block * VTE_RING_INDEX_BLOCK - 2;
+			target = MAX (target, record.text_offset);
+		} else
+			target = ring->index_head;
+
+		if (target >= _vte_stream_head (ring->text_stream))
+			row = ring->writable;
+		else
+			row = _vte_ring_find_row_by_offset (ring, position, ring->writable, target);
+
+		/* Back to the start of the logical line */
+		while (row > position && !_vte_ring_row_ends_line (ring, row - 1))
+			row--;
+
+		return MIN (row, limit);
+	}
+
+	if (position == ring->writable)
+		end = _vte_stream_head (ring->text_stream);
+	else if (!_vte_ring_read_row_record (ring, &record, position))
+		return position;
+	else
+		end = record.text_offset;
+	if (end > ring->index_head ||
+	    !_vte_ring_read_row_record (ring, &record, limit) ||
+	    record.text_offset < ring->index_base)
+		return position;
+	start = record.text_offset;
+	if (end <= start)
+		return position;
+
+	first_block = (start - ring->index_base) / VTE_RING_INDEX_BLOCK;
+	block = (end - 1 - ring->index_base) / VTE_RING_INDEX_BLOCK;
+	if (block >= ring->index_blocks->len)
+		return position;
+	while (!_vte_ring_index_may_start (ring, block, hashes, n_hashes)) {
+		if (block == first_block)
+			return limit;
+		block--;
+	}
+
+	/* The last byte a match may cover */
+	target = MIN (end, ring->index_base + (gsize) (block + 2) * VTE_RING_INDEX_BLOCK) - 1;
+	row = _vte_ring_find_row_by_offset (ring, limit, position, target);
+
+	/* On to the end of the logical line */
+	while (row + 1 < position && !_vte_ring_row_ends_line (ring, row))
+		row++;
+
+	return row + 1;
+}
+
+/**
+ * _vte_ring_search_literal:
+ * @pattern: a regular expression in PCRE syntax
+ *
+ * Finds text for _vte_ring_search_skip() to look for: the longest run of
+ * literal characters outside of groups that every match of @pattern
+ * contains.  Patterns with alternatives or inline options have none, and
+ * so do patterns with escapes or bracket expressions that are not
+ * understood here.
+ *
+ * Returns: the text, or %NULL if there is none of at least three bytes;
+ *   free with g_free()
+ */
+char *
+_vte_ring_search_literal (const char *pattern)
+{
+	const char *p = pattern;
+	GString *run, *best;
+	int depth = 0;
+
+	if (strchr (p, '|') || strstr (p, "(?"))
+		return NULL;
+
+	run = g_string_new (NULL);
+	best = g_string_new (NULL);
+	for (;;) {
+		gboolean literal = FALSE;
+
+		switch (*p) {
+		case '\\':
+			p++;
+			if (!*p)
+				goto out;
+			if (g_ascii_isalnum (*p) && !strchr ("dDwWsSbBAzZGhHvVR", *p)) {
+				/* \x41, \1, \Q... would need a real parser */
+				g_string_truncate (best, 0);
+				goto out;
+			}
+			/* Classes and assertions end the run */
+			literal = !g_ascii_isalnum (*p);
+			break;
+		case '*':
+		case '?':
+		case '{':
+			/* The atom before may be absent */
+			if (run->len)
+				g_string_truncate (run, g_utf8_find_prev_char (run->str, run->str + run->len) - run->str);
+			if (*p == '{' && strchr (p, '}'))
+				p = strchr (p, '}');
+			break;
+		case '[':
+			/* Skip the class */
+			p++;
+			if (*p == '^')
+				p++;
+			if (*p == ']')
+				p++;
+			while (*p && *p != ']') {
+				if (*p == '\\' && p[1]) {
+					if (p[1] == 'Q' || p[1] == 'E') {
+						g_string_truncate (best, 0);
+						goto out;
+					}
+					p++;
+				} else if (*p == '[' &&
+					   (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+					/* [:digit:], [=e=] and [.a.] end with
+					 * their own bracket */
+					const char *close;
+
+					for (close = p + 2; *close; close++)
+						if (close[0] == p[1] && close[1] == ']')
+							break;
+					if (!*close) {
+						g_string_truncate (best, 0);
+						goto out;
+					}
+					p = close + 1;
+				}
+				p++;
+			}
+			if (!*p)
+				goto out;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			depth--;
+			break;
+		case '.': case '+': case '^': case '$': case '\n': case '\0':
+			break;
+		default:
+			literal = TRUE;
+			break;
+		}
+
+		if (literal && depth == 0) {
+			g_string_append_c (run, *p);
+		} else if (!literal || depth) {
+			if (run->len > best->len)
+				g_string_assign (best, run->str);
+			g_string_truncate (run, 0);
+		}
+		if (!*p)
+			break;
+		p++;
+	}
+
+out:
+	g_string_free (run, TRUE);
+	if (best->len < 3) {
+		g_string_free (best, TRUE);
+		return NULL;
+	}
+	return g_string_free (best, FALSE);
+}
+
+/**
+ * _vte_ring_read_lines:
+ * @ring: a #VteRing
+ * @first: (inout): the first row to read
+ * @last: (inout): the row after the last one to read
+ * @text: a #GString to store the text in
+ * @offset: (out): the text offset of the start of @text
+ *
+ * Reads the text of the logical lines that lie wholly within the frozen
+ * rows from @first to @last straight from the text stream, without
+ * thawing the rows.  Each line ends in a newline, and empty cells read as
+ * NUL bytes.  @first and @last are updated to the rows the lines span.
+ * The row at @ring's start counts as the start of a line.
+ *
+ * Returns: %TRUE if any line was read
+ */
+gboolean
+_vte_ring_read_lines (VteRing *ring, gulong *first, gulong *last,
+		      GString *text, gsize *offset)
+{
+	VteRowRecord record;
+	gsize start, end, skip;
+	char *p;
+
+	*first = MAX (*first, ring->start);
+	*last = MIN (*last, ring->writable);
+	if (*first >= *last)
+		return FALSE;
+
+	if (!_vte_ring_read_row_span (ring, *last - 1, &record, &end) ||
+	    !_vte_ring_read_row_record (ring, &record, *first))
+		return FALSE;
+	start = record.text_offset;
+	if (end <= start)
+		return FALSE;
+
+	g_string_set_size (text, end - start);
+	if (!_vte_stream_read (ring->text_stream, start, text->str, text->len))
+		return FALSE;
+
+	/* Drop the partial lines at both ends */
+	if (*first > ring->start && !_vte_ring_row_ends_line (ring, *first - 1)) {
+		p = memchr (text->str, '\n', text->len);
+		if (!p)
+			return FALSE;
+		skip = p + 1 - text->str;
+		g_string_erase (text, 0, skip);
+		start += skip;
+	}
+	for (p = text->str + text->len; p > text->str && p[-1] != '\n'; p--)
+		;
+	if (p == text->str)
+		return FALSE;
+	g_string_truncate (text, p - text->str);
+
+	if (start + text->len < end)
+		*last = _vte_ring_find_row_by_offset (ring, *first, *last, start + text->len);
+	*first = _vte_ring_find_row_by_offset (ring, *first, *last, start);
+	*offset = start;
+
+	return TRUE;
+}
+
+/**
+ * _vte_ring_append_text:
+ * @ring: a #VteRing
+ * @first: the first row to read
+ * @last: the row after the last one to read
+ * @text: a #GString to append the text to
+ *
+ * Appends the text of the frozen rows from @first to @last to @text
+ * straight from the text stream, the way the terminal reads it from the
+ * cells: empty cells read as spaces, and those at the end of a row are
+ * dropped.
+ *
+ * Returns: the row after the last one appended
+ */
+gulong
+_vte_ring_append_text (VteRing *ring, gulong first, gulong last, GString *text)
+{
+	VteRowRecord record;
+	gsize start, end, row_end, len;
+	gulong row;
+	gboolean newline;
+	char *buf, *p, *q, *w;
+
+	last = MIN (last, ring->writable);
+	if (first < ring->start || first >= last)
+		return first;
+
+	if (!_vte_ring_read_row_span (ring, last - 1, &record, &end) ||
+	    !_vte_ring_read_row_record (ring, &record, first))
+		return first;
+	start = record.text_offset;
+
+	len = text->len;
+	g_string_set_size (text, len + (end - start));
+	buf = text->str + len;
+	if (!_vte_stream_read (ring->text_stream, start, buf, end - start)) {
+		g_string_truncate (text, len);
+		return first;
+	}
+
+	/* Trim each row in place */
+	w = buf;
+	for (row = first; row < last; row++) {
+		if (!_vte_ring_read_row_span (ring, row, &record, &row_end))
+			break;
+		p = buf + (record.text_offset - start);
+		q = buf + (row_end - start);
+		newline = q > p && q[-1] == '\n';
+		if (newline)
+			q--;
+		while (q > p && q[-1] == '\0')
+			q--;
+		for (; p < q; p++)
+			*w++ = *p ? *p : ' ';
+		if (newline)
+			*w++ = '\n';
+	}
+	g_string_truncate (text, w - text->str);
+
+	return row;
 }
 
+/**
+ * _vte_ring_find_cell:
+ * @ring: a #VteRing
+ * @first: the first row to look in
+ * @last: the row after the last one to look in
+ * @offset: a text offset returned by _vte_ring_read_lines()
+ * @row: (out): the row of the cell
+ * @column: (out): the column of the cell
+ *
+ * Finds the cell whose text holds @offset among the frozen rows from
+ * @first to @last, thawing only the row it is in.  The newline ending a
+ * line maps to the column after the row's last cell.
+ *
+ * Returns: %TRUE if the cell was found
+ */
+gboolean
+_vte_ring_find_cell (VteRing *ring, gulong first, gulong last, gsize offset,
+		     gulong *row, glong *column)
+{
+	const VteRowData *row_data;
+	const VteCell *cell;
+	VteRowRecord record;
+	GString *buffer = ring->utf8_buffer;
+	gsize text_offset;
+	int i;
+
+	*row = _vte_ring_find_row_by_offset (ring, first, last, offset);
+	if (!_vte_ring_read_row_record (ring, &record, *row))
+		return FALSE;
+	row_data = _vte_ring_index (ring, *row);
+	if (!row_data)
+		return FALSE;
+
+	text_offset = record.text_offset;
+	for (i = 0, cell = row_data->cells; i < row_data->len; i++, cell++) {
+		if (cell->attr.fragment)
+			continue;
+
+		g_string_set_size (buffer, 0);
+		_vte_unistr_append_to_string (cell->c, buffer);
+		text_offset += buffer->len;
+
+		if (offset < text_offset) {
+			*column = i;
+			return TRUE;
+		}
+	}
+
+	*column = row_data->len;
+	return TRUE;
+}
 
 static gboolean
 _vte_ring_write_row (VteRing *ring,
@@ -609,6 +2063,25 @@ _vte_ring_write_contents (VteRing *ring,
 
 	_vte_debug_print(VTE_DEBUG_RING, "Writing contents to GOutputStream.\n");
 
+	if (flags & VTE_TERMINAL_WRITE_ATTRIBUTES) {
+		VteRingWriter *writer;
+		GString *buffer = g_string_sized_new (VTE_RING_WRITER_CHUNK_SIZE);
+		gsize bytes_written;
+		gboolean ret;
+
+		writer = _vte_ring_writer_new (ring, ring->start, ring->end, flags);
+		do {
+			g_string_truncate (buffer, 0);
+			ret = _vte_ring_writer_read (writer, buffer, VTE_RING_WRITER_CHUNK_SIZE, error) &&
+			      g_output_stream_write_all (stream, buffer->str, buffer->len,
+							 &bytes_written, cancellable, error);
+		} while (ret && buffer->len);
+		_vte_ring_writer_free (writer);
+		g_string_free (buffer, TRUE);
+
+		return ret;
+	}
+
 	if (ring->start < ring->writable) {
 		VteRowRecord record;
 		/* XXX what to do in case of error? */
@@ -629,3 +2102,706 @@ _vte_ring_write_contents (VteRing *ring,
 
 	return TRUE;
 }
+
+
+/*
+ * VteRingWriter: The contents of a range of rows, read a chunk at a time
+ */
+
+struct _VteRingWriter {
+	/* The frozen rows, read by text offset from the streams as they
+	 * were when the writer was made */
+	VteStream *text_stream, *attr_stream;
+	gsize text_offset, text_end;
+	gsize attr_offset, attr_end;
+	VteCellAttrChange attr_change, last_attr;
+
+	/* The attr changes read ahead from attr_stream */
+	VteCellAttrChange attr_changes[256];
+	guint n_attr_changes, attr_change_index;
+
+	/* The ring while it lasts, and the lowest offset it rewound the
+	 * text stream to since, or G_MAXSIZE: the text from there on is no
+	 * longer ours */
+	VteRing *ring;
+	gsize text_low_water;
+
+	/* The rows that were still writable */
+	GString *tail;
+	gsize tail_offset;
+	gboolean tail_attr; /* whether the tail sets attributes */
+
+	gboolean attributes;
+	gboolean have_attr;
+	guint32 attr;
+};
+
+/* The ring's streams are about to be rewritten from @text_offset on.
+ * G_MAXSIZE lets go of the writers without failing them, for when the ring
+ * goes away: they hold on to the streams themselves. */
+static void
+_vte_ring_rewind_writers (VteRing *ring, gsize text_offset)
+{
+	GSList *l;
+
+	for (l = ring->writers; l; l = l->next) {
+		VteRingWriter *writer = l->data;
+
+		if (text_offset == G_MAXSIZE)
+			writer->ring = NULL;
+		else
+			writer->text_low_water = MIN (writer->text_low_water, text_offset);
+	}
+}
+
+/* The attributes that show, for telling whether an SGR sequence is due */
+static inline guint32
+_vte_ring_attr_visual (VteCellAttr attr)
+{
+	VteIntCellAttr a;
+
+	a.s = attr;
+	a.s.fragment = 0;
+	a.s.columns = 0;
+	return a.i;
+}
+
+static void
+_vte_ring_append_color (GString *string, guint color, guint base, guint bright_base)
+{
+	if (color < 8)
+		g_string_append_printf (string, ";%u", base + color);
+	else if (color < 16)
+		g_string_append_printf (string, ";%u", bright_base + color - 8);
+	else if (color < 256)
+		g_string_append_printf (string, ";%u;5;%u", base + 8, color);
+}
+
+/* Appends the SGR sequence for @attr, unless it is the one in effect */
+static void
+_vte_ring_writer_set_attr (VteRingWriter *writer, VteCellAttr attr, GString *string)
+{
+	guint32 visual = _vte_ring_attr_visual (attr);
+
+	if (writer->have_attr && writer->attr == visual)
+		return;
+	writer->have_attr = TRUE;
+	writer->attr = visual;
+
+	g_string_append (string, "\033[0");
+	if (attr.bold)
+		g_string_append (string, ";1");
+	if (attr.half)
+		g_string_append (string, ";2");
+	if (attr.underline)
+		g_string_append (string, ";4");
+	if (attr.blink)
+		g_string_append (string, ";5");
+	if (attr.reverse || attr.standout)
+		g_string_append (string, ";7");
+	if (attr.invisible)
+		g_string_append (string, ";8");
+	if (attr.strikethrough)
+		g_string_append (string, ";9");
+	_vte_ring_append_color (string, attr.fore, 30, 90);
+	_vte_ring_append_color (string, attr.back, 40, 100);
+	g_string_append_c (string, 'm');
+}
+
+/**
+ * _vte_ring_writer_new:
+ * @ring: a #VteRing
+ * @start: the first row to write
+ * @end: the row after the last one to write
+ * @flags: a set of #VteTerminalWriteFlags
+ *
+ * Starts reading the contents of the rows from @start to @end in the format
+ * _vte_ring_write_contents() writes them, to hand them out a chunk at a
+ * time with _vte_ring_writer_read().  The writable rows are read right
+ * away; the frozen ones are read as they are needed from the ring's
+ * streams, by text offset, so the rows going on scrolling out of view or
+ * off the ring doesn't disturb the writer, until the streams' contents
+ * themselves are dropped or rewritten.
+ *
+ * Returns: a new #VteRingWriter
+ */
+VteRingWriter *
+_vte_ring_writer_new (VteRing *ring, gulong start, gulong end,
+		      VteTerminalWriteFlags flags)
+{
+	VteRingWriter *writer = g_slice_new0 (VteRingWriter);
+	VteRowRecord record;
+	gulong i;
+
+	writer->text_stream = g_object_ref (ring->text_stream);
+	writer->attr_stream = g_object_ref (ring->attr_stream);
+	writer->last_attr = ring->last_attr;
+	writer->attr_end = _vte_stream_head (ring->attr_stream);
+	writer->attributes = (flags & VTE_TERMINAL_WRITE_ATTRIBUTES) != 0;
+	writer->tail = g_string_new (NULL);
+	writer->ring = ring;
+	writer->text_low_water = G_MAXSIZE;
+	ring->writers = g_slist_prepend (ring->writers, writer);
+
+	start = MAX (start, ring->start);
+	end = MIN (end, ring->end);
+
+	if (start < MIN (end, ring->writable) &&
+	    _vte_ring_read_row_record (ring, &record, start)) {
+		writer->text_offset = record.text_offset;
+		writer->attr_offset = record.attr_offset;
+		if (MIN (end, ring->writable) < ring->writable &&
+		    _vte_ring_read_row_record (ring, &record, end))
+			writer->text_end = record.text_offset;
+		else
+			writer->text_end = _vte_stream_head (ring->text_stream);
+	}
+
+	for (i = MAX (start, ring->writable); i < end; i++) {
+		const VteRowData *row = _vte_ring_writable_index (ring, i);
+		const VteCell *cell;
+		int j;
+
+		for (j = 0, cell = row->cells; j < row->len; j++, cell++) {
+			if (G_UNLIKELY (cell->attr.fragment))
+				continue;
+			if (writer->attributes)
+				_vte_ring_writer_set_attr (writer, cell->attr, writer->tail);
+			_vte_unistr_append_to_string (cell->c, writer->tail);
+		}
+		if (!row->attr.soft_wrapped)
+			g_string_append_c (writer->tail, '\n');
+	}
+	/* The tail leaves the attributes as they were itself, and the frozen
+	 * rows come first, so start over for them */
+	writer->tail_attr = writer->have_attr;
+	if (writer->tail_attr)
+		g_string_append (writer->tail, "\033[0m");
+	writer->have_attr = FALSE;
+
+	_vte_debug_print (VTE_DEBUG_RING,
+			  "Writer for rows %lu to %lu: %"G_GSIZE_FORMAT" bytes "
+			  "frozen, %"G_GSIZE_FORMAT" writable.\n",
+			  start, end, writer->text_end - writer->text_offset,
+			  writer->tail->len);
+
+	return writer;
+}
+
+/* Moves on to the next attr change, reading them a batch at a time */
+static gboolean
+_vte_ring_writer_next_attr (VteRingWriter *writer)
+{
+	if (writer->attr_change_index == writer->n_attr_changes) {
+		guint n = MIN (G_N_ELEMENTS (writer->attr_changes),
+			       (writer->attr_end - writer->attr_offset) / sizeof (VteCellAttrChange));
+
+		if (!n || !_vte_stream_read (writer->attr_stream, writer->attr_offset,
+					     (char *) writer->attr_changes,
+					     n * sizeof (VteCellAttrChange)))
+			return FALSE;
+		writer->attr_offset += n * sizeof (VteCellAttrChange);
+		writer->n_attr_changes = n;
+		writer->attr_change_index = 0;
+	}
+
+	writer->attr_change = writer->attr_changes[writer->attr_change_index++];
+	return TRUE;
+}
+
+/* Appends the frozen text from the writer's offset to @end, with the SGR
+ * sequences for its attributes */
+static gboolean
+_vte_ring_writer_read_attributes (VteRingWriter *writer, GString *buffer,
+				  const char *text, gsize end)
+{
+	gsize offset = writer->text_offset, next;
+	VteCellAttr attr;
+
+	while (offset < end) {
+		if (offset >= writer->last_attr.text_offset) {
+			attr = writer->last_attr.attr.s;
+			next = end;
+		} else {
+			while (offset >= writer->attr_change.text_offset)
+				if (!_vte_ring_writer_next_attr (writer))
+					return FALSE;
+			attr = writer->attr_change.attr.s;
+			next = MIN (end, writer->attr_change.text_offset);
+		}
+
+		_vte_ring_writer_set_attr (writer, attr, buffer);
+		g_string_append_len (buffer, text + (offset - writer->text_offset),
+				     next - offset);
+		offset = next;
+	}
+
+	return TRUE;
+}
+
+/**
+ * _vte_ring_writer_read:
+ * @writer: a #VteRingWriter
+ * @buffer: a #GString to append to
+ * @max: about how many bytes of text to read
+ * @error: a #GError location to store the error occuring, or %NULL to ignore
+ *
+ * Appends the next chunk of contents to @buffer, or nothing once they are
+ * all read.
+ *
+ * Returns: %TRUE on success, %FALSE if the contents were dropped from or
+ *   rewritten in the ring's streams before they were read
+ */
+gboolean
+_vte_ring_writer_read (VteRingWriter *writer, GString *buffer, gsize max,
+		       GError **error)
+{
+	gsize len, old_len = buffer->len;
+	gboolean ok = FALSE;
+
+	if (writer->text_offset < writer->text_end) {
+		len = MIN (max, writer->text_end - writer->text_offset);
+
+		/* Thawing rows or starting the streams over puts new text
+		 * where ours was */
+		if (writer->text_low_water < writer->text_end)
+			ok = FALSE;
+		else if (writer->attributes) {
+			GString *text = g_string_sized_new (len);
+
+			g_string_set_size (text, len);
+			ok = _vte_stream_read (writer->text_stream, writer->text_offset,
+					       text->str, len) &&
+			     _vte_ring_writer_read_attributes (writer, buffer, text->str,
+							       writer->text_offset + len);
+			g_string_free (text, TRUE);
+		} else {
+			g_string_set_size (buffer, old_len + len);
+			ok = _vte_stream_read (writer->text_stream, writer->text_offset,
+					       buffer->str + old_len, len);
+		}
+
+		if (!ok) {
+			g_string_truncate (buffer, old_len);
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+					     "The terminal's scrollback was discarded while being written");
+			return FALSE;
+		}
+		writer->text_offset += len;
+		return TRUE;
+	}
+
+	if (writer->tail_offset < writer->tail->len) {
+		len = MIN (max, writer->tail->len - writer->tail_offset);
+		g_string_append_len (buffer, writer->tail->str + writer->tail_offset, len);
+		writer->tail_offset += len;
+		return TRUE;
+	}
+
+	/* Leave the attributes as they were, unless the tail did */
+	if (writer->attributes && writer->have_attr && !writer->tail_attr) {
+		g_string_append (buffer, "\033[0m");
+		writer->have_attr = FALSE;
+	}
+
+	return TRUE;
+}
+
+void
+_vte_ring_writer_free (VteRingWriter *writer)
+{
+	if (writer->ring)
+		writer->ring->writers = g_slist_remove (writer->ring->writers, writer);
+	g_object_unref (writer->text_stream);
+	g_object_unref (writer->attr_stream);
+	g_string_free (writer->tail, TRUE);
+	g_slice_free (VteRingWriter, writer);
+}
+
+#ifdef RING_MAIN
+/* Checks that thawing rows back into the writable area keeps the attributes
+ * of the rows before them, that writers reset the attributes at their end
+ * and notice rewritten text, and what text the search index looks for.
+ * Given a number of lines, then fills a ring with that many and times
+ * resizing it, searching it with and without the search index, reading its
+ * text with and without thawing rows, and dumping it. */
+
+/* Row 0 is plain, row 1 turns red halfway and row 2 stays red, so that
+ * rows 0 and 1 both start in the first run of the attr stream */
+static VteCell
+check_cell (gulong row, gulong col)
+{
+	VteCell cell = basic_cell.cell;
+
+	cell.c = 'a' + (row + col) % 26;
+	if ((row == 1 && col >= 5) || row == 2)
+		cell.attr.fore = 1;
+	return cell;
+}
+
+static gboolean
+check_rows (VteRing *ring, gulong first, gulong last, const char *when)
+{
+	gulong row, col;
+
+	for (row = first; row < last; row++) {
+		const VteRowData *row_data = _vte_ring_index (ring, row);
+
+		for (col = 0; col < 10; col++) {
+			VteCell cell = check_cell (row, col);
+			const VteCell *got = _vte_row_data_get (row_data, col);
+
+			if (!got || got->c != cell.c || got->attr.fore != cell.attr.fore) {
+				g_printerr ("thaw: row %lu column %lu differs %s\n",
+					    row, col, when);
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static gboolean
+check_thaw (void)
+{
+	VteRing ring[1];
+	gulong row, col;
+	gboolean ok;
+
+	_vte_ring_init (ring, 1000);
+	for (row = 0; row < 100; row++) {
+		VteRowData *row_data = _vte_ring_append (ring);
+		for (col = 0; col < 10; col++) {
+			VteCell cell = check_cell (row, col);
+			_vte_row_data_append (row_data, &cell);
+		}
+	}
+
+	/* Thaw down to row 1, leaving only row 0 frozen */
+	_vte_ring_index_writable (ring, 1);
+	ok = check_rows (ring, 0, 100, "after thawing");
+
+	/* And freeze them all again */
+	for (; ok && row < 200; row++) {
+		VteRowData *row_data = _vte_ring_append (ring);
+		for (col = 0; col < 10; col++) {
+			VteCell cell = check_cell (row, col);
+			_vte_row_data_append (row_data, &cell);
+		}
+	}
+	ok = ok && check_rows (ring, 0, 200, "after freezing again");
+
+	_vte_ring_fini (ring);
+
+	return ok;
+}
+
+/* Checks that a writer resets the attributes that only its writable rows
+ * set, and that it fails once the text it was to read is rewritten */
+static gboolean
+check_writer (void)
+{
+	VteRing ring[1];
+	VteRingWriter *writer;
+	GString *buffer = g_string_new (NULL);
+	gulong row, col;
+	gboolean ok = TRUE;
+
+	_vte_ring_init (ring, 1000);
+	for (row = 0; row < 100; row++) {
+		VteRowData *row_data = _vte_ring_append (ring);
+		for (col = 0; col < 10; col++) {
+			VteCell cell = basic_cell.cell;
+			cell.c = 'a' + (row + col) % 26;
+			if (row == 99)
+				cell.attr.fore = 2;
+			_vte_row_data_append (row_data, &cell);
+		}
+	}
+
+	writer = _vte_ring_writer_new (ring, ring->writable, ring->end,
+				       VTE_TERMINAL_WRITE_ATTRIBUTES);
+	do {
+		row = buffer->len;
+		_vte_ring_writer_read (writer, buffer, 4096, NULL);
+	} while (buffer->len != row);
+	_vte_ring_writer_free (writer);
+	if (!g_str_has_suffix (buffer->str, "\033[0m")) {
+		g_printerr ("writer: attributes of the writable rows not reset\n");
+		ok = FALSE;
+	}
+
+	writer = _vte_ring_writer_new (ring, ring->start, ring->end,
+				       VTE_TERMINAL_WRITE_DEFAULT);
+	/* Thaws rows down to 10, and writes new ones in their place */
+	_vte_ring_index_writable (ring, 10);
+	for (row = 0; row < 100; row++)
+		_vte_ring_append (ring);
+	g_string_truncate (buffer, 0);
+	if (_vte_ring_writer_read (writer, buffer, 4096, NULL)) {
+		g_printerr ("writer: read text that was rewritten\n");
+		ok = FALSE;
+	}
+	_vte_ring_writer_free (writer);
+
+	_vte_ring_fini (ring);
+	g_string_free (buffer, TRUE);
+
+	return ok;
+}
+
+static gboolean
+check_literals (void)
+{
+	static const struct {
+		const char *pattern, *literal;
+	} tests[] = {
+		{ "hello", "hello" },
+		{ "ab+cdef", "cdef" },
+		{ "abcd?ef", "abc" },
+		{ "x(abcd)y", NULL },
+		{ "foo|barbaz", NULL },
+		{ "(?i)hello", NULL },
+		{ "\\x41bcd", NULL },
+		{ "[abc]defg", "defg" },
+		{ "[]x]defg", "defg" },
+		{ "[[:digit:]]abc", "abc" },
+		{ "ab[[:alpha:]]cde", "cde" },
+		{ "[[=e=][.a.]]xyz", "xyz" },
+		{ "[[:digit]abcd", NULL },
+	};
+	gboolean ok = TRUE;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		char *literal = _vte_ring_search_literal (tests[i].pattern);
+		if (g_strcmp0 (literal, tests[i].literal) != 0) {
+			g_printerr ("literal: \"%s\" gave \"%s\", not \"%s\"\n",
+				    tests[i].pattern,
+				    literal ? literal : "(none)",
+				    tests[i].literal ? tests[i].literal : "(none)");
+			ok = FALSE;
+		}
+		g_free (literal);
+	}
+
+	return ok;
+}
+
+static void
+fill_line (VteRing *ring, gulong n, gulong columns)
+{
+	VteRowData *row = _vte_ring_append (ring);
+	VteCell cell = basic_cell.cell;
+	gulong len = (n * 37) % 200, i;
+
+	for (i = 0; i < len; i++) {
+		if ((gulong) row->len == columns) {
+			row->attr.soft_wrapped = 1;
+			row = _vte_ring_append (ring);
+		}
+		cell.c = 'a' + (n + i) % 26;
+		cell.attr.fore = i / 8 % 8;
+		_vte_row_data_append (row, &cell);
+	}
+}
+
+static void
+resize (VteRing *ring, gulong columns, gulong rows)
+{
+	GTimer *timer = g_timer_new ();
+	glong cursor_row = ring->end - 1, cursor_col = 0;
+	gulong shift;
+	gdouble reflow, view, all;
+
+	shift = _vte_ring_reflow (ring, columns, &cursor_row, &cursor_col);
+	reflow = g_timer_elapsed (timer, NULL);
+	_vte_ring_reflow_range (ring, ring->end - rows, ring->end, NULL);
+	view = g_timer_elapsed (timer, NULL);
+	_vte_ring_reflow_range (ring, ring->start, ring->end, NULL);
+	all = g_timer_elapsed (timer, NULL);
+
+	g_print ("%4lu columns: resize %.2f ms, first screen %.2f ms, "
+		 "all %lu rows %.2f ms (rows moved by %lu)\n",
+		 columns, reflow * 1000, view * 1000,
+		 (gulong) _vte_ring_length (ring), all * 1000, shift);
+
+	g_timer_destroy (timer);
+}
+
+/* Goes through the logical lines from the bottom up, thawing their rows
+ * like a search does, and returns how many rows that took */
+static gulong
+search_rows (VteRing *ring, const char *literal)
+{
+	gulong position = ring->end, thawed = 0;
+
+	while (position > ring->start) {
+		position = _vte_ring_search_skip (ring, position, ring->start, TRUE,
+						  literal, FALSE);
+		if (position <= ring->start)
+			break;
+		do {
+			position--;
+			thawed++;
+		} while (position > ring->start &&
+			 _vte_ring_index (ring, position - 1)->attr.soft_wrapped);
+	}
+
+	return thawed;
+}
+
+static void
+search (VteRing *ring, const char *literal)
+{
+	GTimer *timer = g_timer_new ();
+	gulong thawed;
+	gdouble plain, first, indexed;
+
+	thawed = search_rows (ring, literal);
+	plain = g_timer_elapsed (timer, NULL);
+	g_print ("search for \"%s\": %lu rows thawed in %.2f ms\n",
+		 literal, thawed, plain * 1000);
+
+	_vte_ring_set_search_index (ring, TRUE);
+	g_timer_start (timer);
+	search_rows (ring, literal);
+	first = g_timer_elapsed (timer, NULL);
+	g_timer_start (timer);
+	thawed = search_rows (ring, literal);
+	indexed = g_timer_elapsed (timer, NULL);
+	g_print ("  with the index: %lu rows thawed in %.2f ms, "
+		 "%.2f ms with building the index\n",
+		 thawed, indexed * 1000, first * 1000);
+	_vte_ring_set_search_index (ring, FALSE);
+
+	g_timer_destroy (timer);
+}
+
+/* Reads the text of all the frozen rows by thawing them, then straight
+ * from the text stream, checking that the two agree on where lines start */
+static void
+scan (VteRing *ring)
+{
+	GTimer *timer = g_timer_new ();
+	GString *text = g_string_new (NULL);
+	gulong position, first, last, row;
+	gsize thawed = 0, streamed = 0, offset;
+	glong column;
+	gdouble plain, direct;
+	int i, bad = 0;
+
+	for (position = ring->start; position < ring->writable; position++) {
+		const VteRowData *row_data = _vte_ring_index (ring, position);
+
+		g_string_set_size (text, 0);
+		for (i = 0; i < row_data->len; i++)
+			if (!row_data->cells[i].attr.fragment)
+				_vte_unistr_append_to_string (row_data->cells[i].c, text);
+		thawed += text->len + !row_data->attr.soft_wrapped;
+	}
+	plain = g_timer_elapsed (timer, NULL);
+
+	g_timer_start (timer);
+	for (position = ring->start; position < ring->writable; position = last) {
+		first = position;
+		last = position + 256;
+		if (!_vte_ring_read_lines (ring, &first, &last, text, &offset) ||
+		    first != position)
+			break;
+		streamed += text->len;
+
+		if (!_vte_ring_find_cell (ring, first, last, offset, &row, &column) ||
+		    row != first || column != 0)
+			bad++;
+	}
+	direct = g_timer_elapsed (timer, NULL);
+
+	g_print ("read %"G_GSIZE_FORMAT" bytes thawing rows in %.2f ms, "
+		 "%"G_GSIZE_FORMAT" straight from the stream in %.2f ms%s\n",
+		 thawed, plain * 1000, streamed, direct * 1000,
+		 bad ? " (MISPLACED LINES)" : "");
+
+	g_string_free (text, TRUE);
+	g_timer_destroy (timer);
+}
+
+/* Writes the whole ring to /dev/null a chunk at a time, like
+ * vte_terminal_write_contents_async() does */
+static void
+dump (VteRing *ring, VteTerminalWriteFlags flags)
+{
+	GTimer *timer = g_timer_new ();
+	GString *buffer = g_string_new (NULL);
+	GFile *file = g_file_new_for_path ("/dev/null");
+	GOutputStream *stream = G_OUTPUT_STREAM (g_file_append_to (file, G_FILE_CREATE_NONE, NULL, NULL));
+	VteRingWriter *writer;
+	gsize bytes_written, total = 0;
+
+	writer = _vte_ring_writer_new (ring, ring->start, ring->end, flags);
+	do {
+		g_string_truncate (buffer, 0);
+		if (!_vte_ring_writer_read (writer, buffer, VTE_RING_WRITER_CHUNK_SIZE, NULL) ||
+		    !g_output_stream_write_all (stream, buffer->str, buffer->len,
+						&bytes_written, NULL, NULL))
+			break;
+		total += buffer->len;
+	} while (buffer->len);
+	_vte_ring_writer_free (writer);
+
+	g_print ("dump%s: %"G_GSIZE_FORMAT" bytes in %.2f ms\n",
+		 flags & VTE_TERMINAL_WRITE_ATTRIBUTES ? " with attributes" : "",
+		 total, g_timer_elapsed (timer, NULL) * 1000);
+
+	g_object_unref (stream);
+	g_object_unref (file);
+	g_string_free (buffer, TRUE);
+	g_timer_destroy (timer);
+}
+
+int
+main (int argc, char **argv)
+{
+	static const gulong widths[] = { 120, 60, 200, 80 };
+	VteRing ring[1];
+	gulong lines, i;
+
+	g_type_init ();
+
+	if (!check_thaw ())
+		return 1;
+	g_print ("thaw: attributes kept\n");
+	if (!check_writer ())
+		return 1;
+	g_print ("writer: attributes reset, rewritten text noticed\n");
+	if (!check_literals ())
+		return 1;
+	g_print ("literal: search index text as expected\n");
+
+	if (argc < 2)
+		return 0;
+	lines = g_ascii_strtoull (argv[1], NULL, 10);
+
+	_vte_ring_init (ring, lines * 4);
+	_vte_ring_set_columns (ring, 80);
+	for (i = 0; i < lines; i++)
+		fill_line (ring, i, 80);
+
+	g_print ("%lu lines in %lu rows of 80 columns\n",
+		 lines, (gulong) _vte_ring_length (ring));
+
+	for (i = 0; i < G_N_ELEMENTS (widths); i++)
+		resize (ring, widths[i], 24);
+
+	search (ring, "zyx");
+	search (ring, "uvwxy");
+	scan (ring);
+	dump (ring, VTE_TERMINAL_WRITE_DEFAULT);
+	dump (ring, VTE_TERMINAL_WRITE_ATTRIBUTES);
+
+	_vte_ring_fini (ring);
+
+	return 0;
+}
+#endif
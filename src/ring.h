@@ -51,9 +51,11 @@ struct _VteRing {
 	/* Writable */
 	gulong writable, mask;
 	VteRowData *array;
+	VteRowArena *arena;
 
 	/* Storage */
 	gulong last_page;
+	glong row_delta;
 	VteStream *attr_stream, *text_stream, *row_stream;
 	VteCellAttrChange last_attr;
 	GString *utf8_buffer;
@@ -61,6 +63,19 @@ struct _VteRing {
 	VteRowData cached_row;
 	gulong cached_row_num;
 
+	/* Reflow */
+	gulong columns, frozen_max_columns;
+	GArray *reflow_pages;
+	guint reflow_pending;
+
+	/* Search index */
+	GArray *index_blocks;
+	gsize index_base, index_head;
+	guint32 index_window;
+	guint index_fill;
+
+	/* The VteRingWriters reading the streams */
+	GSList *writers;
 };
 
 #define _vte_ring_contains(__ring, __position) \
@@ -76,16 +91,43 @@ VteRowData *_vte_ring_index_writable (VteRing *ring, gulong position);
 void _vte_ring_init (VteRing *ring, gulong max_rows);
 void _vte_ring_fini (VteRing *ring);
 void _vte_ring_resize (VteRing *ring, gulong max_rows);
+void _vte_ring_set_columns (VteRing *ring, gulong columns);
+gulong _vte_ring_reflow (VteRing *ring, gulong columns, glong *cursor_row, glong *cursor_col);
+gboolean _vte_ring_reflow_range (VteRing *ring, gulong first, gulong last, glong *last_moved);
 void _vte_ring_shrink (VteRing *ring, gulong max_len);
+void _vte_ring_trim (VteRing *ring, gulong position);
+gulong _vte_ring_drop_page (VteRing *ring, gulong limit);
 VteRowData *_vte_ring_insert (VteRing *ring, gulong position);
 VteRowData *_vte_ring_append (VteRing *ring);
 void _vte_ring_remove (VteRing *ring, gulong position);
+gsize _vte_ring_get_storage_size (VteRing *ring);
+void _vte_ring_set_search_index (VteRing *ring, gboolean enabled);
+gboolean _vte_ring_update_search_index (VteRing *ring, gsize max_bytes);
+gulong _vte_ring_search_skip (VteRing *ring, gulong position, gulong limit,
+			      gboolean backward,
+			      const char *literal, gboolean caseless);
+char *_vte_ring_search_literal (const char *pattern);
+gboolean _vte_ring_read_lines (VteRing *ring, gulong *first, gulong *last,
+			       GString *text, gsize *offset);
+gboolean _vte_ring_find_cell (VteRing *ring, gulong first, gulong last, gsize offset,
+			      gulong *row, glong *column);
+gulong _vte_ring_append_text (VteRing *ring, gulong first, gulong last, GString *text);
 gboolean _vte_ring_write_contents (VteRing *ring,
 				   GOutputStream *stream,
 				   VteTerminalWriteFlags flags,
 				   GCancellable *cancellable,
 				   GError **error);
 
+#define VTE_RING_WRITER_CHUNK_SIZE (1 << 18)
+
+typedef struct _VteRingWriter VteRingWriter;
+
+VteRingWriter *_vte_ring_writer_new (VteRing *ring, gulong start, gulong end,
+				     VteTerminalWriteFlags flags);
+gboolean _vte_ring_writer_read (VteRingWriter *writer, GString *buffer, gsize max,
+				GError **error);
+void _vte_ring_writer_free (VteRingWriter *writer);
+
 G_END_DECLS
 
 #endif
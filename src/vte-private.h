@@ -73,6 +73,7 @@ G_BEGIN_DECLS
 #define VTE_CHILD_INPUT_PRIORITY	G_PRIORITY_DEFAULT_IDLE
 #define VTE_CHILD_OUTPUT_PRIORITY	G_PRIORITY_HIGH
 #define VTE_FX_PRIORITY			G_PRIORITY_DEFAULT_IDLE
+#define VTE_SEARCH_PRIORITY		G_PRIORITY_DEFAULT_IDLE
 #define VTE_REGCOMP_FLAGS		REG_EXTENDED
 #define VTE_REGEXEC_FLAGS		0
 #define VTE_INPUT_CHUNK_SIZE		0x2000
@@ -81,8 +82,13 @@ G_BEGIN_DECLS
 #define VTE_DISPLAY_TIMEOUT		10
 #define VTE_UPDATE_TIMEOUT		15
 #define VTE_UPDATE_REPEAT_TIMEOUT	30
+#define VTE_SCROLLBACK_BUDGET_TIMEOUT	1000
 #define VTE_MAX_PROCESS_TIME		100
 #define VTE_CELL_BBOX_SLACK		1
+#define VTE_MATCH_CACHE_LINES		256
+#define VTE_SEARCH_SLICE_ROWS		1024
+#define VTE_SEARCH_CHUNK_ROWS		256
+#define VTE_SEARCH_SLICE_INDEX_BYTES	(1 << 20)
 
 #define VTE_UTF8_BPC                    (6) /* Maximum number of bytes used per UTF-8 character */
 
@@ -114,6 +120,7 @@ typedef enum {
 /* A match regex, with a tag. */
 struct vte_match_regex {
 	gint tag;
+	gint group;	/* its group in the combined GRegex, or -1 */
         VteRegexMode mode;
         union { /* switched on |mode| */
               struct {
@@ -130,6 +137,19 @@ struct vte_match_regex {
         } cursor;
 };
 
+/* Where a match regex matched in a line, in bytes. */
+struct vte_match_span {
+	guint regex;	/* index in match_regexes */
+	gint start, end;
+};
+
+/* Where a row of match_contents lies, in bytes, and the line it is part of. */
+struct vte_match_row {
+	gint start;		/* first byte of the row */
+	gint line_start;	/* first byte of its line */
+	gint line_end;		/* the newline ending its line */
+};
+
 /* The terminal's keypad/cursor state.  A terminal can either be using the
  * normal keypad, or the "application" keypad. */
 typedef enum _VteKeymode {
@@ -139,9 +159,21 @@ typedef enum _VteKeymode {
 
 typedef struct _VteScreen VteScreen;
 
-typedef struct _VteWordCharRange {
-	gunichar start, end;
-} VteWordCharRange;
+/* Columns [start, end) of a row that need repainting */
+typedef struct _VteDirtySpan {
+	glong start, end;
+	gboolean keep;		/* repaint even if the cells look unchanged */
+} VteDirtySpan;
+
+/* A cell as it was last painted */
+typedef struct _VtePaintedCell {
+	VteCell cell;
+	guint32 flags;		/* VTE_PAINTED_* */
+} VtePaintedCell;
+
+#define VTE_PAINTED_VALID	(1 << 0)
+#define VTE_PAINTED_SELECTED	(1 << 1)
+#define VTE_PAINTED_HILITE	(1 << 2)
 
 typedef struct _VteVisualPosition {
 	long row, col;
@@ -192,7 +224,17 @@ struct _VteTerminalPrivate {
 			- 2 * sizeof(void *)];
 	} *incoming;			/* pending bytestream */
 	GArray *pending;		/* pending characters */
-	GSList *update_regions;
+	VteDirtySpan *dirty_spans;	/* per visible row, columns to repaint */
+	glong dirty_spans_len;
+	glong dirty_row_start, dirty_row_end;	/* rows that may have a span */
+	gboolean dirty_all;		/* pending repaint of the whole widget */
+	guint dirty_count;		/* invalidations since the last repaint */
+	/* Copy of the last painted viewport, to drop damage for cells
+	 * which were rewritten with the same contents. */
+	VtePaintedCell *painted_cells;
+	glong painted_rows, painted_columns;
+	glong painted_scroll_delta;
+	VteScreen *painted_screen;
 	gboolean invalidated_all;	/* pending refresh of entire terminal */
 	GList *active;                  /* is the terminal processing data */
 	glong input_bytes;
@@ -243,7 +285,7 @@ struct _VteTerminalPrivate {
 	} normal_screen, alternate_screen, *screen;
 
 	/* Selection information. */
-	GArray *word_chars;
+	VteWordChars *word_chars;
 	gboolean has_selection;
 	gboolean selecting;
 	gboolean selecting_restart;
@@ -260,6 +302,16 @@ struct _VteTerminalPrivate {
 	} selection_origin, selection_last;
 	VteVisualPosition selection_start, selection_end;
 
+	/* The copied selection.  Its rows in the scrollback are only read
+	 * into selection when asked for; until then selection holds the
+	 * text of the rows from selection_copied_tail on. */
+	VteRing *selection_copied_ring;
+	VteVisualPosition selection_copied_start, selection_copied_end;
+	gboolean selection_copied_block_mode;
+	glong selection_copied_tail;	/* first row read right away */
+	gsize selection_tail_offset;	/* where its text starts in selection */
+	gboolean selection_pending;
+
 	/* Miscellaneous options. */
 	VteTerminalEraseBinding backspace_binding, delete_binding;
 	gboolean meta_sends_escape;
@@ -280,6 +332,8 @@ struct _VteTerminalPrivate {
 	gboolean scroll_on_output;
 	gboolean scroll_on_keystroke;
 	long scrollback_lines;
+	GList *scrollback_link;		/* our link in the scrollback budget
+					   list, most recently viewed first */
 
 	/* Cursor shape */
 	VteTerminalCursorShape cursor_shape;
@@ -294,6 +348,7 @@ struct _VteTerminalPrivate {
         gboolean cursor_blinks;           /* whether the cursor is actually blinking */
 	gint64 cursor_blink_time;         /* how long the cursor has been blinking yet */
 	gboolean cursor_visible;
+	glong cursor_painted_row;         /* row the cursor was last painted at */
 	gboolean has_focus;               /* is the terminal window focused */
 
 	/* Input device options. */
@@ -309,8 +364,13 @@ struct _VteTerminalPrivate {
 	/* State variables for handling match checks. */
 	char *match_contents;
 	GArray *match_attributes;
+	GArray *match_rows;	/* vte_match_row, one more than the rows */
+	glong match_rows_first;
         VteRegexMode match_regex_mode;
 	GArray *match_regexes;
+	GHashTable *match_cache; /* line text -> GArray of vte_match_span */
+	GRegex *match_combined; /* alternation of the GRegex match regexes */
+	gboolean match_combined_valid;
 	char *match;
 	int match_tag;
 	VteVisualPosition match_start, match_end;
@@ -320,6 +380,9 @@ struct _VteTerminalPrivate {
 	GRegex *search_regex;
 	gboolean search_wrap_around;
 	GArray *search_attrs; /* Cache attrs */
+	GString *search_text; /* Frozen text being searched */
+	char *search_literal; /* Text every match contains, for the ring index */
+	gboolean search_caseless;
 
 	/* Data used when rendering the text which does not require server
 	 * resources and which can be kept after unrealizing. */
@@ -120,6 +120,18 @@ static char *vte_terminal_get_text_maybe_wrapped(VteTerminal *terminal,
 						 gpointer data,
 						 GArray *attributes,
 						 gboolean include_trailing_spaces);
+static void vte_terminal_append_rows(VteTerminal *terminal,
+				     glong first, glong start_col,
+				     glong last, glong end_col,
+				     GString *string);
+static void vte_terminal_append_selected_text(VteTerminal *terminal,
+					      VteRing *ring,
+					      const VteVisualPosition *ss,
+					      const VteVisualPosition *se,
+					      gboolean block_mode,
+					      glong first, glong last,
+					      GString *string);
+static void vte_terminal_selection_read_pending(VteTerminal *terminal);
 static void _vte_terminal_disconnect_pty_read(VteTerminal *terminal);
 static void _vte_terminal_disconnect_pty_write(VteTerminal *terminal);
 static void vte_terminal_stop_processing (VteTerminal *terminal);
@@ -130,6 +142,7 @@ static void vte_terminal_add_process_timeout (VteTerminal *terminal);
 static void add_update_timeout (VteTerminal *terminal);
 static void remove_update_timeout (VteTerminal *terminal);
 static void reset_update_regions (VteTerminal *terminal);
+static void vte_terminal_shift_painted (VteTerminal *terminal, glong delta);
 static void vte_terminal_set_cursor_blinks_internal(VteTerminal *terminal, gboolean blink);
 static void vte_terminal_set_font_full_internal(VteTerminal *terminal,
                                                 const PangoFontDescription *font_desc,
@@ -138,10 +151,13 @@ static void _vte_check_cursor_blink(VteTerminal *terminal);
 
 static gboolean process_timeout (gpointer data);
 static gboolean update_timeout (gpointer data);
+static void vte_terminal_scrollback_viewed (VteTerminal *terminal);
+static void vte_terminal_queue_scrollback_budget_check (void);
 
 enum {
     COPY_CLIPBOARD,
     PASTE_CLIPBOARD,
+    HISTORY_TRIMMED,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL];
@@ -189,6 +205,9 @@ static guint update_timeout_tag = 0;
 static gboolean in_update_timeout;
 static GList *active_terminals;
 static GTimer *process_timer;
+static GList *scrollback_terminals;	/* most recently viewed first */
+static gsize scrollback_budget;
+static guint scrollback_budget_tag = 0;
 
 static const GtkBorder default_inner_border = { 1, 1, 1, 1 };
 
@@ -363,6 +382,164 @@ _vte_terminal_set_default_attributes(VteTerminal *terminal)
 	screen->fill_defaults = screen->defaults;
 }
 
+/* Convert a range of visible cells to the pixel rectangle which has to be
+ * repainted.  Always include the extra pixel border and overlap pixel. */
+static void
+vte_terminal_cells_to_rect (VteTerminal *terminal,
+			    glong column_start, glong column_count,
+			    glong row_start, glong row_count,
+			    VteRegionRectangle *rect)
+{
+	rect->x = column_start * terminal->char_width - 1;
+	if (column_start != 0) {
+		rect->x += terminal->pvt->inner_border.left;
+	}
+	rect->width = (column_start + column_count) * terminal->char_width + 3 + terminal->pvt->inner_border.left;
+	if (column_start + column_count == terminal->column_count) {
+		rect->width += terminal->pvt->inner_border.right;
+	}
+	rect->width -= rect->x;
+
+	rect->y = row_start * terminal->char_height - 1;
+	if (row_start != 0) {
+		rect->y += terminal->pvt->inner_border.top;
+	}
+	rect->height = (row_start + row_count) * terminal->char_height + 2 + terminal->pvt->inner_border.top;
+	if (row_start + row_count == terminal->row_count) {
+		rect->height += terminal->pvt->inner_border.bottom;
+	}
+	rect->height -= rect->y;
+}
+
+/* Whether anything is waiting to be repainted at the next update. */
+static inline gboolean
+vte_terminal_has_dirty (VteTerminal *terminal)
+{
+	return terminal->pvt->dirty_all ||
+	       terminal->pvt->dirty_row_start < terminal->pvt->dirty_row_end;
+}
+
+/* Grow the dirty span of each of the given visible rows to include the
+ * given columns.  The ranges must already be clamped to the screen.  If
+ * @keep, the cells are repainted even if their contents did not change. */
+static void
+vte_terminal_add_dirty_cells (VteTerminal *terminal,
+			      glong column_start, glong column_count,
+			      glong row_start, glong row_count,
+			      gboolean keep)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	glong row, row_end = row_start + row_count;
+
+	if (pvt->dirty_spans_len < terminal->row_count) {
+		pvt->dirty_spans = g_renew (VteDirtySpan, pvt->dirty_spans,
+					    terminal->row_count);
+		memset (pvt->dirty_spans + pvt->dirty_spans_len, 0,
+			(terminal->row_count - pvt->dirty_spans_len) *
+			sizeof (VteDirtySpan));
+		pvt->dirty_spans_len = terminal->row_count;
+	}
+
+	for (row = row_start; row < row_end; row++) {
+		VteDirtySpan *span = &pvt->dirty_spans[row];
+		if (span->start >= span->end) {
+			span->start = column_start;
+			span->end = column_start + column_count;
+		} else {
+			span->start = MIN (span->start, column_start);
+			span->end = MAX (span->end, column_start + column_count);
+		}
+		span->keep |= keep;
+	}
+
+	if (pvt->dirty_row_start >= pvt->dirty_row_end) {
+		pvt->dirty_row_start = row_start;
+		pvt->dirty_row_end = row_end;
+	} else {
+		pvt->dirty_row_start = MIN (pvt->dirty_row_start, row_start);
+		pvt->dirty_row_end = MAX (pvt->dirty_row_end, row_end);
+	}
+	pvt->dirty_count++;
+}
+
+/* Forget about all pending repaints. */
+static void
+vte_terminal_clear_dirty (VteTerminal *terminal)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	glong end = MIN (pvt->dirty_row_end, pvt->dirty_spans_len);
+
+	if (pvt->dirty_row_start < end) {
+		memset (pvt->dirty_spans + pvt->dirty_row_start, 0,
+			(end - pvt->dirty_row_start) * sizeof (VteDirtySpan));
+	}
+	pvt->dirty_row_start = pvt->dirty_row_end = 0;
+	pvt->dirty_all = FALSE;
+	pvt->dirty_count = 0;
+}
+
+/* Build the region to repaint from the dirty spans.  Runs of rows are
+ * merged into a single rectangle as long as that at most doubles the number
+ * of cells covered, so a frame touches a handful of rectangles no matter
+ * how many invalidations led to it. */
+static GdkRegion *
+vte_terminal_get_dirty_region (VteTerminal *terminal, guint *n_rects)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	VteRegionRectangle rect;
+	GdkRegion *region;
+	glong row, last, end;
+	guint n = 0;
+
+	region = gdk_region_new ();
+	end = MIN (MIN (pvt->dirty_row_end, pvt->dirty_spans_len),
+		   terminal->row_count);
+	row = pvt->dirty_row_start;
+	while (row < end) {
+		VteDirtySpan *span = &pvt->dirty_spans[row];
+		glong start, stop, covered;
+
+		if (span->start >= span->end) {
+			row++;
+			continue;
+		}
+		start = span->start;
+		stop = MIN (span->end, terminal->column_count);
+		covered = stop - start;
+		for (last = row + 1; last < end; last++) {
+			VteDirtySpan *next = &pvt->dirty_spans[last];
+			glong s, e, len;
+
+			if (next->start >= next->end) {
+				break;
+			}
+			s = MIN (start, next->start);
+			e = MAX (stop, MIN (next->end, terminal->column_count));
+			len = MIN (next->end, terminal->column_count) - next->start;
+			if ((e - s) * (last - row + 1) > 2 * (covered + len)) {
+				break;
+			}
+			start = s;
+			stop = e;
+			covered += len;
+		}
+		if (start < stop) {
+			vte_terminal_cells_to_rect (terminal,
+						    start, stop - start,
+						    row, last - row,
+						    &rect);
+			gdk_region_union_with_rect (region, &rect);
+			n++;
+		}
+		row = last;
+	}
+
+	if (n_rects != NULL) {
+		*n_rects = n;
+	}
+	return region;
+}
+
 /* Cause certain cells to be repainted. */
 void
 _vte_invalidate_cells(VteTerminal *terminal,
@@ -417,42 +594,24 @@ _vte_invalidate_cells(VteTerminal *terminal,
 		return;
 	}
 
-	/* Convert the column and row start and end to pixel values
-	 * by multiplying by the size of a character cell.
-	 * Always include the extra pixel border and overlap pixel.
-	 */
-	rect.x = column_start * terminal->char_width - 1;
-	if (column_start != 0) {
-		rect.x += terminal->pvt->inner_border.left;
-	}
-	rect.width = (column_start + column_count) * terminal->char_width + 3 + terminal->pvt->inner_border.left;
-	if (column_start + column_count == terminal->column_count) {
-		rect.width += terminal->pvt->inner_border.right;
-	}
-	rect.width -= rect.x;
-
-	rect.y = row_start * terminal->char_height - 1;
-	if (row_start != 0) {
-		rect.y += terminal->pvt->inner_border.top;
-	}
-	rect.height = (row_start + row_count) * terminal->char_height + 2 + terminal->pvt->inner_border.top;
-	if (row_start + row_count == terminal->row_count) {
-		rect.height += terminal->pvt->inner_border.bottom;
-	}
-	rect.height -= rect.y;
-
-	_vte_debug_print (VTE_DEBUG_UPDATES,
-			"Invalidating pixels at (%d,%d)x(%d,%d).\n",
-			rect.x, rect.y, rect.width, rect.height);
-
 	if (terminal->pvt->active != NULL) {
-		terminal->pvt->update_regions = g_slist_prepend (
-				terminal->pvt->update_regions,
-				gdk_region_rectangle (&rect));
+		/* Only note down which cells changed; the spans are turned
+		 * into a region once per frame in update_regions(). */
+		vte_terminal_add_dirty_cells (terminal,
+					      column_start, column_count,
+					      row_start, row_count,
+					      FALSE);
 		/* Wait a bit before doing any invalidation, just in
 		 * case updates are coming in really soon. */
 		add_update_timeout (terminal);
 	} else {
+		vte_terminal_cells_to_rect (terminal,
+					    column_start, column_count,
+					    row_start, row_count,
+					    &rect);
+		_vte_debug_print (VTE_DEBUG_UPDATES,
+				"Invalidating pixels at (%d,%d)x(%d,%d).\n",
+				rect.x, rect.y, rect.width, rect.height);
 		gdk_window_invalidate_rect (gtk_widget_get_window (&terminal->widget), &rect, FALSE);
 	}
 
@@ -513,8 +672,8 @@ _vte_invalidate_all(VteTerminal *terminal)
 	terminal->pvt->invalidated_all = TRUE;
 
 	if (terminal->pvt->active != NULL) {
-		terminal->pvt->update_regions = g_slist_prepend (NULL,
-				gdk_region_rectangle (&rect));
+		terminal->pvt->dirty_all = TRUE;
+		terminal->pvt->dirty_count++;
 		/* Wait a bit before doing any invalidation, just in
 		 * case updates are coming in really soon. */
 		add_update_timeout (terminal);
@@ -546,6 +705,54 @@ _vte_terminal_scroll_region (VteTerminal *terminal,
 	}
 }
 
+/* Scroll the visible rows by @delta rows, negative = up, by moving what is
+ * already in the window instead of repainting it.  Only works over a solid
+ * background.  Returns FALSE if the caller has to repaint instead. */
+static gboolean
+_vte_terminal_scroll_window (VteTerminal *terminal, glong delta)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	GdkWindow *window = gtk_widget_get_window (&terminal->widget);
+	VteRegionRectangle rect;
+	GdkRegion *region;
+
+	if (pvt->scroll_background || pvt->bg_transparent ||
+	    pvt->bg_pixbuf != NULL || pvt->bg_file != NULL ||
+	    pvt->invalidated_all || pvt->dirty_all ||
+	    ABS (delta) >= terminal->row_count)
+		return FALSE;
+
+	_vte_debug_print (VTE_DEBUG_UPDATES,
+			"Scrolling window contents by %ld rows.\n", delta);
+
+	/* Updates still pending were queued for the old or the new view;
+	 * hand them to GDK now so that they move along with the contents,
+	 * and keep them for the new view as well. */
+	if (pvt->dirty_row_start < pvt->dirty_row_end) {
+		region = vte_terminal_get_dirty_region (terminal, NULL);
+		gdk_window_invalidate_region (window, region, FALSE);
+		gdk_region_destroy (region);
+	}
+
+	rect.x = pvt->inner_border.left;
+	rect.y = pvt->inner_border.top;
+	rect.width = terminal->column_count * terminal->char_width;
+	rect.height = terminal->row_count * terminal->char_height;
+	region = gdk_region_rectangle (&rect);
+	/* Invalidates the rows that scroll in */
+	gdk_window_move_region (window, region, 0, delta * terminal->char_height);
+	gdk_region_destroy (region);
+	vte_terminal_shift_painted (terminal, delta);
+
+	/* The cursor moved along with its row */
+	_vte_invalidate_cells (terminal,
+			       0, terminal->column_count,
+			       pvt->cursor_painted_row, 1);
+	_vte_invalidate_cursor_once (terminal, FALSE);
+
+	return TRUE;
+}
+
 /* Find the row in the given position in the backscroll buffer. */
 static inline const VteRowData *
 _vte_terminal_find_row_data (VteTerminal *terminal, glong row)
@@ -1113,6 +1320,10 @@ vte_terminal_match_contents_clear(VteTerminal *terminal)
 		g_array_free(terminal->pvt->match_attributes, TRUE);
 		terminal->pvt->match_attributes = NULL;
 	}
+	if (terminal->pvt->match_rows != NULL) {
+		g_array_free(terminal->pvt->match_rows, TRUE);
+		terminal->pvt->match_rows = NULL;
+	}
 	vte_terminal_match_hilite_clear(terminal);
 }
 
@@ -1123,6 +1334,64 @@ always_selected(VteTerminal *terminal, glong column, glong row, gpointer data)
 	return TRUE;
 }
 
+/* Index where each row of the screen contents starts, and the bounds of the
+ * line it belongs to, so that a cell maps to its text without a scan. */
+static void
+vte_terminal_match_rows_refresh(VteTerminal *terminal)
+{
+	const char *contents = terminal->pvt->match_contents;
+	GArray *attributes = terminal->pvt->match_attributes;
+	struct _VteCharAttributes *attr;
+	struct vte_match_row mrow, *prow;
+	GArray *rows;
+	glong first, row;
+	gint offset, line_start, line_end;
+
+	first = terminal->pvt->screen->scroll_delta;
+	rows = g_array_sized_new(FALSE, FALSE, sizeof(struct vte_match_row),
+				 terminal->row_count + 1);
+
+	/* The start of each row, and of the line it is part of. */
+	line_start = 0;
+	row = first;
+	for (offset = 0; offset <= (gint) attributes->len; offset++) {
+		if (offset == (gint) attributes->len) {
+			/* One past the last row */
+			row = first + terminal->row_count;
+		} else {
+			attr = &g_array_index(attributes,
+					      struct _VteCharAttributes,
+					      offset);
+			row = MAX(attr->row, row);
+		}
+		while (first + (glong) rows->len <= row) {
+			mrow.start = offset;
+			mrow.line_start = line_start;
+			mrow.line_end = offset;
+			g_array_append_val(rows, mrow);
+		}
+		if (contents[offset] == '\n' || contents[offset] == '\0') {
+			line_start = offset + 1;
+		}
+	}
+
+	/* The end of the line each row is part of. */
+	line_end = attributes->len;
+	for (row = rows->len - 1; row-- > 0; ) {
+		prow = &g_array_index(rows, struct vte_match_row, row);
+		for (offset = prow[1].start; offset-- > prow->start; ) {
+			if (contents[offset] == '\n' ||
+			    contents[offset] == '\0') {
+				line_end = offset;
+			}
+		}
+		prow->line_end = line_end;
+	}
+
+	terminal->pvt->match_rows = rows;
+	terminal->pvt->match_rows_first = first;
+}
+
 static void
 vte_terminal_match_contents_refresh(VteTerminal *terminal)
 {
@@ -1134,6 +1403,22 @@ vte_terminal_match_contents_refresh(VteTerminal *terminal)
 							      NULL,
 							      array);
 	terminal->pvt->match_attributes = array;
+	vte_terminal_match_rows_refresh(terminal);
+}
+
+/* Forget the matches found in lines and the combined regex, for when the
+ * regexes change. */
+static void
+vte_terminal_match_regexes_changed(VteTerminal *terminal)
+{
+	if (terminal->pvt->match_cache != NULL) {
+		g_hash_table_remove_all(terminal->pvt->match_cache);
+	}
+	if (terminal->pvt->match_combined != NULL) {
+		g_regex_unref(terminal->pvt->match_combined);
+		terminal->pvt->match_combined = NULL;
+	}
+	terminal->pvt->match_combined_valid = FALSE;
 }
 
 static void
@@ -1228,6 +1513,7 @@ vte_terminal_match_clear_all(VteTerminal *terminal)
 		}
 	}
 	g_array_set_size(terminal->pvt->match_regexes, 0);
+	vte_terminal_match_regexes_changed(terminal);
 	vte_terminal_match_hilite_clear(terminal);
 }
 
@@ -1257,6 +1543,7 @@ vte_terminal_match_remove(VteTerminal *terminal, int tag)
 		/* Remove this item and leave a hole in its place. */
                 regex_match_clear (regex);
 	}
+	vte_terminal_match_regexes_changed(terminal);
 	vte_terminal_match_hilite_clear(terminal);
 }
 
@@ -1316,6 +1603,7 @@ vte_terminal_match_add(VteTerminal *terminal, const char *match)
 	}
 	/* Set the tag to the insertion point. */
 	new_regex.tag = ret;
+	new_regex.group = -1;
         new_regex.cursor_mode = VTE_REGEX_CURSOR_GDKCURSORTYPE;
         new_regex.cursor.cursor_type = VTE_DEFAULT_CURSOR;
 	if (ret < terminal->pvt->match_regexes->len) {
@@ -1327,6 +1615,7 @@ vte_terminal_match_add(VteTerminal *terminal, const char *match)
 		/* Append. */
 		g_array_append_val(terminal->pvt->match_regexes, new_regex);
 	}
+	vte_terminal_match_regexes_changed(terminal);
 	return new_regex.tag;
 }
 
@@ -1374,6 +1663,7 @@ vte_terminal_match_add_gregex(VteTerminal *terminal, GRegex *regex, GRegexMatchF
         new_regex_match.regex.gregex.regex = g_regex_ref(regex);
         new_regex_match.regex.gregex.flags = flags;
 	new_regex_match.tag = ret;
+	new_regex_match.group = -1;
         new_regex_match.cursor_mode = VTE_REGEX_CURSOR_GDKCURSORTYPE;
         new_regex_match.cursor.cursor_type = VTE_DEFAULT_CURSOR;
 	if (ret < pvt->match_regexes->len) {
@@ -1385,6 +1675,7 @@ vte_terminal_match_add_gregex(VteTerminal *terminal, GRegex *regex, GRegexMatchF
 		/* Append. */
 		g_array_append_val(pvt->match_regexes, new_regex_match);
 	}
+	vte_terminal_match_regexes_changed(terminal);
 
 	return new_regex_match.tag;
 }
@@ -1474,125 +1765,20 @@ vte_terminal_match_set_cursor_name(VteTerminal *terminal,
 	vte_terminal_match_hilite_clear(terminal);
 }
 
-/* Check if a given cell on the screen contains part of a matched string.  If
- * it does, return the string, and store the match tag in the optional tag
- * argument. */
-static char *
-vte_terminal_match_check_internal_vte(VteTerminal *terminal,
-                                      long column, glong row,
-                                      int *tag, int *start, int *end)
+/* Finds the matches of the _vte_regex regexes in @line, which is @len
+ * bytes long, in the order vte_terminal_match_check_internal() looks at
+ * them. */
+static void
+vte_terminal_match_line_vte(VteTerminal *terminal, const char *line,
+			    gssize len, GArray *spans)
 {
 	struct _vte_regex_match matches[256];
+	struct vte_match_regex *regex;
+	struct vte_match_span span;
 	guint i, j;
 	gint k;
-	gint start_blank, end_blank;
-	int ret, offset;
-	struct vte_match_regex *regex = NULL;
-	struct _VteCharAttributes *attr = NULL;
-	gssize sattr, eattr;
-	gchar *line, eol;
-
-	_vte_debug_print(VTE_DEBUG_EVENTS,
-			"Checking for match at (%ld,%ld).\n", row, column);
-	*tag = -1;
-	if (start != NULL) {
-		*start = 0;
-	}
-	if (end != NULL) {
-		*end = 0;
-	}
-	/* Map the pointer position to a portion of the string. */
-	eattr = terminal->pvt->match_attributes->len;
-	for (offset = eattr; offset--; ) {
-		attr = &g_array_index(terminal->pvt->match_attributes,
-				      struct _VteCharAttributes,
-				      offset);
-		if (row < attr->row) {
-			eattr = offset;
-		}
-		if (row == attr->row &&
-		    column == attr->column &&
-		    terminal->pvt->match_contents[offset] != ' ') {
-			break;
-		}
-	}
-
-	_VTE_DEBUG_IF(VTE_DEBUG_EVENTS) {
-		if (offset < 0)
-			g_printerr("Cursor is not on a character.\n");
-		else
-			g_printerr("Cursor is on character '%c' at %d.\n",
-					g_utf8_get_char (terminal->pvt->match_contents + offset),
-					offset);
-	}
-
-	/* If the pointer isn't on a matchable character, bug out. */
-	if (offset < 0) {
-		return NULL;
-	}
-
-	/* If the pointer is on a newline, bug out. */
-	if ((g_ascii_isspace(terminal->pvt->match_contents[offset])) ||
-	    (terminal->pvt->match_contents[offset] == '\0')) {
-		_vte_debug_print(VTE_DEBUG_EVENTS,
-				"Cursor is on whitespace.\n");
-		return NULL;
-	}
-
-	/* Snip off any final newlines. */
-	while (terminal->pvt->match_contents[eattr] == '\n' ||
-			terminal->pvt->match_contents[eattr] == '\0') {
-		eattr--;
-	}
-	/* and scan forwards to find the end of this line */
-	while (!(terminal->pvt->match_contents[eattr] == '\n' ||
-			terminal->pvt->match_contents[eattr] == '\0')) {
-		eattr++;
-	}
-
-	/* find the start of row */
-	if (row == 0) {
-		sattr = 0;
-	} else {
-		for (sattr = offset; sattr > 0; sattr--) {
-			attr = &g_array_index(terminal->pvt->match_attributes,
-					      struct _VteCharAttributes,
-					      sattr);
-			if (row > attr->row) {
-				break;
-			}
-		}
-	}
-	/* Scan backwards to find the start of this line */
-	while (sattr > 0 &&
-		! (terminal->pvt->match_contents[sattr] == '\n' ||
-		    terminal->pvt->match_contents[sattr] == '\0')) {
-		sattr--;
-	}
-	/* and skip any initial newlines. */
-	while (terminal->pvt->match_contents[sattr] == '\n' ||
-		terminal->pvt->match_contents[sattr] == '\0') {
-		sattr++;
-	}
-	if (eattr <= sattr) { /* blank line */
-		return NULL;
-	}
-	if (eattr <= offset || sattr > offset) {
-		/* nothing to match on this line */
-		return NULL;
-	}
-	offset -= sattr;
-	eattr -= sattr;
-
-	/* temporarily shorten the contents to this row */
-	line = terminal->pvt->match_contents + sattr;
-	eol = line[eattr];
-	line[eattr] = '\0';
-
-	start_blank = 0;
-	end_blank = eattr;
+	int ret;
 
-	/* Now iterate over each regex we need to match against. */
 	for (i = 0; i < terminal->pvt->match_regexes->len; i++) {
 		regex = &g_array_index(terminal->pvt->match_regexes,
 				       struct vte_match_regex,
@@ -1601,86 +1787,30 @@ vte_terminal_match_check_internal_vte(VteTerminal *terminal,
 		if (regex->tag < 0) {
 			continue;
 		}
-		/* We'll only match the first item in the buffer which
-		 * matches, so we'll have to skip each match until we
-		 * stop getting matches. */
+		/* The regex only gives us the first match in the string,
+		 * so we have to skip past each match to find more. */
 		k = 0;
 		ret = _vte_regex_exec(regex->regex.reg,
 				      line + k,
 				      G_N_ELEMENTS(matches),
 				      matches);
 		while (ret == 0) {
-			gint ko = offset - k;
-			gint sblank=G_MININT, eblank=G_MAXINT;
 			for (j = 0;
 			     j < G_N_ELEMENTS(matches) &&
 			     matches[j].rm_so != -1;
 			     j++) {
 				/* The offsets should be "sane". */
-				g_assert(matches[j].rm_so + k < eattr);
-				g_assert(matches[j].rm_eo + k <= eattr);
-				_VTE_DEBUG_IF(VTE_DEBUG_MISC) {
-					gchar *match;
-					struct _VteCharAttributes *_sattr, *_eattr;
-					match = g_strndup(line + matches[j].rm_so + k,
-							matches[j].rm_eo - matches[j].rm_so);
-					_sattr = &g_array_index(terminal->pvt->match_attributes,
-							struct _VteCharAttributes,
-							matches[j].rm_so + k);
-					_eattr = &g_array_index(terminal->pvt->match_attributes,
-							struct _VteCharAttributes,
-							matches[j].rm_eo + k - 1);
-					g_printerr("Match %u `%s' from %d(%ld,%ld) to %d(%ld,%ld) (%d).\n",
-							j, match,
-							matches[j].rm_so + k,
-							_sattr->column,
-							_sattr->row,
-							matches[j].rm_eo + k - 1,
-							_eattr->column,
-							_eattr->row,
-							offset);
-					g_free(match);
-
-				}
-				/* If the pointer is in this substring,
-				 * then we're done. */
-				if (ko >= matches[j].rm_so &&
-				    ko < matches[j].rm_eo) {
-					gchar *result;
-					if (tag != NULL) {
-						*tag = regex->tag;
-					}
-					if (start != NULL) {
-						*start = sattr + k + matches[j].rm_so;
-					}
-					if (end != NULL) {
-						*end = sattr + k + matches[j].rm_eo - 1;
-					}
-                                        vte_terminal_set_cursor_from_regex_match(terminal, regex);
-					result = g_strndup(line + k + matches[j].rm_so,
-							 matches[j].rm_eo - matches[j].rm_so);
-					line[eattr] = eol;
-					return result;
-				}
-				if (ko > matches[j].rm_eo &&
-						matches[j].rm_eo > sblank) {
-					sblank = matches[j].rm_eo;
-				}
-				if (ko < matches[j].rm_so &&
-						matches[j].rm_so < eblank) {
-					eblank = matches[j].rm_so;
-				}
-			}
-			if (k + sblank > start_blank) {
-				start_blank = k + sblank;
-			}
-			if (k + eblank < end_blank) {
-				end_blank = k + eblank;
+				g_assert(matches[j].rm_so + k < len);
+				g_assert(matches[j].rm_eo + k <= len);
+				span.regex = i;
+				span.start = k + matches[j].rm_so;
+				span.end = k + matches[j].rm_eo;
+				g_array_append_val(spans, span);
 			}
 			/* Skip past the beginning of this match to
 			 * look for more. */
 			k += matches[0].rm_so + 1;
-			if (k > offset) {
+			if (k >= len) {
 				break;
 			}
 			ret = _vte_regex_exec(regex->regex.reg,
@@ -1689,115 +1819,386 @@ vte_terminal_match_check_internal_vte(VteTerminal *terminal,
 					      matches);
 		}
 	}
-	line[eattr] = eol;
-	if (start != NULL) {
-		*start = sattr + start_blank;
-	}
-	if (end != NULL) {
-		*end = sattr + end_blank;
-	}
-	return NULL;
 }
 
-/* Check if a given cell on the screen contains part of a matched string.  If
- * it does, return the string, and store the match tag in the optional tag
- * argument. */
-static char *
-vte_terminal_match_check_internal_gregex(VteTerminal *terminal,
-                                         long column, glong row,
-                                         int *tag, int *start, int *end)
+/* The compile flags a regex can carry into the combined regex as inline
+ * options, or that don't matter there */
+#define VTE_MATCH_COMBINED_FLAGS (G_REGEX_CASELESS | G_REGEX_MULTILINE | \
+				  G_REGEX_DOTALL | G_REGEX_EXTENDED | \
+				  G_REGEX_UNGREEDY | G_REGEX_NO_AUTO_CAPTURE | \
+				  G_REGEX_OPTIMIZE)
+
+/* Whether the match regex can be one branch of the combined regex, where
+ * it must match the same text as on its own.  Group numbers shift there,
+ * and other branches may use the same group names, so it can't refer to
+ * groups at all, and a branch that matches the empty string would shadow
+ * the branches after it. */
+static gboolean
+vte_terminal_match_regex_combinable(struct vte_match_regex *regex)
 {
-	gint start_blank, end_blank;
-        guint i;
-	int offset;
-	struct vte_match_regex *regex = NULL;
-	struct _VteCharAttributes *attr = NULL;
-	gssize sattr, eattr;
-	gchar *line, eol;
-        GMatchInfo *match_info;
+	static GRegexCompileFlags default_flags = -1;
+	GRegexCompileFlags flags;
+	const char *p;
 
-	_vte_debug_print(VTE_DEBUG_EVENTS,
-			"Checking for gregex match at (%ld,%ld).\n", row, column);
-	*tag = -1;
-	if (start != NULL) {
-		*start = 0;
+	if (regex->regex.gregex.flags != 0) {
+		return FALSE;
 	}
-	if (end != NULL) {
-		*end = 0;
+
+	/* Older GLib reports internal flags too, so compare with those of
+	 * a plain regex */
+	if (default_flags == (GRegexCompileFlags) -1) {
+		GRegex *plain = g_regex_new("", 0, 0, NULL);
+		default_flags = g_regex_get_compile_flags(plain);
+		g_regex_unref(plain);
 	}
-	/* Map the pointer position to a portion of the string. */
-	eattr = terminal->pvt->match_attributes->len;
-	for (offset = eattr; offset--; ) {
-		attr = &g_array_index(terminal->pvt->match_attributes,
-				      struct _VteCharAttributes,
-				      offset);
-		if (row < attr->row) {
-			eattr = offset;
-		}
-		if (row == attr->row &&
-		    column == attr->column &&
-		    terminal->pvt->match_contents[offset] != ' ') {
-			break;
-		}
+	flags = g_regex_get_compile_flags(regex->regex.gregex.regex);
+	if ((flags ^ default_flags) & ~VTE_MATCH_COMBINED_FLAGS) {
+		return FALSE;
 	}
 
-	_VTE_DEBUG_IF(VTE_DEBUG_EVENTS) {
-		if (offset < 0)
-			g_printerr("Cursor is not on a character.\n");
-		else
-			g_printerr("Cursor is on character '%c' at %d.\n",
-					g_utf8_get_char (terminal->pvt->match_contents + offset),
-					offset);
+	for (p = g_regex_get_pattern(regex->regex.gregex.regex); *p; p++) {
+		if (p[0] == '\\' && p[1] != '\0') {
+			p++;
+			/* \1, \g{1}, \g{name}, \k<name>... */
+			if ((*p >= '1' && *p <= '9') || *p == 'g' || *p == 'k') {
+				return FALSE;
+			}
+		} else if (p[0] == '(' && p[1] == '?') {
+			if (strchr("0123456789+-R(&", p[2]) != NULL ||
+			    (p[2] == 'P' && (p[3] == '>' || p[3] == '='))) {
+				return FALSE;
+			}
+		}
 	}
 
-	/* If the pointer isn't on a matchable character, bug out. */
-	if (offset < 0) {
-		return NULL;
-	}
+	return !g_regex_match(regex->regex.gregex.regex, "", 0, NULL);
+}
 
-	/* If the pointer is on a newline, bug out. */
-	if ((g_ascii_isspace(terminal->pvt->match_contents[offset])) ||
-	    (terminal->pvt->match_contents[offset] == '\0')) {
-		_vte_debug_print(VTE_DEBUG_EVENTS,
-				"Cursor is on whitespace.\n");
-		return NULL;
-	}
+/* Builds an alternation of all the GRegex match regexes that allow it, each
+ * in a named group, so that a single pass over a line finds their matches
+ * and the group that matched tells the regex apart. */
+static void
+vte_terminal_match_combine(VteTerminal *terminal)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	struct vte_match_regex *regex;
+	GRegexCompileFlags flags;
+	GString *pattern;
+	char name[16];
+	guint i, n = 0;
 
-	/* Snip off any final newlines. */
-	while (terminal->pvt->match_contents[eattr] == '\n' ||
-			terminal->pvt->match_contents[eattr] == '\0') {
-		eattr--;
-	}
-	/* and scan forwards to find the end of this line */
-	while (!(terminal->pvt->match_contents[eattr] == '\n' ||
-			terminal->pvt->match_contents[eattr] == '\0')) {
-		eattr++;
-	}
+	pvt->match_combined_valid = TRUE;
 
-	/* find the start of row */
-	if (row == 0) {
-		sattr = 0;
-	} else {
-		for (sattr = offset; sattr > 0; sattr--) {
-			attr = &g_array_index(terminal->pvt->match_attributes,
-					      struct _VteCharAttributes,
-					      sattr);
-			if (row > attr->row) {
-				break;
-			}
+	pattern = g_string_new(NULL);
+	for (i = 0; i < pvt->match_regexes->len; i++) {
+		regex = &g_array_index(pvt->match_regexes,
+				       struct vte_match_regex,
+				       i);
+		regex->group = -1;
+		if (regex->tag < 0 ||
+		    !vte_terminal_match_regex_combinable(regex)) {
+			continue;
+		}
+
+		flags = g_regex_get_compile_flags(regex->regex.gregex.regex);
+		if (pattern->len) {
+			g_string_append_c(pattern, '|');
+		}
+		g_string_append_printf(pattern, "(?P<vte%u>", i);
+		/* The regex's own flags become inline options for its branch */
+		if (flags & (G_REGEX_CASELESS | G_REGEX_MULTILINE |
+			     G_REGEX_DOTALL | G_REGEX_EXTENDED |
+			     G_REGEX_UNGREEDY)) {
+			g_string_append_printf(pattern, "(?%s%s%s%s%s)",
+					       flags & G_REGEX_CASELESS ? "i" : "",
+					       flags & G_REGEX_MULTILINE ? "m" : "",
+					       flags & G_REGEX_DOTALL ? "s" : "",
+					       flags & G_REGEX_EXTENDED ? "x" : "",
+					       flags & G_REGEX_UNGREEDY ? "U" : "");
 		}
+		g_string_append(pattern,
+				g_regex_get_pattern(regex->regex.gregex.regex));
+		/* A comment in extended mode runs to the end of the line */
+		g_string_append(pattern,
+				flags & G_REGEX_EXTENDED ? "\n)" : ")");
+		n++;
 	}
-	/* Scan backwards to find the start of this line */
-	while (sattr > 0 &&
-		! (terminal->pvt->match_contents[sattr] == '\n' ||
-		    terminal->pvt->match_contents[sattr] == '\0')) {
-		sattr--;
+
+	if (n >= 2) {
+		pvt->match_combined = g_regex_new(pattern->str,
+						  G_REGEX_OPTIMIZE | G_REGEX_DUPNAMES,
+						  0, NULL);
+	}
+	g_string_free(pattern, TRUE);
+
+	_vte_debug_print(VTE_DEBUG_MISC,
+			"Combined %u of %u match regexes%s.\n",
+			pvt->match_combined ? n : 0, pvt->match_regexes->len,
+			n >= 2 && !pvt->match_combined ? " (failed)" : "");
+
+	if (pvt->match_combined == NULL) {
+		return;
+	}
+	for (i = 0; i < pvt->match_regexes->len; i++) {
+		regex = &g_array_index(pvt->match_regexes,
+				       struct vte_match_regex,
+				       i);
+		if (regex->tag < 0 ||
+		    !vte_terminal_match_regex_combinable(regex)) {
+			continue;
+		}
+		g_snprintf(name, sizeof(name), "vte%u", i);
+		regex->group = g_regex_get_string_number(pvt->match_combined, name);
+	}
+}
+
+static gint
+vte_match_span_compare(gconstpointer a, gconstpointer b)
+{
+	const struct vte_match_span *A = a, *B = b;
+
+	if (A->regex != B->regex) {
+		return A->regex < B->regex ? -1 : 1;
+	}
+	return A->start - B->start;
+}
+
+/* Finds the matches of the GRegex regexes in @line, which is @len bytes
+ * long, in the order vte_terminal_match_check_internal() looks at them.
+ * Each regex gets the same matches as if it went over the line on its own.
+ * The combined regex finds, one after the other, the places where any of
+ * them matches; there each regex that is not still inside a match of its
+ * own is tried, anchored, so that a match of one doesn't hide those of
+ * others it overlaps. */
+static void
+vte_terminal_match_line_gregex(VteTerminal *terminal, const char *line,
+			       gssize len, GArray *spans)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	struct vte_match_regex *regex;
+	struct vte_match_span span;
+	GMatchInfo *match_info;
+	gint rm_so, rm_eo, start, *last_end;
+	guint i;
+
+	if (!pvt->match_combined_valid) {
+		vte_terminal_match_combine(terminal);
+	}
+
+	if (pvt->match_combined != NULL) {
+		/* where the last match of each regex ended */
+		last_end = g_newa(gint, pvt->match_regexes->len);
+		memset(last_end, 0, pvt->match_regexes->len * sizeof(gint));
+
+		start = 0;
+		while (start < len) {
+			if (!g_regex_match_full(pvt->match_combined,
+						line, len, start, 0,
+						&match_info,
+						NULL)) {
+				g_match_info_free(match_info);
+				break;
+			}
+			g_match_info_fetch_pos(match_info, 0, &rm_so, &rm_eo);
+			g_match_info_free(match_info);
+
+			for (i = 0; i < pvt->match_regexes->len; i++) {
+				regex = &g_array_index(pvt->match_regexes,
+						       struct vte_match_regex,
+						       i);
+				if (regex->group < 0 || last_end[i] > rm_so) {
+					continue;
+				}
+				if (g_regex_match_full(regex->regex.gregex.regex,
+						       line, len, rm_so,
+						       G_REGEX_MATCH_ANCHORED,
+						       &match_info,
+						       NULL) &&
+				    g_match_info_fetch_pos(match_info, 0,
+							   &span.start,
+							   &span.end)) {
+					span.regex = i;
+					g_array_append_val(spans, span);
+					last_end[i] = span.end;
+				}
+				g_match_info_free(match_info);
+			}
+
+			start = g_utf8_next_char(line + rm_so) - line;
+		}
+	}
+
+	for (i = 0; i < pvt->match_regexes->len; i++) {
+		regex = &g_array_index(pvt->match_regexes,
+				       struct vte_match_regex,
+				       i);
+		/* Skip holes, and the regexes matched above. */
+		if (regex->tag < 0 || regex->group >= 0) {
+			continue;
+		}
+		if (!g_regex_match_full(regex->regex.gregex.regex,
+					line, len, 0,
+					regex->regex.gregex.flags,
+					&match_info,
+					NULL)) {
+			g_match_info_free(match_info);
+			continue;
+		}
+
+		while (g_match_info_matches(match_info)) {
+			if (g_match_info_fetch_pos (match_info, 0, &rm_so, &rm_eo)) {
+				/* The offsets should be "sane". */
+				g_assert(rm_so < len);
+				g_assert(rm_eo <= len);
+				span.regex = i;
+				span.start = rm_so;
+				span.end = rm_eo;
+				g_array_append_val(spans, span);
+			}
+			g_match_info_next(match_info, NULL);
+		}
+
+		g_match_info_free(match_info);
+	}
+
+	/* Back to the order of the regexes */
+	if (pvt->match_combined != NULL) {
+		g_array_sort(spans, vte_match_span_compare);
+	}
+}
+
+/* Gets the matches in @line.  They are cached by the text of the line, so
+ * moving the pointer around a line that didn't change is a lookup, even
+ * when other lines did. */
+static GArray *
+vte_terminal_match_line(VteTerminal *terminal, const char *line, gssize len)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	GArray *spans;
+
+	if (pvt->match_cache == NULL) {
+		pvt->match_cache = g_hash_table_new_full(g_str_hash,
+							 g_str_equal,
+							 g_free,
+							 (GDestroyNotify) g_array_unref);
+	}
+
+	spans = g_hash_table_lookup(pvt->match_cache, line);
+	if (spans != NULL) {
+		return spans;
+	}
+
+	if (g_hash_table_size(pvt->match_cache) >= VTE_MATCH_CACHE_LINES) {
+		g_hash_table_remove_all(pvt->match_cache);
+	}
+
+	spans = g_array_new(FALSE, FALSE, sizeof(struct vte_match_span));
+	if (pvt->match_regex_mode == VTE_REGEX_GREGEX) {
+		vte_terminal_match_line_gregex(terminal, line, len, spans);
+	} else if (pvt->match_regex_mode == VTE_REGEX_VTE) {
+		vte_terminal_match_line_vte(terminal, line, len, spans);
+	}
+	g_hash_table_insert(pvt->match_cache, g_strndup(line, len), spans);
+
+	return spans;
+}
+
+/* Check if a given cell on the screen contains part of a matched string.  If
+ * it does, return the string, and store the match tag in the optional tag
+ * argument. */
+static char *
+vte_terminal_match_check_internal(VteTerminal *terminal,
+                                  long column, glong row,
+                                  int *tag, int *start, int *end)
+{
+	gint start_blank, end_blank;
+	guint i;
+	int offset;
+	struct vte_match_regex *regex = NULL;
+	struct vte_match_span *span;
+	struct _VteCharAttributes *attr = NULL;
+	struct vte_match_row *mrow = NULL;
+	gssize sattr, eattr;
+	gint lo, hi, mid;
+	gchar *line, eol;
+	GArray *spans;
+
+	if (terminal->pvt->match_contents == NULL) {
+		vte_terminal_match_contents_refresh(terminal);
+	}
+
+	_vte_debug_print(VTE_DEBUG_EVENTS,
+			"Checking for match at (%ld,%ld).\n", row, column);
+	*tag = -1;
+	if (start != NULL) {
+		*start = 0;
+	}
+	if (end != NULL) {
+		*end = 0;
+	}
+	if (terminal->pvt->match_regex_mode == VTE_REGEX_UNDECIDED) {
+		return NULL;
+	}
+
+	/* Map the pointer position to a portion of the string: the row's
+	 * bytes are in order of column, so look for the first byte past the
+	 * column, then check the character before it. */
+	offset = -1;
+	if (row >= terminal->pvt->match_rows_first &&
+	    row + 1 < terminal->pvt->match_rows_first +
+		      (glong) terminal->pvt->match_rows->len) {
+		mrow = &g_array_index(terminal->pvt->match_rows,
+				      struct vte_match_row,
+				      row - terminal->pvt->match_rows_first);
+		lo = mrow->start;
+		hi = mrow[1].start;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			attr = &g_array_index(terminal->pvt->match_attributes,
+					      struct _VteCharAttributes,
+					      mid);
+			if (attr->column <= column) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo > mrow->start) {
+			attr = &g_array_index(terminal->pvt->match_attributes,
+					      struct _VteCharAttributes,
+					      lo - 1);
+			if (attr->column == column &&
+			    terminal->pvt->match_contents[lo - 1] != ' ') {
+				offset = lo - 1;
+			}
+		}
+	}
+
+	_VTE_DEBUG_IF(VTE_DEBUG_EVENTS) {
+		if (offset < 0)
+			g_printerr("Cursor is not on a character.\n");
+		else
+			g_printerr("Cursor is on character '%c' at %d.\n",
+					g_utf8_get_char (terminal->pvt->match_contents + offset),
+					offset);
+	}
+
+	/* If the pointer isn't on a matchable character, bug out. */
+	if (offset < 0) {
+		return NULL;
 	}
-	/* and skip any initial newlines. */
-	while (terminal->pvt->match_contents[sattr] == '\n' ||
-		terminal->pvt->match_contents[sattr] == '\0') {
-		sattr++;
+
+	/* If the pointer is on a newline, bug out. */
+	if ((g_ascii_isspace(terminal->pvt->match_contents[offset])) ||
+	    (terminal->pvt->match_contents[offset] == '\0')) {
+		_vte_debug_print(VTE_DEBUG_EVENTS,
+				"Cursor is on whitespace.\n");
+		return NULL;
 	}
+
+	/* The line the row is part of. */
+	sattr = mrow->line_start;
+	eattr = mrow->line_end;
 	if (eattr <= sattr) { /* blank line */
 		return NULL;
 	}
@@ -1816,99 +2217,64 @@ vte_terminal_match_check_internal_gregex(VteTerminal *terminal,
 	start_blank = 0;
 	end_blank = eattr;
 
-	/* Now iterate over each regex we need to match against. */
-	for (i = 0; i < terminal->pvt->match_regexes->len; i++) {
+	/* Now iterate over the matches of each regex, in order. */
+	spans = vte_terminal_match_line(terminal, line, eattr);
+	for (i = 0; i < spans->len; i++) {
+		span = &g_array_index(spans, struct vte_match_span, i);
 		regex = &g_array_index(terminal->pvt->match_regexes,
 				       struct vte_match_regex,
-				       i);
-		/* Skip holes. */
-		if (regex->tag < 0) {
-			continue;
-		}
-		/* We'll only match the first item in the buffer which
-		 * matches, so we'll have to skip each match until we
-		 * stop getting matches. */
-                if (!g_regex_match_full(regex->regex.gregex.regex,
-                                        line, -1, 0,
-                                        regex->regex.gregex.flags,
-                                        &match_info,
-                                        NULL)) {
-                        g_match_info_free(match_info);
-                        continue;
-                }
-
-                while (g_match_info_matches(match_info)) {
-			gint ko = offset;
-			gint sblank=G_MININT, eblank=G_MAXINT;
-                        gint rm_so, rm_eo;
-
-                        if (g_match_info_fetch_pos (match_info, 0, &rm_so, &rm_eo)) {
-				/* The offsets should be "sane". */
-				g_assert(rm_so < eattr);
-				g_assert(rm_eo <= eattr);
-				_VTE_DEBUG_IF(VTE_DEBUG_MISC) {
-					gchar *match;
-					struct _VteCharAttributes *_sattr, *_eattr;
-					match = g_strndup(line + rm_so, rm_eo - rm_so);
-					_sattr = &g_array_index(terminal->pvt->match_attributes,
-							struct _VteCharAttributes,
-							rm_so);
-					_eattr = &g_array_index(terminal->pvt->match_attributes,
-							struct _VteCharAttributes,
-							rm_eo - 1);
-					g_printerr("Match `%s' from %d(%ld,%ld) to %d(%ld,%ld) (%d).\n",
-							match,
-							rm_so,
-							_sattr->column,
-							_sattr->row,
-							rm_eo - 1,
-							_eattr->column,
-							_eattr->row,
-							offset);
-					g_free(match);
-
-				}
-				/* If the pointer is in this substring,
-				 * then we're done. */
-				if (ko >= rm_so &&
-				    ko < rm_eo) {
-					gchar *result;
-					if (tag != NULL) {
-						*tag = regex->tag;
-					}
-					if (start != NULL) {
-						*start = sattr + rm_so;
-					}
-					if (end != NULL) {
-						*end = sattr + rm_eo - 1;
-					}
-                                        vte_terminal_set_cursor_from_regex_match(terminal, regex);
-                                        result = g_match_info_fetch(match_info, 0);
-					line[eattr] = eol;
+				       span->regex);
+		_VTE_DEBUG_IF(VTE_DEBUG_MISC) {
+			gchar *match;
+			struct _VteCharAttributes *_sattr, *_eattr;
+			match = g_strndup(line + span->start,
+					  span->end - span->start);
+			_sattr = &g_array_index(terminal->pvt->match_attributes,
+					struct _VteCharAttributes,
+					sattr + span->start);
+			_eattr = &g_array_index(terminal->pvt->match_attributes,
+					struct _VteCharAttributes,
+					sattr + span->end - 1);
+			g_printerr("Match `%s' from %d(%ld,%ld) to %d(%ld,%ld) (%d).\n",
+					match,
+					span->start,
+					_sattr->column,
+					_sattr->row,
+					span->end - 1,
+					_eattr->column,
+					_eattr->row,
+					offset);
+			g_free(match);
 
-                                        g_match_info_free(match_info);
-					return result;
-				}
-				if (ko > rm_eo &&
-						rm_eo > sblank) {
-					sblank = rm_eo;
-				}
-				if (ko < rm_so &&
-						rm_so < eblank) {
-					eblank = rm_so;
-				}
+		}
+		/* If the pointer is in this substring,
+		 * then we're done. */
+		if (offset >= span->start &&
+		    offset < span->end) {
+			gchar *result;
+			if (tag != NULL) {
+				*tag = regex->tag;
 			}
-			if (sblank > start_blank) {
-				start_blank = sblank;
+			if (start != NULL) {
+				*start = sattr + span->start;
 			}
-			if (eblank < end_blank) {
-				end_blank = eblank;
+			if (end != NULL) {
+				*end = sattr + span->end - 1;
 			}
-
-                        g_match_info_next(match_info, NULL);
+			vte_terminal_set_cursor_from_regex_match(terminal, regex);
+			result = g_strndup(line + span->start,
+					   span->end - span->start);
+			line[eattr] = eol;
+			return result;
+		}
+		if (offset > span->end &&
+				span->end > start_blank) {
+			start_blank = span->end;
+		}
+		if (offset < span->start &&
+				span->start < end_blank) {
+			end_blank = span->start;
 		}
-
-                g_match_info_free(match_info);
 	}
 	line[eattr] = eol;
 	if (start != NULL) {
@@ -1920,22 +2286,6 @@ vte_terminal_match_check_internal_gregex(VteTerminal *terminal,
 	return NULL;
 }
 
-static char *
-vte_terminal_match_check_internal(VteTerminal *terminal,
-                                  long column, glong row,
-                                  int *tag, int *start, int *end)
-{
-	if (terminal->pvt->match_contents == NULL) {
-		vte_terminal_match_contents_refresh(terminal);
-	}
-
-        if (terminal->pvt->match_regex_mode == VTE_REGEX_GREGEX)
-                return vte_terminal_match_check_internal_gregex(terminal, column, row, tag, start, end);
-        if (terminal->pvt->match_regex_mode == VTE_REGEX_VTE)
-                return vte_terminal_match_check_internal_vte(terminal, column, row, tag, start, end);
-        return NULL;
-}
-
 static gboolean
 rowcol_inside_match (VteTerminal *terminal, glong row, glong col)
 {
@@ -1972,7 +2322,8 @@ rowcol_inside_match (VteTerminal *terminal, glong row, glong col)
  *
  * If more than one regular expression has been set with
  * vte_terminal_match_add(), then expressions are checked in the order in
- * which they were added.
+ * which they were added: where matches of several of them overlap, the one
+ * added first wins, wherever the others start.
  *
  * Returns: (transfer full): a newly allocated string which matches one of the previously
  *   set regular expressions
@@ -4145,6 +4496,19 @@ skip_chunk:
 	wbuf = &g_array_index(unichars, gunichar, 0);
 	wcount = unichars->len;
 
+	/* Each character adds at most a row, and a row added to a full ring
+	 * drops the oldest one; read the copied text before its rows go. */
+	if (terminal->pvt->selection_pending &&
+	    terminal->pvt->selection_copied_ring == screen->row_data) {
+		VteRing *ring = screen->row_data;
+		glong room = terminal->pvt->selection_copied_start.row -
+			     _vte_ring_delta(ring) +
+			     (glong) ring->max - _vte_ring_length(ring);
+		if (room < wcount + terminal->row_count) {
+			vte_terminal_selection_read_pending(terminal);
+		}
+	}
+
 	/* Try initial substrings. */
 	start = 0;
 	modified = leftovers = again = FALSE;
@@ -4374,21 +4738,34 @@ next_match:
 		/* Deselect the current selection if its contents are changed
 		 * by this insertion. */
 		if (terminal->pvt->has_selection) {
-			char *selection;
-			selection =
-			vte_terminal_get_text_range(terminal,
-						    terminal->pvt->selection_start.row,
-						    0,
-						    terminal->pvt->selection_end.row,
-						    terminal->column_count,
-						    vte_cell_is_selected,
-						    NULL,
-						    NULL);
-			if ((selection == NULL) || (terminal->pvt->selection == NULL) ||
-			    (strcmp(selection, terminal->pvt->selection) != 0)) {
+			VteTerminalPrivate *pvt = terminal->pvt;
+			GString *selection;
+			/* Only the rows that were on screen when the text was
+			 * taken can have changed. */
+			if ((pvt->selection == NULL) ||
+			    (pvt->selection_copied_ring != pvt->screen->row_data) ||
+			    (pvt->selection_copied_block_mode != pvt->selection_block_mode) ||
+			    (pvt->selection_copied_start.row != pvt->selection_start.row) ||
+			    (pvt->selection_copied_start.col != pvt->selection_start.col) ||
+			    (pvt->selection_copied_end.row != pvt->selection_end.row) ||
+			    (pvt->selection_copied_end.col != pvt->selection_end.col)) {
 				vte_terminal_deselect_all(terminal);
+			} else {
+				selection = g_string_new(NULL);
+				vte_terminal_append_selected_text(terminal,
+								  pvt->screen->row_data,
+								  &pvt->selection_start,
+								  &pvt->selection_end,
+								  pvt->selection_block_mode,
+								  pvt->selection_copied_tail,
+								  pvt->selection_end.row + 1,
+								  selection);
+				if (strcmp(selection->str,
+					   pvt->selection + pvt->selection_tail_offset) != 0) {
+					vte_terminal_deselect_all(terminal);
+				}
+				g_string_free(selection, TRUE);
 			}
-			g_free(selection);
 		}
 	}
 
@@ -4397,6 +4774,10 @@ next_match:
 		_vte_terminal_queue_contents_changed(terminal);
 	}
 
+	if (modified) {
+		vte_terminal_queue_scrollback_budget_check ();
+	}
+
 	vte_terminal_emit_pending_signals (terminal);
 
 	if (invalidated_text) {
@@ -5622,30 +6003,9 @@ vte_terminal_key_release(GtkWidget *widget, GdkEventKey *event)
 gboolean
 vte_terminal_is_word_char(VteTerminal *terminal, gunichar c)
 {
-	guint i;
-	VteWordCharRange *range;
 	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
 
-	if (terminal->pvt->word_chars != NULL) {
-		/* Go through each range and check if c is included. */
-		for (i = 0; i < terminal->pvt->word_chars->len; i++) {
-			range = &g_array_index(terminal->pvt->word_chars,
-					       VteWordCharRange,
-					       i);
-			if ((c >= range->start) && (c <= range->end))
-				return TRUE;
-		}
-	}
-
-	/* If not ASCII, or ASCII and no array set (or empty array),
-	 * fall back on Unicode properties. */
-	return (c >= 0x80 ||
-	        (terminal->pvt->word_chars == NULL) ||
-	        (terminal->pvt->word_chars->len == 0)) &&
-		g_unichar_isgraph(c) &&
-	       !g_unichar_ispunct(c) &&
-	       !g_unichar_isspace(c) &&
-	       (c != '\0');
+	return _vte_word_chars_contains(terminal->pvt->word_chars, c);
 }
 
 /* Check if the characters in the two given locations are in the same class
@@ -5654,25 +6014,18 @@ static gboolean
 vte_same_class(VteTerminal *terminal, glong acol, glong arow,
 	       glong bcol, glong brow)
 {
-	const VteCell *pcell = NULL;
-	gboolean word_char;
-	if ((pcell = vte_terminal_find_charcell(terminal, acol, arow)) != NULL && pcell->c != 0) {
-		word_char = vte_terminal_is_word_char(terminal, _vte_unistr_get_base (pcell->c));
-
-		/* Lets not group non-wordchars together (bug #25290) */
-		if (!word_char)
-			return FALSE;
+	const VteCell *acell, *bcell;
 
-		pcell = vte_terminal_find_charcell(terminal, bcol, brow);
-		if (pcell == NULL || pcell->c == 0) {
-			return FALSE;
-		}
-		if (word_char != vte_terminal_is_word_char(terminal, _vte_unistr_get_base (pcell->c))) {
-			return FALSE;
-		}
-		return TRUE;
+	acell = vte_terminal_find_charcell(terminal, acol, arow);
+	if (acell == NULL || acell->c == 0) {
+		return FALSE;
 	}
-	return FALSE;
+	bcell = vte_terminal_find_charcell(terminal, bcol, brow);
+	if (bcell == NULL) {
+		return FALSE;
+	}
+	return _vte_word_chars_same_word(terminal->pvt->word_chars,
+					 acell->c, bcell->c);
 }
 
 /* Check if we soft-wrapped on the given line. */
@@ -5775,6 +6128,50 @@ vte_cell_is_selected(VteTerminal *terminal, glong col, glong row, gpointer data)
 	return vte_cell_is_between(col, row, ss.col, ss.row, se.col, se.row, TRUE);
 }
 
+/* Find the columns [*start, *end) of @row which lie between the two
+ * points, including the second one; the same cells for which
+ * vte_cell_is_between() would say so.  *end is G_MAXLONG if the region
+ * continues past the end of the row. */
+static void
+vte_row_span_between(glong row,
+		     glong acol, glong arow, glong bcol, glong brow,
+		     glong *start, glong *end)
+{
+	*start = *end = 0;
+	if ((arow > brow) || ((arow == brow) && (acol > bcol))) {
+		return;
+	}
+	if ((row < arow) || (row > brow)) {
+		return;
+	}
+	*start = (row == arow) ? MAX (acol, 0) : 0;
+	*end = (row == brow) ? bcol + 1 : G_MAXLONG;
+}
+
+/* Find the columns of @row which are selected, as a span computed once
+ * per row instead of asking vte_cell_is_selected() for every cell. */
+static void
+vte_terminal_get_selected_span(VteTerminal *terminal, glong row,
+			       glong *start, glong *end)
+{
+	VteVisualPosition ss, se;
+
+	*start = *end = 0;
+	if (!terminal->pvt->has_selection) {
+		return;
+	}
+	ss = terminal->pvt->selection_start;
+	se = terminal->pvt->selection_end;
+	if ((ss.row < 0) || (se.row < 0)) {
+		return;
+	}
+	vte_row_span_between(row, ss.col, ss.row, se.col, se.row, start, end);
+	if (terminal->pvt->selection_block_mode && *start < *end) {
+		*start = MAX (*start, ss.col);
+		*end = MIN (*end, se.col + 1);
+	}
+}
+
 /* Once we get text data, actually paste it in. */
 static void
 vte_terminal_paste_cb(GtkClipboard *clipboard, const gchar *text, gpointer data)
@@ -6197,6 +6594,7 @@ vte_terminal_copy_cb(GtkClipboard *clipboard, GtkSelectionData *data,
 {
 	VteTerminal *terminal;
 	terminal = owner;
+	vte_terminal_selection_read_pending(terminal);
 	if (terminal->pvt->selection != NULL) {
 		_VTE_DEBUG_IF(VTE_DEBUG_SELECTION) {
 			int i;
@@ -6264,27 +6662,164 @@ vte_terminal_get_text_range(VteTerminal *terminal,
 							 FALSE);
 }
 
-static char *
-vte_terminal_get_text_range_maybe_wrapped(VteTerminal *terminal,
-					  glong start_row, glong start_col,
-					  glong end_row, glong end_col,
-					  gboolean wrap,
-					  VteSelectionFunc is_selected,
-					  gpointer data,
-					  GArray *attributes,
-					  gboolean include_trailing_spaces)
+/**
+ * vte_terminal_append_text_range:
+ * @terminal: a #VteTerminal
+ * @start_row: first row to read
+ * @start_col: first column to read
+ * @end_row: last row to read
+ * @end_col: last column to read
+ * @string: a #GString to append the text to
+ *
+ * Appends the text of the terminal from @start_row and @start_col to
+ * @end_row and @end_col to @string.  The text is the same that
+ * vte_terminal_get_text_range() returns for all of the cells, but it is
+ * read without a #VteSelectionFunc call or a #VteCharAttributes for each
+ * cell, which makes this much faster when only the text is wanted.
+ *
+ * Since: 0.32
+ */
+void
+vte_terminal_append_text_range(VteTerminal *terminal,
+			       glong start_row, glong start_col,
+			       glong end_row, glong end_col,
+			       GString *string)
 {
-	glong col, row, last_empty, last_emptycol, last_nonempty, last_nonemptycol;
-	VteScreen *screen;
-	const VteCell *pcell = NULL;
-	GString *string;
-	struct _VteCharAttributes attr;
-	PangoColor fore, back, *palette;
+	g_return_if_fail(VTE_IS_TERMINAL(terminal));
+	g_return_if_fail(string != NULL);
+	vte_terminal_append_rows(terminal,
+				 start_row, start_col,
+				 end_row + 1,
+				 end_col < G_MAXLONG ? end_col + 1 : G_MAXLONG,
+				 string);
+}
 
-	if (!is_selected)
-		is_selected = always_selected;
+typedef struct {
+	VteTerminal *terminal;
+	glong row;
+	glong end_row;
+	gpointer dummy;
+} VteRealTerminalLineIter;
 
-	screen = terminal->pvt->screen;
+/**
+ * vte_terminal_line_iter_init:
+ * @iter: an uninitialized #VteTerminalLineIter
+ * @terminal: a #VteTerminal
+ * @start_row: the first row to read
+ * @end_row: the last row to read
+ *
+ * Initializes @iter to read the lines of text of @terminal from @start_row
+ * to @end_row, one at a time, with vte_terminal_line_iter_next().  The terminal's
+ * contents must not change while @iter is in use.
+ *
+ * |[
+ * VteTerminalLineIter iter;
+ * GString *line = g_string_new (NULL);
+ * glong row;
+ *
+ * vte_terminal_line_iter_init (&iter, terminal, first_row, last_row);
+ * while (vte_terminal_line_iter_next (&iter, line, &row))
+ *   {
+ *     /&ast; do something with line->str &ast;/
+ *   }
+ * g_string_free (line, TRUE);
+ * ]|
+ *
+ * Since: 0.32
+ */
+void
+vte_terminal_line_iter_init(VteTerminalLineIter *iter,
+			    VteTerminal *terminal,
+			    glong start_row, glong end_row)
+{
+	VteRealTerminalLineIter *ri = (VteRealTerminalLineIter *) iter;
+
+	g_return_if_fail(iter != NULL);
+	g_return_if_fail(VTE_IS_TERMINAL(terminal));
+
+	ri->terminal = terminal;
+	ri->row = start_row;
+	ri->end_row = end_row;
+}
+
+/**
+ * vte_terminal_line_iter_next:
+ * @iter: a #VteTerminalLineIter
+ * @line: a #GString to store the text of the line in
+ * @row: (out) (allow-none): a location to store the line's first row, or
+ *   %NULL
+ *
+ * Reads the next line of text into @line, replacing its contents.  A line
+ * is made of the rows joined by soft wraps; it doesn't end in a newline.
+ * A line running past the iterator's last row is cut short there.
+ *
+ * Returns: %TRUE if a line was read, %FALSE when there are no more
+ *
+ * Since: 0.32
+ */
+gboolean
+vte_terminal_line_iter_next(VteTerminalLineIter *iter, GString *line, glong *row)
+{
+	VteRealTerminalLineIter *ri = (VteRealTerminalLineIter *) iter;
+
+	g_return_val_if_fail(iter != NULL, FALSE);
+	g_return_val_if_fail(VTE_IS_TERMINAL(ri->terminal), FALSE);
+	g_return_val_if_fail(line != NULL, FALSE);
+
+	if (ri->row > ri->end_row) {
+		return FALSE;
+	}
+	if (row != NULL) {
+		*row = ri->row;
+	}
+
+	g_string_truncate(line, 0);
+	do {
+		vte_terminal_append_rows(ri->terminal,
+					 ri->row, 0, ri->row + 1, G_MAXLONG,
+					 line);
+		ri->row++;
+	} while (ri->row <= ri->end_row &&
+		 (line->len == 0 || line->str[line->len - 1] != '\n'));
+
+	if (line->len > 0 && line->str[line->len - 1] == '\n') {
+		g_string_truncate(line, line->len - 1);
+	}
+	return TRUE;
+}
+
+static char *
+vte_terminal_get_text_range_maybe_wrapped(VteTerminal *terminal,
+					  glong start_row, glong start_col,
+					  glong end_row, glong end_col,
+					  gboolean wrap,
+					  VteSelectionFunc is_selected,
+					  gpointer data,
+					  GArray *attributes,
+					  gboolean include_trailing_spaces)
+{
+	glong col, row, last_empty, last_emptycol, last_nonempty, last_nonemptycol;
+	VteScreen *screen;
+	const VteCell *pcell = NULL;
+	GString *string;
+	struct _VteCharAttributes attr;
+	PangoColor fore, back, *palette;
+
+	/* Without attributes to fill in, plain text can be read faster. */
+	if (!is_selected && !attributes && !include_trailing_spaces) {
+		string = g_string_new(NULL);
+		vte_terminal_append_rows(terminal,
+					 start_row, start_col,
+					 end_row + 1,
+					 end_col < G_MAXLONG ? end_col + 1 : G_MAXLONG,
+					 string);
+		return g_string_free(string, FALSE);
+	}
+
+	if (!is_selected)
+		is_selected = always_selected;
+
+	screen = terminal->pvt->screen;
 
 	if (attributes)
 		g_array_set_size (attributes, 0);
@@ -6404,6 +6939,160 @@ vte_terminal_get_text_range_maybe_wrapped(VteTerminal *terminal,
 	return g_string_free(string, FALSE);
 }
 
+/* Appends the text of the cells of @row_data from @start to @end, with empty
+ * cells read as spaces, and trimmed off the end of the row. */
+static void
+vte_terminal_append_row_text(const VteRowData *row_data,
+			     glong start, glong end,
+			     GString *string)
+{
+	const VteCell *pcell;
+	gsize last_nonempty = string->len;
+	gboolean trailing_empty = FALSE;
+	glong col;
+
+	for (col = start;
+	     col < end && (pcell = _vte_row_data_get(row_data, col)) != NULL;
+	     col++) {
+		if (pcell->attr.fragment) {
+			continue;
+		}
+		if (G_LIKELY(pcell->c < 0x80)) {
+			if (pcell->c == 0) {
+				g_string_append_c(string, ' ');
+				trailing_empty = TRUE;
+				continue;
+			}
+			g_string_append_c(string, pcell->c);
+		} else {
+			_vte_unistr_append_to_string(pcell->c, string);
+		}
+		last_nonempty = string->len;
+		trailing_empty = FALSE;
+	}
+
+	/* Trim the empty cells off the end, unless something follows them
+	 * in the row. */
+	if (trailing_empty) {
+		while ((pcell = _vte_row_data_get(row_data, col)) != NULL &&
+		       (pcell->attr.fragment || pcell->c == 0)) {
+			col++;
+		}
+		if (pcell == NULL) {
+			g_string_truncate(string, last_nonempty);
+		}
+	}
+}
+
+/* Appends the text of the rows from @first to @last, from @start_col on the
+ * first row and up to @end_col on the last one, as vte_terminal_get_text_range()
+ * reads it when every cell is wanted.  The rows of the scrollback read whole
+ * come straight from the ring's text stream. */
+static void
+vte_terminal_append_rows(VteTerminal *terminal,
+			 glong first, glong start_col,
+			 glong last, glong end_col,
+			 GString *string)
+{
+	VteRing *ring = terminal->pvt->screen->row_data;
+	const VteRowData *row_data;
+	glong row, next, start, whole_last;
+
+	whole_last = (end_col == G_MAXLONG) ? last : last - 1;
+
+	for (row = first; row < last; row++) {
+		if ((row > first || start_col == 0) && row < whole_last &&
+		    !terminal->pvt->selection_block_mode) {
+			next = _vte_ring_append_text(ring, row, whole_last, string);
+			if (next > row) {
+				row = next - 1;
+				continue;
+			}
+		}
+
+		/* The first cell is read even if it lies past @end_col. */
+		row_data = _vte_terminal_find_row_data(terminal, row);
+		start = (row == first) ? start_col : 0;
+		if (row_data != NULL) {
+			vte_terminal_append_row_text(row_data, start,
+						     (row == last - 1) ?
+						     MAX(end_col, start + 1) :
+						     G_MAXLONG,
+						     string);
+		}
+		/* Like vte_terminal_get_text_range(), end every row in block
+		 * mode. */
+		if (terminal->pvt->selection_block_mode ||
+		    !vte_line_is_wrappable(terminal, row)) {
+			g_string_append_c(string, '\n');
+		}
+	}
+}
+
+/* Appends the text of the rows from @first to @last of @ring which lie in
+ * the selection from @ss to @se, as vte_terminal_get_text_range() reads it
+ * with vte_cell_is_selected(), but working out the selected columns once per
+ * row, and reading the rows selected whole from the scrollback straight from
+ * the ring's text stream. */
+static void
+vte_terminal_append_selected_text(VteTerminal *terminal,
+				  VteRing *ring,
+				  const VteVisualPosition *ss,
+				  const VteVisualPosition *se,
+				  gboolean block_mode,
+				  glong first, glong last,
+				  GString *string)
+{
+	const VteRowData *row_data;
+	glong row, start, end, whole_start, next;
+
+	if ((ss->row < 0) || (se->row < 0)) {
+		return;
+	}
+
+	/* The rows selected from edge to edge */
+	whole_start = (ss->col <= 0) ? ss->row : ss->row + 1;
+
+	for (row = first; row < last; row++) {
+		if (!block_mode && row >= whole_start && row < se->row) {
+			next = _vte_ring_append_text(ring, row,
+						     MIN(last, se->row),
+						     string);
+			if (next > row) {
+				row = next - 1;
+				continue;
+			}
+		}
+
+		vte_row_span_between(row, ss->col, ss->row, se->col, se->row,
+				     &start, &end);
+		if (block_mode && start < end) {
+			start = MAX(start, ss->col);
+			end = MIN(end, se->col + 1);
+		}
+
+		row_data = _vte_ring_contains(ring, row) ?
+			   _vte_ring_index(ring, row) : NULL;
+		if (row_data != NULL) {
+			/* The last row is read up to the right edge. */
+			vte_terminal_append_row_text(row_data, start,
+						     (row == se->row) ?
+						     MIN(end, terminal->column_count + 1) :
+						     end,
+						     string);
+		}
+
+		/* Add a newline in block mode, or else where the line ends
+		 * within the selection. */
+		if (block_mode ||
+		    (start <= terminal->column_count &&
+		     terminal->column_count < end &&
+		     !(row_data != NULL && row_data->attr.soft_wrapped))) {
+			g_string_append_c(string, '\n');
+		}
+	}
+}
+
 static char *
 vte_terminal_get_text_maybe_wrapped(VteTerminal *terminal,
 				    gboolean wrap,
@@ -6521,6 +7210,73 @@ vte_terminal_clipboard_get(VteTerminal *terminal, GdkAtom board)
 	return gtk_clipboard_get_for_display(display, board);
 }
 
+/* Take the text of the current selection.  The rows of the scrollback can't
+ * change, so their text is only read from the ring when it is asked for; the
+ * rows on screen can, so their text is read right away. */
+static void
+vte_terminal_selection_take(VteTerminal *terminal)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	VteScreen *screen = pvt->screen;
+	GString *string;
+	glong tail;
+
+	pvt->selection_copied_ring = screen->row_data;
+	pvt->selection_copied_start = pvt->selection_start;
+	pvt->selection_copied_end = pvt->selection_end;
+	pvt->selection_copied_block_mode = pvt->selection_block_mode;
+
+	tail = MAX(pvt->selection_start.row,
+		   MIN(screen->insert_delta, pvt->selection_end.row + 1));
+	pvt->selection_copied_tail = tail;
+
+	string = g_string_new(NULL);
+	vte_terminal_append_selected_text(terminal,
+					  pvt->selection_copied_ring,
+					  &pvt->selection_copied_start,
+					  &pvt->selection_copied_end,
+					  pvt->selection_copied_block_mode,
+					  tail, pvt->selection_end.row + 1,
+					  string);
+	g_free(pvt->selection);
+	pvt->selection = g_string_free(string, FALSE);
+	pvt->selection_tail_offset = 0;
+	pvt->selection_pending = tail > pvt->selection_start.row;
+}
+
+/* Read the rows of the copied text that were left in the scrollback, for
+ * someone who asked for the text, or before they go away. */
+static void
+vte_terminal_selection_read_pending(VteTerminal *terminal)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	GString *string;
+
+	if (!pvt->selection_pending) {
+		return;
+	}
+	pvt->selection_pending = FALSE;
+
+	_vte_debug_print(VTE_DEBUG_SELECTION,
+			"Reading rows %ld to %ld of the selection.\n",
+			pvt->selection_copied_start.row,
+			pvt->selection_copied_tail - 1);
+
+	string = g_string_new(NULL);
+	vte_terminal_append_selected_text(terminal,
+					  pvt->selection_copied_ring,
+					  &pvt->selection_copied_start,
+					  &pvt->selection_copied_end,
+					  pvt->selection_copied_block_mode,
+					  pvt->selection_copied_start.row,
+					  pvt->selection_copied_tail,
+					  string);
+	pvt->selection_tail_offset = string->len;
+	g_string_append(string, pvt->selection);
+	g_free(pvt->selection);
+	pvt->selection = g_string_free(string, FALSE);
+}
+
 /* Place the selected text onto the clipboard.  Do this asynchronously so that
  * we get notified when the selection we placed on the clipboard is replaced. */
 static void
@@ -6532,17 +7288,8 @@ vte_terminal_copy(VteTerminal *terminal, GdkAtom board)
 
 	clipboard = vte_terminal_clipboard_get(terminal, board);
 
-	/* Chuck old selected text and retrieve the newly-selected text. */
-	g_free(terminal->pvt->selection);
-	terminal->pvt->selection =
-		vte_terminal_get_text_range(terminal,
-					    terminal->pvt->selection_start.row,
-					    0,
-					    terminal->pvt->selection_end.row,
-					    terminal->column_count,
-					    vte_cell_is_selected,
-					    NULL,
-					    NULL);
+	/* Chuck old selected text and take the newly-selected text. */
+	vte_terminal_selection_take(terminal);
 	terminal->pvt->has_selection = TRUE;
 
 	/* Place the text on the clipboard. */
@@ -7978,6 +8725,90 @@ vte_terminal_refresh_size(VteTerminal *terminal)
 	}
 }
 
+/* Lays the rows from @first to @last out for the current width, if the
+ * last resize didn't get to them yet.  Rows before them move, and so may
+ * the ones right after them; a view ending in between follows those. */
+static void
+vte_terminal_reflow_rows(VteTerminal *terminal, glong first, glong last)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	VteScreen *screen = pvt->screen;
+	glong last_moved;
+
+	if (pvt->selection_pending &&
+	    pvt->selection_copied_ring == pvt->screen->row_data &&
+	    pvt->selection_copied_start.row < last) {
+		vte_terminal_selection_read_pending(terminal);
+	}
+	if (!_vte_ring_reflow_range (screen->row_data,
+				     MAX (first, 0), MAX (last, 0), &last_moved))
+		return;
+
+	_vte_debug_print(VTE_DEBUG_RING,
+			"Reflowed rows %ld to %ld, the rows after them moved by %ld.\n",
+			first, last, last_moved);
+
+	/* Keep the rows the bottom of the view showed there */
+	if (last_moved &&
+	    screen->scroll_delta < last &&
+	    screen->scroll_delta + terminal->row_count >= last)
+		vte_terminal_queue_adjustment_value_changed (terminal,
+							     MAX (screen->scroll_delta + last_moved,
+								  _vte_ring_delta (screen->row_data)));
+
+	if (pvt->has_selection && pvt->selection_start.row < last)
+		vte_terminal_deselect_all (terminal);
+	vte_terminal_match_contents_clear (terminal);
+	_vte_terminal_adjust_adjustments (terminal);
+	_vte_invalidate_all (terminal);
+}
+
+/* Rewraps the normal screen for the new number of columns.  Only the
+ * writable rows are rewrapped right away; the scrollback follows as it is
+ * shown or searched. */
+static void
+vte_terminal_reflow(VteTerminal *terminal)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	VteScreen *screen = &pvt->normal_screen;
+	VteRing *ring = screen->row_data;
+	gboolean at_bottom = screen->scroll_delta >= screen->insert_delta;
+	glong scroll_delta;
+	gulong shift;
+
+	vte_terminal_selection_read_pending(terminal);
+	shift = _vte_ring_reflow (ring, terminal->column_count,
+				  &screen->cursor_current.row,
+				  &screen->cursor_current.col);
+
+	screen->insert_delta = MAX ((glong) _vte_ring_delta (ring),
+				    (glong) _vte_ring_next (ring) - terminal->row_count);
+	screen->cursor_current.row = MAX (screen->cursor_current.row,
+					  screen->insert_delta);
+	if (at_bottom)
+		scroll_delta = screen->insert_delta;
+	else
+		scroll_delta = MAX (screen->scroll_delta + (glong) shift,
+				    (glong) _vte_ring_delta (ring));
+
+	_vte_debug_print(VTE_DEBUG_RING,
+			"Reflowed to %ld columns, rows moved by %lu.\n",
+			terminal->column_count, shift);
+
+	vte_terminal_deselect_all (terminal);
+	vte_terminal_match_contents_clear (terminal);
+
+	if (pvt->screen != screen) {
+		screen->scroll_delta = scroll_delta;
+		return;
+	}
+
+	vte_terminal_queue_adjustment_value_changed (terminal, scroll_delta);
+	vte_terminal_reflow_rows (terminal, scroll_delta,
+				  scroll_delta + terminal->row_count);
+	_vte_terminal_adjust_adjustments (terminal);
+}
+
 /**
  * vte_terminal_set_size:
  * @terminal: a #VteTerminal
@@ -8019,7 +8850,16 @@ vte_terminal_set_size(VteTerminal *terminal, glong columns, glong rows)
 	if (old_rows != terminal->row_count || old_columns != terminal->column_count) {
 		VteScreen *screen = terminal->pvt->screen;
 		glong visible_rows = MIN (old_rows, _vte_ring_length (screen->row_data));
-		if (terminal->row_count < visible_rows) {
+		if (old_columns != terminal->column_count)
+			vte_terminal_reflow (terminal);
+		_vte_ring_set_columns (terminal->pvt->normal_screen.row_data,
+				       terminal->column_count);
+		_vte_ring_set_columns (terminal->pvt->alternate_screen.row_data,
+				       terminal->column_count);
+		/* The reflow placed the normal screen already. */
+		if (terminal->row_count < visible_rows &&
+		    (old_columns == terminal->column_count ||
+		     screen != &terminal->pvt->normal_screen)) {
 			glong delta = visible_rows - terminal->row_count;
 			screen->insert_delta += delta;
 			vte_terminal_queue_adjustment_value_changed (
@@ -8046,6 +8886,10 @@ vte_terminal_handle_scroll(VteTerminal *terminal)
 	dy = adj - screen->scroll_delta;
 	screen->scroll_delta = adj;
 
+	/* Lay out the scrollback being scrolled into view */
+	vte_terminal_reflow_rows (terminal, screen->scroll_delta,
+				  screen->scroll_delta + terminal->row_count);
+
 	/* Sanity checks. */
 	if (! gtk_widget_is_drawable (&terminal->widget)
 			|| terminal->pvt->visibility_state == GDK_VISIBILITY_FULLY_OBSCURED) {
@@ -8055,8 +8899,9 @@ vte_terminal_handle_scroll(VteTerminal *terminal)
 	if (dy != 0) {
 		_vte_debug_print(VTE_DEBUG_ADJ,
 			    "Scrolling by %ld\n", dy);
-		_vte_terminal_scroll_region(terminal, screen->scroll_delta,
-					   terminal->row_count, -dy);
+		if (!_vte_terminal_scroll_window (terminal, -dy))
+			_vte_terminal_scroll_region(terminal, screen->scroll_delta,
+						   terminal->row_count, -dy);
 		vte_terminal_emit_text_scrolled(terminal, dy);
 		_vte_terminal_queue_contents_changed(terminal);
 	} else {
@@ -8375,6 +9220,12 @@ vte_terminal_init(VteTerminal *terminal)
 	pvt->screen = &terminal->pvt->normal_screen;
 	_vte_terminal_set_default_attributes(terminal);
 
+	/* Take part in the process-wide scrollback budget. */
+	pvt->scrollback_link = g_list_alloc ();
+	pvt->scrollback_link->data = terminal;
+	scrollback_terminals = g_list_concat (pvt->scrollback_link,
+					      scrollback_terminals);
+
 	/* Set up I/O encodings. */
 	pvt->iso2022 = _vte_iso2022_state_new(pvt->encoding,
 					      &_vte_terminal_codeset_changed_cb,
@@ -8867,6 +9718,9 @@ vte_terminal_finalize(GObject *object)
 	if (terminal->pvt->match_attributes != NULL) {
 		g_array_free(terminal->pvt->match_attributes, TRUE);
 	}
+	if (terminal->pvt->match_rows != NULL) {
+		g_array_free(terminal->pvt->match_rows, TRUE);
+	}
 	g_free(terminal->pvt->match_contents);
 	if (terminal->pvt->match_regexes != NULL) {
 		for (i = 0; i < terminal->pvt->match_regexes->len; i++) {
@@ -8881,11 +9735,20 @@ vte_terminal_finalize(GObject *object)
 		}
 		g_array_free(terminal->pvt->match_regexes, TRUE);
 	}
+	if (terminal->pvt->match_cache != NULL) {
+		g_hash_table_destroy(terminal->pvt->match_cache);
+	}
+	if (terminal->pvt->match_combined != NULL) {
+		g_regex_unref(terminal->pvt->match_combined);
+	}
 
 	if (terminal->pvt->search_regex)
 		g_regex_unref (terminal->pvt->search_regex);
 	if (terminal->pvt->search_attrs)
 		g_array_free (terminal->pvt->search_attrs, TRUE);
+	if (terminal->pvt->search_text)
+		g_string_free (terminal->pvt->search_text, TRUE);
+	g_free (terminal->pvt->search_literal);
 
 	/* Disconnect from toplevel window configure events. */
 	toplevel = gtk_widget_get_toplevel(&terminal->widget);
@@ -8909,6 +9772,7 @@ vte_terminal_finalize(GObject *object)
 	/* Free any selected text, but if we currently own the selection,
 	 * throw the text onto the clipboard without an owner so that it
 	 * doesn't just disappear. */
+	vte_terminal_selection_read_pending(terminal);
 	if (terminal->pvt->selection != NULL) {
 		clipboard = vte_terminal_clipboard_get(terminal,
 						       GDK_SELECTION_PRIMARY);
@@ -8920,13 +9784,20 @@ vte_terminal_finalize(GObject *object)
 		g_free(terminal->pvt->selection);
 	}
 	if (terminal->pvt->word_chars != NULL) {
-		g_array_free(terminal->pvt->word_chars, TRUE);
+		_vte_word_chars_free(terminal->pvt->word_chars);
 	}
 
 	/* Clear the output histories. */
 	_vte_ring_fini(terminal->pvt->normal_screen.row_data);
 	_vte_ring_fini(terminal->pvt->alternate_screen.row_data);
 
+	scrollback_terminals = g_list_delete_link (scrollback_terminals,
+						   terminal->pvt->scrollback_link);
+	if (scrollback_terminals == NULL && scrollback_budget_tag != 0) {
+		g_source_remove (scrollback_budget_tag);
+		scrollback_budget_tag = 0;
+	}
+
 	/* Clear the status lines. */
 	g_string_free(terminal->pvt->normal_screen.status_line_contents,
 		      TRUE);
@@ -8991,6 +9862,8 @@ vte_terminal_finalize(GObject *object)
 	}
 
 	remove_update_timeout (terminal);
+	g_free (terminal->pvt->dirty_spans);
+	g_free (terminal->pvt->painted_cells);
 
 	/* discard title updates */
 	g_free(terminal->pvt->window_title_changed);
@@ -9376,6 +10249,7 @@ vte_terminal_draw_graphic(VteTerminal *terminal, vteunistr c,
 	gboolean ret;
 	gint xcenter, xright, ycenter, ybottom, i;
 	struct _vte_draw_text_request request;
+	guint32 mask_key;
 
 	request.c = c;
 	request.x = x + terminal->pvt->inner_border.left;
@@ -9400,6 +10274,19 @@ vte_terminal_draw_graphic(VteTerminal *terminal, vteunistr c,
 		return TRUE;
 	}
 
+	/* What follows only depends on the character and the size of the
+	 * cell, so draw it once into a mask and reuse that. */
+	mask_key = c | (columns << 21) | ((bold ? 1 : 0) << 25);
+	if (_vte_draw_cell_mask(terminal->pvt->draw, mask_key,
+				request.x, request.y,
+				column_width * columns, row_height,
+				&terminal->pvt->palette[fore], VTE_DRAW_OPAQUE)) {
+		return TRUE;
+	}
+	_vte_draw_begin_cell_mask(terminal->pvt->draw,
+				  request.x, request.y,
+				  column_width * columns, row_height);
+
 	ret = TRUE;
 
 	switch (c) {
@@ -10122,6 +11009,9 @@ vte_terminal_draw_graphic(VteTerminal *terminal, vteunistr c,
 		ret = FALSE;
 		break;
 	}
+
+	_vte_draw_end_cell_mask(terminal->pvt->draw, mask_key, ret,
+				&terminal->pvt->palette[fore], VTE_DRAW_OPAQUE);
 	return ret;
 }
 
@@ -10498,6 +11388,85 @@ vte_terminal_draw_cells_with_attributes(VteTerminal *terminal,
 }
 
 
+/* Colors and decorations of a cell, resolved once per distinct attribute
+ * and packed into one word so that runs can be found by comparing words. */
+#define VTE_RESOLVED_FORE(r)		((r) & 0x1ff)
+#define VTE_RESOLVED_BACK(r)		(((r) >> 9) & 0x1ff)
+#define VTE_RESOLVED_BOLD		(1U << 18)
+#define VTE_RESOLVED_UNDERLINE		(1U << 19)
+#define VTE_RESOLVED_STRIKETHROUGH	(1U << 20)
+#define VTE_RESOLVED_HILITE		(1U << 21)
+#define VTE_RESOLVED_VALID		(1U << 31)
+/* What has to be the same for cells to be drawn together */
+#define VTE_RESOLVED_RUN_MASK		(~((0x1ffU << 9) | VTE_RESOLVED_VALID))
+
+#define VTE_ATTR_CACHE_SIZE 64
+
+typedef struct _VteAttrCache {
+	struct {
+		guint32 attr;
+		guint32 resolved;
+	} entries[2][VTE_ATTR_CACHE_SIZE];	/* unselected, selected */
+} VteAttrCache;
+
+static inline guint32
+vte_terminal_resolve_attr(VteTerminal *terminal, VteAttrCache *cache,
+			  const VteCell *cell, gboolean selected)
+{
+	VteIntCellAttr attr;
+	guint32 hash;
+	guint fore, back;
+
+	attr.s = cell ? cell->attr : basic_cell.cell.attr;
+	/* Neither affects the colors */
+	attr.s.fragment = 0;
+	attr.s.columns = 0;
+
+	hash = (attr.i ^ (attr.i >> 7) ^ (attr.i >> 17)) % VTE_ATTR_CACHE_SIZE;
+	selected = selected ? 1 : 0;
+	if (G_UNLIKELY (cache->entries[selected][hash].attr != attr.i ||
+			!cache->entries[selected][hash].resolved)) {
+		VteCell resolve_cell;
+		guint32 resolved;
+
+		resolve_cell.c = 0;
+		resolve_cell.attr = attr.s;
+		vte_terminal_determine_colors(terminal, &resolve_cell, selected,
+					      &fore, &back);
+		resolved = fore | (back << 9) | VTE_RESOLVED_VALID;
+		if (attr.s.bold)
+			resolved |= VTE_RESOLVED_BOLD;
+		if (attr.s.underline)
+			resolved |= VTE_RESOLVED_UNDERLINE;
+		if (attr.s.strikethrough)
+			resolved |= VTE_RESOLVED_STRIKETHROUGH;
+		cache->entries[selected][hash].attr = attr.i;
+		cache->entries[selected][hash].resolved = resolved;
+	}
+	return cache->entries[selected][hash].resolved;
+}
+
+/* Find the selected and the highlighted match columns of a row. */
+static inline void
+vte_terminal_prepare_row(VteTerminal *terminal, glong row,
+			 glong *sel_start, glong *sel_end,
+			 glong *hl_start, glong *hl_end)
+{
+	vte_terminal_get_selected_span(terminal, row, sel_start, sel_end);
+	if (terminal->pvt->show_match) {
+		vte_row_span_between(row,
+				     terminal->pvt->match_start.col,
+				     terminal->pvt->match_start.row,
+				     terminal->pvt->match_end.col,
+				     terminal->pvt->match_end.row,
+				     hl_start, hl_end);
+	} else {
+		*hl_start = *hl_end = 0;
+	}
+}
+
+#define VTE_IN_SPAN(col, start, end) ((col) >= (start) && (col) < (end))
+
 /* Paint the contents of a given row at the given location.  Take advantage
  * of multiple-draw APIs by finding runs of characters with identical
  * attributes and bundling them together. */
@@ -10510,26 +11479,30 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 		      gint column_width, gint row_height)
 {
 	struct _vte_draw_text_request items[4*VTE_DRAW_MAX_LENGTH];
+	VteAttrCache cache;
 	gint i, j, row, rows, x, y, end_column;
 	guint fore, nfore, back, nback;
-	glong delta;
-	gboolean underline, nunderline, bold, nbold, hilite, nhilite,
-		 selected, nselected, strikethrough, nstrikethrough;
+	guint32 resolved, nresolved;
+	glong sel_start, sel_end, hl_start, hl_end;
+	gboolean bold, selected;
 	guint item_count;
 	const VteCell *cell;
 	const VteRowData *row_data;
 
+	memset (&cache, 0, sizeof (cache));
+
 	/* adjust for the absolute start of row */
 	start_x -= start_column * column_width;
 	end_column = start_column + column_count;
 
 	/* clear the background */
-	delta = screen->scroll_delta;
 	x = start_x + terminal->pvt->inner_border.left;
 	y = start_y + terminal->pvt->inner_border.top;
 	row = start_row;
 	rows = row_count;
 	do {
+		vte_terminal_get_selected_span(terminal, row,
+					       &sel_start, &sel_end);
 		row_data = _vte_terminal_find_row_data(terminal, row);
 		/* Back up in case this is a multicolumn character,
 		 * making the drawing area a little wider. */
@@ -10546,8 +11519,9 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 				/* Get the character cell's contents. */
 				cell = _vte_row_data_get (row_data, i);
 				/* Find the colors for this cell. */
-				selected = vte_cell_is_selected(terminal, i, row, NULL);
-				vte_terminal_determine_colors(terminal, cell, selected, &fore, &back);
+				back = VTE_RESOLVED_BACK (vte_terminal_resolve_attr (
+						terminal, &cache, cell,
+						VTE_IN_SPAN (i, sel_start, sel_end)));
 
 				bold = cell && cell->attr.bold;
 				j = i + (cell ? cell->attr.columns : 1);
@@ -10565,8 +11539,9 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 					/* Resolve attributes to colors where possible and
 					 * compare visual attributes to the first character
 					 * in this chunk. */
-					selected = vte_cell_is_selected(terminal, j, row, NULL);
-					vte_terminal_determine_colors(terminal, cell, selected, &nfore, &nback);
+					nback = VTE_RESOLVED_BACK (vte_terminal_resolve_attr (
+							terminal, &cache, cell,
+							VTE_IN_SPAN (j, sel_start, sel_end)));
 					if (nback != back) {
 						break;
 					}
@@ -10588,16 +11563,16 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 			} while (i < end_column);
 		} else {
 			do {
-				selected = vte_cell_is_selected(terminal, i, row, NULL);
-				j = i + 1;
-				while (j < end_column){
-					nselected = vte_cell_is_selected(terminal, j, row, NULL);
-					if (nselected != selected) {
-						break;
-					}
-					j++;
+				selected = VTE_IN_SPAN (i, sel_start, sel_end);
+				if (selected) {
+					j = MIN (end_column, sel_end);
+				} else if (i < sel_start) {
+					j = MIN (end_column, sel_start);
+				} else {
+					j = end_column;
 				}
-				vte_terminal_determine_colors(terminal, NULL, selected, &fore, &back);
+				back = VTE_RESOLVED_BACK (vte_terminal_resolve_attr (
+						terminal, &cache, NULL, selected));
 				if (back != VTE_DEF_BG) {
 					_vte_draw_fill_rectangle (terminal->pvt->draw,
 								  x + i *column_width,
@@ -10634,6 +11609,10 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 		while (cell->attr.fragment && i > 0)
 			cell = _vte_row_data_get (row_data, --i);
 
+		vte_terminal_prepare_row(terminal, row,
+					 &sel_start, &sel_end,
+					 &hl_start, &hl_end);
+
 		/* Walk the line. */
 		do {
 			/* Get the character cell's contents. */
@@ -10655,21 +11634,13 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 				}
 			}
 			/* Find the colors for this cell. */
-			selected = vte_cell_is_selected(terminal, i, row, NULL);
-			vte_terminal_determine_colors(terminal, cell, selected, &fore, &back);
-			underline = cell->attr.underline;
-			strikethrough = cell->attr.strikethrough;
-			bold = cell->attr.bold;
-			if (terminal->pvt->show_match) {
-				hilite = vte_cell_is_between(i, row,
-						terminal->pvt->match_start.col,
-						terminal->pvt->match_start.row,
-						terminal->pvt->match_end.col,
-						terminal->pvt->match_end.row,
-						TRUE);
-			} else {
-				hilite = FALSE;
+			resolved = vte_terminal_resolve_attr(terminal, &cache, cell,
+					VTE_IN_SPAN (i, sel_start, sel_end));
+			if (VTE_IN_SPAN (i, hl_start, hl_end)) {
+				resolved |= VTE_RESOLVED_HILITE;
 			}
+			fore = VTE_RESOLVED_FORE (resolved);
+			back = VTE_RESOLVED_BACK (resolved);
 
 			items[0].c = cell->c;
 			items[0].columns = cell->attr.columns;
@@ -10714,7 +11685,9 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 						/* only break the run if we
 						 * are drawing attributes
 						 */
-						if (underline || strikethrough || hilite) {
+						if (resolved & (VTE_RESOLVED_UNDERLINE |
+								VTE_RESOLVED_STRIKETHROUGH |
+								VTE_RESOLVED_HILITE)) {
 							break;
 						} else {
 							j++;
@@ -10724,10 +11697,12 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 					/* Resolve attributes to colors where possible and
 					 * compare visual attributes to the first character
 					 * in this chunk. */
-					selected = vte_cell_is_selected(terminal, j, row, NULL);
-					vte_terminal_determine_colors(terminal, cell, selected, &nfore, &nback);
+					nresolved = vte_terminal_resolve_attr(terminal, &cache, cell,
+							VTE_IN_SPAN (j, sel_start, sel_end));
 					/* Graphic characters must be drawn individually. */
 					if (vte_terminal_unichar_is_local_graphic(terminal, cell->c, cell->attr.bold)) {
+						nfore = VTE_RESOLVED_FORE (nresolved);
+						nback = VTE_RESOLVED_BACK (nresolved);
 						if (vte_terminal_draw_graphic(terminal,
 									cell->c,
 									nfore, nback,
@@ -10743,33 +11718,11 @@ vte_terminal_draw_rows(VteTerminal *terminal,
 							continue;
 						}
 					}
-					if (nfore != fore) {
-						break;
-					}
-					nbold = cell->attr.bold;
-					if (nbold != bold) {
-						break;
-					}
-					/* Break up underlined/not-underlined text. */
-					nunderline = cell->attr.underline;
-					if (nunderline != underline) {
-						break;
-					}
-					nstrikethrough = cell->attr.strikethrough;
-					if (nstrikethrough != strikethrough) {
-						break;
-					}
 					/* Break up matched/not-matched text. */
-					nhilite = FALSE;
-					if (terminal->pvt->show_match) {
-						nhilite = vte_cell_is_between(j, row,
-								terminal->pvt->match_start.col,
-								terminal->pvt->match_start.row,
-								terminal->pvt->match_end.col,
-								terminal->pvt->match_end.row,
-								TRUE);
+					if (VTE_IN_SPAN (j, hl_start, hl_end)) {
+						nresolved |= VTE_RESOLVED_HILITE;
 					}
-					if (nhilite != hilite) {
+					if ((nresolved ^ resolved) & VTE_RESOLVED_RUN_MASK) {
 						break;
 					}
 					/* Add this cell to the draw list. */
@@ -10807,6 +11760,9 @@ fg_next_row:
 				while (cell->attr.fragment && j > 0) {
 					cell = _vte_row_data_get (row_data, --j);
 				}
+				vte_terminal_prepare_row(terminal, row,
+							 &sel_start, &sel_end,
+							 &hl_start, &hl_end);
 			} while (TRUE);
 fg_draw:
 			/* Draw the cells. */
@@ -10814,8 +11770,11 @@ fg_draw:
 					items,
 					item_count,
 					fore, back, FALSE, FALSE,
-					bold, underline,
-					strikethrough, hilite, FALSE,
+					(resolved & VTE_RESOLVED_BOLD) != 0,
+					(resolved & VTE_RESOLVED_UNDERLINE) != 0,
+					(resolved & VTE_RESOLVED_STRIKETHROUGH) != 0,
+					(resolved & VTE_RESOLVED_HILITE) != 0,
+					FALSE,
 					column_width, row_height);
 			item_count = 1;
 			/* We'll need to continue at the first cell which didn't
@@ -10962,6 +11921,8 @@ vte_terminal_paint_cursor(VteTerminal *terminal)
 	if (focus && !blink)
 		return;
 
+	terminal->pvt->cursor_painted_row = drow;
+
 	/* Find the character "under" the cursor. */
 	cell = vte_terminal_find_charcell(terminal, col, drow);
 	while ((cell != NULL) && (cell->attr.fragment) && (col > 0)) {
@@ -11153,58 +12114,308 @@ vte_terminal_paint_im_preedit_string(VteTerminal *terminal)
 }
 
 /* Draw the widget. */
-static void
-vte_terminal_paint(GtkWidget *widget, GdkRegion *region)
+/* Fill in how the cell at (@col, @row) is to be painted right now. */
+static inline void
+vte_terminal_get_painted_cell (VteTerminal *terminal,
+			       const VteRowData *row_data,
+			       glong col, glong row,
+			       VtePaintedCell *painted)
 {
-	VteTerminal *terminal;
-	GtkAllocation allocation;
+	const VteCell *cell = row_data ? _vte_row_data_get (row_data, col) : NULL;
 
-	_vte_debug_print(VTE_DEBUG_LIFECYCLE, "vte_terminal_paint()\n");
-	_vte_debug_print(VTE_DEBUG_WORK, "=");
+	painted->cell = cell ? *cell : basic_cell.cell;
+	painted->flags = VTE_PAINTED_VALID;
+	if (vte_cell_is_selected (terminal, col, row, NULL)) {
+		painted->flags |= VTE_PAINTED_SELECTED;
+	}
+	if (terminal->pvt->show_match &&
+	    vte_cell_is_between (col, row,
+				 terminal->pvt->match_start.col,
+				 terminal->pvt->match_start.row,
+				 terminal->pvt->match_end.col,
+				 terminal->pvt->match_end.row,
+				 TRUE)) {
+		painted->flags |= VTE_PAINTED_HILITE;
+	}
+}
 
-	terminal = VTE_TERMINAL(widget);
-	gtk_widget_get_allocation (widget, &allocation);
+static inline gboolean
+vte_painted_cell_equal (const VtePaintedCell *a, const VtePaintedCell *b)
+{
+	return a->cell.c == b->cell.c &&
+	       ((const VteIntCellAttr *) &a->cell.attr)->i ==
+	       ((const VteIntCellAttr *) &b->cell.attr)->i &&
+	       a->flags == b->flags;
+}
 
-	/* Designate the start of the drawing operation and clear the area. */
-	_vte_draw_start(terminal->pvt->draw);
-	if (terminal->pvt->bg_transparent) {
-		int x, y;
-		gdk_window_get_origin (gtk_widget_get_window (widget), &x, &y);
-		_vte_draw_set_background_scroll(terminal->pvt->draw, x, y);
-	} else {
-		if (terminal->pvt->scroll_background) {
-			_vte_draw_set_background_scroll(terminal->pvt->draw,
-							0,
-							terminal->pvt->screen->scroll_delta *
-							terminal->char_height);
-		} else {
-			_vte_draw_set_background_scroll(terminal->pvt->draw, 0, 0);
+/* Make sure the copy of the painted viewport matches the current view;
+ * if the view changed in a way we did not follow, forget its contents.
+ * Returns FALSE if there is nothing to compare against. */
+static gboolean
+vte_terminal_check_painted (VteTerminal *terminal)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+
+	if (pvt->painted_rows != terminal->row_count ||
+	    pvt->painted_columns != terminal->column_count) {
+		g_free (pvt->painted_cells);
+		pvt->painted_cells = NULL;
+		pvt->painted_rows = terminal->row_count;
+		pvt->painted_columns = terminal->column_count;
+		if (pvt->painted_rows <= 0 || pvt->painted_columns <= 0) {
+			return FALSE;
 		}
+		pvt->painted_cells = g_new0 (VtePaintedCell,
+					     pvt->painted_rows *
+					     pvt->painted_columns);
+	} else if (pvt->painted_screen != pvt->screen ||
+		   pvt->painted_scroll_delta != pvt->screen->scroll_delta) {
+		memset (pvt->painted_cells, 0,
+			pvt->painted_rows * pvt->painted_columns *
+			sizeof (VtePaintedCell));
 	}
+	pvt->painted_screen = pvt->screen;
+	pvt->painted_scroll_delta = pvt->screen->scroll_delta;
 
-	_VTE_DEBUG_IF (VTE_DEBUG_UPDATES) {
-		VteRegionRectangle clip;
-		gdk_region_get_clipbox (region, &clip);
-		g_printerr ("vte_terminal_paint"
-				"	(%d,%d)x(%d,%d) pixels\n",
-				clip.x, clip.y, clip.width, clip.height);
+	return pvt->painted_cells != NULL;
+}
+
+/* The window contents were moved by @delta rows along with the view;
+ * move the copy of the painted cells the same way. */
+static void
+vte_terminal_shift_painted (VteTerminal *terminal, glong delta)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	glong rows = pvt->painted_rows, columns = pvt->painted_columns;
+
+	if (pvt->painted_cells == NULL || pvt->painted_screen != pvt->screen ||
+	    pvt->painted_scroll_delta != pvt->screen->scroll_delta + delta ||
+	    ABS (delta) >= rows) {
+		return;
 	}
+	/* contents moving down means the view moved up */
+	if (delta > 0) {
+		memmove (pvt->painted_cells + delta * columns,
+			 pvt->painted_cells,
+			 (rows - delta) * columns * sizeof (VtePaintedCell));
+		memset (pvt->painted_cells, 0,
+			delta * columns * sizeof (VtePaintedCell));
+	} else {
+		memmove (pvt->painted_cells,
+			 pvt->painted_cells - delta * columns,
+			 (rows + delta) * columns * sizeof (VtePaintedCell));
+		memset (pvt->painted_cells + (rows + delta) * columns, 0,
+			-delta * columns * sizeof (VtePaintedCell));
+	}
+	pvt->painted_scroll_delta -= delta;
+}
 
-	_vte_draw_clip(terminal->pvt->draw, region);
-	gtk_widget_get_allocation(&terminal->widget, &allocation);
-	_vte_draw_clear (terminal->pvt->draw, 0, 0,
-			 allocation.width, allocation.height);
+/* Remember the cells lying entirely within @area as painted, and forget
+ * the ones it only partly covers: those now show a bit of both. */
+static void
+vte_terminal_record_painted (VteTerminal *terminal, const VteRegionRectangle *area)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	glong row, row_stop, col, col_stop, i, delta;
+	glong row_first, row_last, col_first, col_last;
 
-	/* Calculate the bounding rectangle. */
-	{
-		VteRegionRectangle *rectangles;
-		gint n, n_rectangles;
-		gdk_region_get_rectangles (region, &rectangles, &n_rectangles);
-		/* don't bother to enlarge an invalidate all */
-		if (!(n_rectangles == 1
-		      && rectangles[0].width == allocation.width
-		      && rectangles[0].height == allocation.height)) {
-			GdkRegion *rr = gdk_region_new ();
+	if (!vte_terminal_check_painted (terminal)) {
+		return;
+	}
+
+	/* the cells fully inside */
+	col = MAX (0, howmany (area->x - pvt->inner_border.left,
+			       terminal->char_width));
+	col_stop = MIN ((area->x + area->width - pvt->inner_border.left) /
+			terminal->char_width,
+			terminal->column_count);
+	row = MAX (0, howmany (area->y - pvt->inner_border.top,
+			       terminal->char_height));
+	row_stop = MIN ((area->y + area->height - pvt->inner_border.top) /
+			terminal->char_height,
+			terminal->row_count);
+	/* and the ones touched at all */
+	col_first = MAX (0, (area->x - pvt->inner_border.left) /
+			    terminal->char_width);
+	col_last = MIN (howmany (area->x + area->width - pvt->inner_border.left,
+				 terminal->char_width),
+			terminal->column_count);
+	row_first = MAX (0, (area->y - pvt->inner_border.top) /
+			    terminal->char_height);
+	row_last = MIN (howmany (area->y + area->height - pvt->inner_border.top,
+				 terminal->char_height),
+			terminal->row_count);
+	if (col_first >= col_last || row_first >= row_last) {
+		return;
+	}
+
+	delta = pvt->screen->scroll_delta;
+	for (; row_first < row_last; row_first++) {
+		VtePaintedCell *painted =
+			pvt->painted_cells + row_first * pvt->painted_columns;
+		const VteRowData *row_data;
+
+		if (row_first < row || row_first >= row_stop ||
+		    col >= col_stop) {
+			memset (painted + col_first, 0,
+				(col_last - col_first) * sizeof (VtePaintedCell));
+			continue;
+		}
+		for (i = col_first; i < col; i++) {
+			memset (&painted[i], 0, sizeof (VtePaintedCell));
+		}
+		row_data = _vte_terminal_find_row_data (terminal,
+							row_first + delta);
+		for (i = col; i < col_stop; i++) {
+			vte_terminal_get_painted_cell (terminal, row_data,
+						       i, row_first + delta,
+						       &painted[i]);
+		}
+		for (i = col_stop; i < col_last; i++) {
+			memset (&painted[i], 0, sizeof (VtePaintedCell));
+		}
+	}
+}
+
+/* Shrink the dirty spans to the cells whose contents differ from what was
+ * last painted there, so that applications redrawing the whole screen
+ * with mostly the same text only cost us the cells that changed. */
+static void
+vte_terminal_drop_unchanged_cells (VteTerminal *terminal)
+{
+	VteTerminalPrivate *pvt = terminal->pvt;
+	glong row, end, delta, dropped = 0;
+
+	if (!vte_terminal_check_painted (terminal)) {
+		return;
+	}
+
+	delta = pvt->screen->scroll_delta;
+	end = MIN (MIN (pvt->dirty_row_end, pvt->dirty_spans_len),
+		   terminal->row_count);
+	for (row = pvt->dirty_row_start; row < end; row++) {
+		VteDirtySpan *span = &pvt->dirty_spans[row];
+		const VtePaintedCell *old;
+		const VteRowData *row_data;
+		VtePaintedCell cur;
+		glong col, stop, first = -1, last = -1;
+
+		if (span->start >= span->end || span->keep) {
+			continue;
+		}
+		/* the cursor is painted on top of the cells */
+		if (row + delta == pvt->screen->cursor_current.row ||
+		    row + delta == pvt->cursor_painted_row) {
+			continue;
+		}
+
+		old = pvt->painted_cells + row * pvt->painted_columns;
+		row_data = _vte_terminal_find_row_data (terminal, row + delta);
+		stop = MIN (span->end, terminal->column_count);
+		for (col = span->start; col < stop; col++) {
+			vte_terminal_get_painted_cell (terminal, row_data,
+						       col, row + delta, &cur);
+			if (!vte_painted_cell_equal (&cur, &old[col])) {
+				if (first < 0) {
+					first = col;
+				}
+				last = col;
+				/* a wide character covers the following cells */
+				if (cur.cell.attr.columns > 1) {
+					last = MAX (last, col + cur.cell.attr.columns - 1);
+				}
+				if (old[col].cell.attr.columns > 1) {
+					last = MAX (last, col + old[col].cell.attr.columns - 1);
+				}
+			}
+		}
+
+		if (first < 0) {
+			dropped += span->end - span->start;
+			span->start = span->end = 0;
+			continue;
+		}
+		/* and a continuation cell belongs to the one before it */
+		while (first > 0 && old[first].cell.attr.fragment) {
+			first--;
+		}
+		if (row_data != NULL) {
+			const VteCell *cell;
+			while (first > 0 &&
+			       (cell = _vte_row_data_get (row_data, first)) != NULL &&
+			       cell->attr.fragment) {
+				first--;
+			}
+		}
+		last = MIN (last + 1, terminal->column_count);
+		dropped += MAX (0, (span->end - span->start) - (last - first));
+		span->start = first;
+		span->end = last;
+	}
+
+	_vte_debug_print (VTE_DEBUG_UPDATES,
+			"Dropped %ld unchanged cells.\n", dropped);
+}
+
+static void
+vte_terminal_paint(GtkWidget *widget, GdkRegion *region)
+{
+	VteTerminal *terminal;
+	GtkAllocation allocation;
+
+	_vte_debug_print(VTE_DEBUG_LIFECYCLE, "vte_terminal_paint()\n");
+	_vte_debug_print(VTE_DEBUG_WORK, "=");
+
+	terminal = VTE_TERMINAL(widget);
+	gtk_widget_get_allocation (widget, &allocation);
+
+	vte_terminal_scrollback_viewed (terminal);
+
+	/* Designate the start of the drawing operation and clear the area. */
+	_vte_draw_start(terminal->pvt->draw);
+	if (terminal->pvt->bg_transparent) {
+		int x, y;
+		gdk_window_get_origin (gtk_widget_get_window (widget), &x, &y);
+		_vte_draw_set_background_scroll(terminal->pvt->draw, x, y);
+	} else {
+		if (terminal->pvt->scroll_background) {
+			_vte_draw_set_background_scroll(terminal->pvt->draw,
+							0,
+							terminal->pvt->screen->scroll_delta *
+							terminal->char_height);
+		} else {
+			_vte_draw_set_background_scroll(terminal->pvt->draw, 0, 0);
+		}
+	}
+
+	_VTE_DEBUG_IF (VTE_DEBUG_UPDATES) {
+		VteRegionRectangle clip;
+		gdk_region_get_clipbox (region, &clip);
+		g_printerr ("vte_terminal_paint"
+				"	(%d,%d)x(%d,%d) pixels\n",
+				clip.x, clip.y, clip.width, clip.height);
+	}
+
+	_vte_draw_clip(terminal->pvt->draw, region);
+	_vte_draw_begin_bands(terminal->pvt->draw, region,
+			      terminal->char_height);
+	gtk_widget_get_allocation(&terminal->widget, &allocation);
+	_vte_draw_clear (terminal->pvt->draw, 0, 0,
+			 allocation.width, allocation.height);
+
+	/* Calculate the bounding rectangle. */
+	{
+		VteRegionRectangle *rectangles;
+		gint n, n_rectangles;
+		gdk_region_get_rectangles (region, &rectangles, &n_rectangles);
+		for (n = 0; n < n_rectangles; n++) {
+			vte_terminal_record_painted (terminal, rectangles + n);
+		}
+		/* don't bother to enlarge an invalidate all */
+		if (!(n_rectangles == 1
+		      && rectangles[0].width == allocation.width
+		      && rectangles[0].height == allocation.height)) {
+			GdkRegion *rr = gdk_region_new ();
 			/* convert pixels into whole cells */
 			for (n = 0; n < n_rectangles; n++) {
 				vte_terminal_expand_region (terminal, rr, rectangles + n);
@@ -11221,6 +12432,8 @@ vte_terminal_paint(GtkWidget *widget, GdkRegion *region)
 		g_free (rectangles);
 	}
 
+	_vte_draw_end_bands(terminal->pvt->draw);
+
 	vte_terminal_paint_cursor(terminal);
 
 	vte_terminal_paint_im_preedit_string(terminal);
@@ -11302,6 +12515,35 @@ vte_terminal_draw(GtkWidget *widget,
 
 #else
 
+/* Mark the cells under an exposed area as dirty.  Cells on the edges of
+ * the screen cover the inner border next to them as well. */
+static void
+vte_terminal_expose_cells (VteTerminal *terminal, const GdkRectangle *area)
+{
+	glong col_start, col_end, row_start, row_end;
+
+	col_start = (area->x - terminal->pvt->inner_border.left) /
+		    terminal->char_width;
+	col_end = howmany (area->x + area->width -
+			   terminal->pvt->inner_border.left,
+			   terminal->char_width);
+	row_start = (area->y - terminal->pvt->inner_border.top) /
+		    terminal->char_height;
+	row_end = howmany (area->y + area->height -
+			   terminal->pvt->inner_border.top,
+			   terminal->char_height);
+
+	col_start = CLAMP (col_start, 0, terminal->column_count - 1);
+	col_end = CLAMP (col_end, col_start + 1, terminal->column_count);
+	row_start = CLAMP (row_start, 0, terminal->row_count - 1);
+	row_end = CLAMP (row_end, row_start + 1, terminal->row_count);
+
+	vte_terminal_add_dirty_cells (terminal,
+				      col_start, col_end - col_start,
+				      row_start, row_end - row_start,
+				      TRUE);
+}
+
 static gboolean
 vte_terminal_expose(GtkWidget *widget,
                     GdkEventExpose *event)
@@ -11321,21 +12563,48 @@ vte_terminal_expose(GtkWidget *widget,
 		/* fix up a race condition where we schedule a delayed update
 		 * after an 'immediate' invalidate all */
 		if (terminal->pvt->invalidated_all &&
-				terminal->pvt->update_regions == NULL) {
+				!vte_terminal_has_dirty (terminal)) {
 			terminal->pvt->invalidated_all = FALSE;
 		}
 		/* if we expect to redraw the widget soon,
 		 * just add this event to the list */
 		if (!terminal->pvt->invalidated_all) {
+			VteRegionRectangle *rectangles, grid;
+			GdkRegion *slack, *cells;
+			gint n, n_rectangles;
+
 			gtk_widget_get_allocation (widget, &allocation);
-			if (event->area.width >= allocation.width &&
-			    event->area.height >= allocation.height) {
+			gdk_region_get_rectangles (event->region,
+						   &rectangles, &n_rectangles);
+			if (n_rectangles == 1 &&
+			    rectangles[0].width >= allocation.width &&
+			    rectangles[0].height >= allocation.height) {
 				_vte_invalidate_all (terminal);
 			} else {
-				terminal->pvt->update_regions =
-					g_slist_prepend (terminal->pvt->update_regions,
-							gdk_region_copy (event->region));
+				for (n = 0; n < n_rectangles; n++) {
+					vte_terminal_expose_cells (terminal,
+								   rectangles + n);
+				}
+				/* The cells stop short of the slack to the
+				 * right of and below the grid; nobody else
+				 * repaints it, so do it now. */
+				grid.x = grid.y = 0;
+				grid.width = terminal->pvt->inner_border.left +
+					     terminal->column_count * terminal->char_width +
+					     terminal->pvt->inner_border.right;
+				grid.height = terminal->pvt->inner_border.top +
+					      terminal->row_count * terminal->char_height +
+					      terminal->pvt->inner_border.bottom;
+				cells = gdk_region_rectangle (&grid);
+				slack = gdk_region_copy (event->region);
+				gdk_region_subtract (slack, cells);
+				gdk_region_destroy (cells);
+				if (!gdk_region_empty (slack)) {
+					vte_terminal_paint (widget, slack);
+				}
+				gdk_region_destroy (slack);
 			}
+			g_free (rectangles);
 		}
 	} else {
 		vte_terminal_paint(widget, event->region);
@@ -12360,6 +13629,28 @@ vte_terminal_class_init(VteTerminalClass *klass)
                              g_cclosure_marshal_VOID__VOID,
 			     G_TYPE_NONE, 0);
 
+        /**
+         * VteTerminal::history-trimmed:
+         * @vteterminal: the object which received the signal
+         * @lines: the number of lines removed from the history
+         *
+         * Emitted when the oldest lines of the scrollback history were
+         * discarded to keep the total scrollback of all terminals in the
+         * process within the budget set with
+         * vte_terminal_set_global_scrollback_budget().
+         *
+         * Since: 0.32
+         */
+	signals[HISTORY_TRIMMED] =
+                g_signal_new(I_("history-trimmed"),
+			     G_OBJECT_CLASS_TYPE(klass),
+			     G_SIGNAL_RUN_LAST,
+			     0,
+			     NULL,
+			     NULL,
+                             g_cclosure_marshal_VOID__INT,
+			     G_TYPE_NONE, 1, G_TYPE_INT);
+
         /**
          * VteTerminal::beep:
          * @vteterminal: the object which received the signal
@@ -13065,6 +14356,7 @@ static void
 vte_terminal_real_copy_clipboard(VteTerminal *terminal)
 {
 	_vte_debug_print(VTE_DEBUG_SELECTION, "Copying to CLIPBOARD.\n");
+	vte_terminal_selection_read_pending(terminal);
 	if (terminal->pvt->selection != NULL) {
 		GtkClipboard *clipboard;
 		clipboard = vte_terminal_clipboard_get(terminal,
@@ -13716,6 +15008,9 @@ vte_terminal_set_scrollback_lines(VteTerminal *terminal, glong lines)
 	screen = pvt->screen;
 	scroll_delta = screen->scroll_delta;
 
+	/* The rows of the copied text may be dropped. */
+	vte_terminal_selection_read_pending(terminal);
+
 	/* The main screen gets the full scrollback buffer, but the
 	 * alternate screen isn't allowed to scroll at all. */
 	if (screen == &terminal->pvt->normal_screen) {
@@ -13746,11 +15041,213 @@ vte_terminal_set_scrollback_lines(VteTerminal *terminal, glong lines)
 	vte_terminal_queue_adjustment_value_changed (terminal, scroll_delta);
 	_vte_terminal_adjust_adjustments_full (terminal);
 
+	/* A larger history may go over the budget without more output */
+	vte_terminal_queue_scrollback_budget_check ();
+
         g_object_notify(object, "scrollback-lines");
 
         g_object_thaw_notify(object);
 }
 
+/**
+ * vte_terminal_get_scrollback_disk_usage:
+ * @terminal: a #VteTerminal
+ *
+ * Returns the number of bytes the scrollback history of @terminal currently
+ * occupies in its temporary backing files.  Old history is released in
+ * pages as it scrolls off, so this closely follows the scrollback size set
+ * with vte_terminal_set_scrollback_lines().
+ *
+ * Returns: the on-disk size of the scrollback history, in bytes
+ *
+ * Since: 0.32
+ */
+gsize
+vte_terminal_get_scrollback_disk_usage(VteTerminal *terminal)
+{
+        VteTerminalPrivate *pvt;
+
+	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), 0);
+
+        pvt = terminal->pvt;
+	return _vte_ring_get_storage_size (pvt->normal_screen.row_data) +
+	       _vte_ring_get_storage_size (pvt->alternate_screen.row_data);
+}
+
+/*
+ * Process-wide scrollback budget
+ */
+
+static void
+vte_terminal_scrollback_viewed (VteTerminal *terminal)
+{
+	GList *link = terminal->pvt->scrollback_link;
+
+	if (scrollback_terminals == link)
+		return;
+
+	scrollback_terminals = g_list_remove_link (scrollback_terminals, link);
+	scrollback_terminals = g_list_concat (link, scrollback_terminals);
+}
+
+static void
+vte_terminal_emit_history_trimmed (VteTerminal *terminal, glong lines)
+{
+	VteScreen *screen = &terminal->pvt->normal_screen;
+	glong delta = _vte_ring_delta (screen->row_data);
+
+	_vte_debug_print(VTE_DEBUG_SIGNALS,
+			"Emitting `history-trimmed' (%ld lines).\n", lines);
+
+	if (screen == terminal->pvt->screen) {
+		if (screen->scroll_delta < delta)
+			vte_terminal_queue_adjustment_value_changed (terminal, delta);
+		_vte_terminal_adjust_adjustments (terminal);
+	} else {
+		screen->scroll_delta = MAX (screen->scroll_delta, delta);
+	}
+
+	g_signal_emit (terminal, signals[HISTORY_TRIMMED], 0, (gint) lines);
+}
+
+/* The part of the disk usage the budget check can trim: the alternate
+ * screen keeps no scrollback, and its rows are left alone */
+static gsize
+vte_terminal_get_scrollback_trimmable_usage (VteTerminal *terminal)
+{
+	return _vte_ring_get_storage_size (terminal->pvt->normal_screen.row_data);
+}
+
+/* A terminal whose history the budget trimmed, and by how many lines */
+typedef struct {
+	VteTerminal *terminal;
+	glong lines;
+} VteHistoryTrim;
+
+static gboolean
+vte_terminal_scrollback_budget_timeout (gpointer data)
+{
+	VteHistoryTrim trimmed;
+	GArray *trimmed_terminals;
+	GList *l;
+	gsize total = 0;
+	guint i;
+
+	GDK_THREADS_ENTER();
+
+	scrollback_budget_tag = 0;
+
+	for (l = scrollback_terminals; l != NULL; l = l->next)
+		total += vte_terminal_get_scrollback_trimmable_usage (l->data);
+
+	_vte_debug_print (VTE_DEBUG_RING,
+			"Scrollback budget check: %"G_GSIZE_FORMAT" of %"G_GSIZE_FORMAT" bytes used.\n",
+			total, scrollback_budget);
+
+	/* Drop history pages from the least recently viewed terminals
+	 * first, never touching the rows on screen.  Handlers of
+	 * history-trimmed may scroll or destroy a terminal, which reorders
+	 * or shortens the list, so they only run once we are done with it. */
+	trimmed_terminals = g_array_new (FALSE, FALSE, sizeof (trimmed));
+	for (l = g_list_last (scrollback_terminals);
+	     l != NULL && total > scrollback_budget;
+	     l = l->prev) {
+		VteTerminal *terminal = l->data;
+		VteScreen *screen = &terminal->pvt->normal_screen;
+		gsize before, after;
+		glong lines = 0, dropped;
+
+		before = vte_terminal_get_scrollback_trimmable_usage (terminal);
+		if (terminal->pvt->selection_copied_ring == screen->row_data)
+			vte_terminal_selection_read_pending (terminal);
+		while (total > scrollback_budget &&
+		       (dropped = _vte_ring_drop_page (screen->row_data,
+						       MIN (screen->insert_delta,
+							    screen->scroll_delta)))) {
+			lines += dropped;
+			after = vte_terminal_get_scrollback_trimmable_usage (terminal);
+			total -= before - after;
+			before = after;
+		}
+
+		if (lines) {
+			trimmed.terminal = g_object_ref (terminal);
+			trimmed.lines = lines;
+			g_array_append_val (trimmed_terminals, trimmed);
+		}
+	}
+
+	for (i = 0; i < trimmed_terminals->len; i++) {
+		trimmed = g_array_index (trimmed_terminals, VteHistoryTrim, i);
+		vte_terminal_emit_history_trimmed (trimmed.terminal, trimmed.lines);
+		g_object_unref (trimmed.terminal);
+	}
+	g_array_free (trimmed_terminals, TRUE);
+
+	GDK_THREADS_LEAVE();
+
+	return FALSE;
+}
+
+static void
+vte_terminal_queue_scrollback_budget_check (void)
+{
+	if (scrollback_budget == 0 || scrollback_budget_tag != 0)
+		return;
+
+	scrollback_budget_tag =
+		g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE,
+				    VTE_SCROLLBACK_BUDGET_TIMEOUT,
+				    vte_terminal_scrollback_budget_timeout, NULL,
+				    NULL);
+}
+
+/**
+ * vte_terminal_set_global_scrollback_budget:
+ * @bytes: the maximum size of all scrollback history, in bytes, or 0
+ *
+ * Sets a budget for the on-disk size of the scrollback history of all
+ * terminals in the process together.  Only the history of the normal
+ * screens counts, as that is all that can be trimmed.  When it is
+ * exceeded, the oldest history of the least recently viewed terminals is
+ * discarded first, and #VteTerminal::history-trimmed is emitted on each
+ * terminal affected.
+ *
+ * This comes on top of the per-terminal limit set with
+ * vte_terminal_set_scrollback_lines().  A value of 0 means no budget.
+ *
+ * Since: 0.32
+ */
+void
+vte_terminal_set_global_scrollback_budget(gsize bytes)
+{
+	_vte_debug_print (VTE_DEBUG_MISC,
+			"Setting scrollback budget to %"G_GSIZE_FORMAT" bytes\n", bytes);
+
+	scrollback_budget = bytes;
+
+	if (scrollback_budget == 0 && scrollback_budget_tag != 0) {
+		g_source_remove (scrollback_budget_tag);
+		scrollback_budget_tag = 0;
+	}
+
+	vte_terminal_queue_scrollback_budget_check ();
+}
+
+/**
+ * vte_terminal_get_global_scrollback_budget:
+ *
+ * Returns: the process-wide scrollback budget in bytes, or 0 if there is
+ *   none; see vte_terminal_set_global_scrollback_budget()
+ *
+ * Since: 0.32
+ */
+gsize
+vte_terminal_get_global_scrollback_budget(void)
+{
+	return scrollback_budget;
+}
+
 /**
  * vte_terminal_set_word_chars:
  * @terminal: a #VteTerminal
@@ -13767,79 +15264,12 @@ vte_terminal_set_scrollback_lines(VteTerminal *terminal, glong lines)
 void
 vte_terminal_set_word_chars(VteTerminal *terminal, const char *spec)
 {
-	VteConv conv;
-	gunichar *wbuf;
-	guchar *ibuf, *ibufptr, *obuf, *obufptr;
-	gsize ilen, olen;
-	VteWordCharRange range;
-	guint i;
-
 	g_return_if_fail(VTE_IS_TERMINAL(terminal));
-	/* Allocate a new range array. */
+
 	if (terminal->pvt->word_chars != NULL) {
-		g_array_free(terminal->pvt->word_chars, TRUE);
-	}
-	terminal->pvt->word_chars = g_array_new(FALSE, TRUE,
-						sizeof(VteWordCharRange));
-	/* Special case: if spec is NULL, try to do the right thing. */
-	if (spec == NULL || spec[0] == '\0') {
-                g_object_notify(G_OBJECT(terminal), "word-chars");
-		return;
-	}
-	/* Convert the spec from UTF-8 to a string of gunichars . */
-        /* FIXME: why not just directly use g_utf8_to_ucs4 here? It'll never fail */
-	conv = _vte_conv_open(VTE_CONV_GUNICHAR_TYPE, "UTF-8");
-	if (conv == VTE_INVALID_CONV) {
-		/* Aaargh.  We're screwed. */
-		g_warning(_("_vte_conv_open() failed setting word characters"));
-		return;
-	}
-	ilen = strlen(spec);
-	ibuf = ibufptr = (guchar *)g_strdup(spec);
-	olen = (ilen + 1) * sizeof(gunichar);
-	_vte_buffer_set_minimum_size(terminal->pvt->conv_buffer, olen);
-	obuf = obufptr = terminal->pvt->conv_buffer->data;
-	wbuf = (gunichar*) obuf;
-	wbuf[ilen] = '\0';
-	_vte_conv(conv, (const guchar **)&ibuf, &ilen, &obuf, &olen);
-	_vte_conv_close(conv);
-	for (i = 0; i < ((obuf - obufptr) / sizeof(gunichar)); i++) {
-		/* The hyphen character. */
-		if (wbuf[i] == '-') {
-			range.start = wbuf[i];
-			range.end = wbuf[i];
-			g_array_append_val(terminal->pvt->word_chars, range);
-			_vte_debug_print(VTE_DEBUG_MISC,
-				"Word charset includes hyphen.\n");
-			continue;
-		}
-		/* A single character, not the start of a range. */
-		if ((wbuf[i] != '-') && (wbuf[i + 1] != '-')) {
-			range.start = wbuf[i];
-			range.end = wbuf[i];
-			g_array_append_val(terminal->pvt->word_chars, range);
-			_vte_debug_print(VTE_DEBUG_MISC,
-					"Word charset includes `%lc'.\n",
-					(wint_t) wbuf[i]);
-			continue;
-		}
-		/* The start of a range. */
-		if ((wbuf[i] != '-') &&
-		    (wbuf[i + 1] == '-') &&
-		    (wbuf[i + 2] != '-') &&
-		    (wbuf[i + 2] != 0)) {
-			range.start = wbuf[i];
-			range.end = wbuf[i + 2];
-			g_array_append_val(terminal->pvt->word_chars, range);
-			_vte_debug_print(VTE_DEBUG_MISC,
-					"Word charset includes range from "
-					"`%lc' to `%lc'.\n", (wint_t) wbuf[i],
-					(wint_t) wbuf[i + 2]);
-			i += 2;
-			continue;
-		}
+		_vte_word_chars_free(terminal->pvt->word_chars);
 	}
-	g_free(ibufptr);
+	terminal->pvt->word_chars = _vte_word_chars_new_from_spec(spec);
 
         g_object_notify(G_OBJECT(terminal), "word-chars");
 }
@@ -14022,6 +15452,8 @@ vte_terminal_reset(VteTerminal *terminal,
 		_vte_ring_init(pvt->normal_screen.row_data, pvt->scrollback_lines);
 		_vte_ring_fini(pvt->alternate_screen.row_data);
 		_vte_ring_init(pvt->alternate_screen.row_data, terminal->row_count);
+		_vte_ring_set_columns(pvt->normal_screen.row_data, terminal->column_count);
+		_vte_ring_set_columns(pvt->alternate_screen.row_data, terminal->column_count);
 		pvt->normal_screen.cursor_saved.row = 0;
 		pvt->normal_screen.cursor_saved.col = 0;
 		pvt->normal_screen.cursor_current.row = 0;
@@ -14084,6 +15516,7 @@ vte_terminal_reset(VteTerminal *terminal,
 	if (pvt->selection != NULL) {
 		g_free(pvt->selection);
 		pvt->selection = NULL;
+		pvt->selection_pending = FALSE;
 		memset(&pvt->selection_origin, 0,
 		       sizeof(&pvt->selection_origin));
 		memset(&pvt->selection_last, 0,
@@ -14493,6 +15926,7 @@ _vte_terminal_get_selection(VteTerminal *terminal)
 {
 	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), NULL);
 
+	vte_terminal_selection_read_pending(terminal);
 	return g_strdup (terminal->pvt->selection);
 }
 
@@ -14601,12 +16035,7 @@ add_update_timeout (VteTerminal *terminal)
 static void
 reset_update_regions (VteTerminal *terminal)
 {
-	if (terminal->pvt->update_regions != NULL) {
-		g_slist_foreach (terminal->pvt->update_regions,
-				(GFunc)gdk_region_destroy, NULL);
-		g_slist_free (terminal->pvt->update_regions);
-		terminal->pvt->update_regions = NULL;
-	}
+	vte_terminal_clear_dirty (terminal);
 	/* the invalidated_all flag also marks whether to skip processing
 	 * due to the widget being invisible */
 	terminal->pvt->invalidated_all =
@@ -14617,7 +16046,7 @@ static void
 remove_from_active_list (VteTerminal *terminal)
 {
 	if (terminal->pvt->active != NULL
-			&& terminal->pvt->update_regions == NULL) {
+			&& !vte_terminal_has_dirty (terminal)) {
 		_vte_debug_print(VTE_DEBUG_TIMEOUT,
 			"Removing terminal from active list\n");
 		active_terminals = g_list_delete_link (active_terminals,
@@ -14815,7 +16244,7 @@ process_timeout (gpointer data)
 			terminal->pvt->input_bytes = 0;
 		} else
 			vte_terminal_emit_pending_signals (terminal);
-		if (!active && terminal->pvt->update_regions == NULL) {
+		if (!active && !vte_terminal_has_dirty (terminal)) {
 			if (terminal->pvt->active != NULL) {
 				_vte_debug_print(VTE_DEBUG_TIMEOUT,
 						"Removing terminal from active list [process]\n");
@@ -14859,9 +16288,10 @@ process_timeout (gpointer data)
 static gboolean
 update_regions (VteTerminal *terminal)
 {
-	GSList *l;
+	VteTerminalPrivate *pvt = terminal->pvt;
 	GdkRegion *region;
 	GdkWindow *window;
+	guint n_rects;
 
 	if (G_UNLIKELY (! gtk_widget_is_drawable (&terminal->widget)
 				|| terminal->pvt->visibility_state == GDK_VISIBILITY_FULLY_OBSCURED)) {
@@ -14869,24 +16299,29 @@ update_regions (VteTerminal *terminal)
 		return FALSE;
 	}
 
-	if (G_UNLIKELY (!terminal->pvt->update_regions))
+	if (G_UNLIKELY (!vte_terminal_has_dirty (terminal)))
 		return FALSE;
 
+	if (pvt->dirty_all) {
+		GtkAllocation allocation;
+		VteRegionRectangle rect;
 
-	l = terminal->pvt->update_regions;
-	if (g_slist_next (l) != NULL) {
-		/* amalgamate into one super-region */
-		region = gdk_region_new ();
-		do {
-			gdk_region_union (region, l->data);
-			gdk_region_destroy (l->data);
-		} while ((l = g_slist_next (l)) != NULL);
+		gtk_widget_get_allocation (&terminal->widget, &allocation);
+		rect.x = rect.y = 0;
+		rect.width = allocation.width;
+		rect.height = allocation.height;
+		region = gdk_region_rectangle (&rect);
+		n_rects = 1;
 	} else {
-		region = l->data;
+		/* merge the row spans into a few rectangles */
+		vte_terminal_drop_unchanged_cells (terminal);
+		region = vte_terminal_get_dirty_region (terminal, &n_rects);
 	}
-	g_slist_free (terminal->pvt->update_regions);
-	terminal->pvt->update_regions = NULL;
-	terminal->pvt->invalidated_all = FALSE;
+	_vte_debug_print (VTE_DEBUG_UPDATES,
+			"Repainting %u rectangles for %u invalidations.\n",
+			n_rects, pvt->dirty_count);
+	vte_terminal_clear_dirty (terminal);
+	pvt->invalidated_all = FALSE;
 
 	/* and perform the merge with the window visible area */
 	window = gtk_widget_get_window (&terminal->widget);
@@ -15112,22 +16547,200 @@ vte_terminal_write_contents (VteTerminal *terminal,
 					 cancellable, error);
 }
 
+typedef struct {
+	GSimpleAsyncResult *result;
+	GOutputStream *stream;
+	int io_priority;
+	GCancellable *cancellable;
+	VteRingWriter *writer;
+	GString *buffer;
+	gsize written;
+} VteWriteJob;
 
-/*
- * Buffer search
- */
+static void
+vte_terminal_write_job_complete (VteWriteJob *job, GError *error)
+{
+	if (error) {
+		g_simple_async_result_set_from_error (job->result, error);
+		g_error_free (error);
+	} else
+		g_simple_async_result_set_op_res_gboolean (job->result, TRUE);
+	g_simple_async_result_complete_in_idle (job->result);
 
-/* TODO Add properties & signals */
+	g_object_unref (job->result);
+	g_object_unref (job->stream);
+	if (job->cancellable)
+		g_object_unref (job->cancellable);
+	_vte_ring_writer_free (job->writer);
+	g_string_free (job->buffer, TRUE);
+	g_slice_free (VteWriteJob, job);
+}
 
-/**
- * vte_terminal_search_set_gregex:
- * @terminal: a #VteTerminal
- * @regex: (allow-none): a #GRegex, or %NULL
- *
- * Sets the #GRegex regex to search for. Unsets the search regex when passed %NULL.
- *
- * Since: 0.26
- */
+static void vte_terminal_write_job_written (GObject *source, GAsyncResult *res, gpointer data);
+
+/* Reads the next chunk from the ring and hands it to the stream, whose
+ * blocking writes happen in a GIO worker thread */
+static void
+vte_terminal_write_job_next (VteWriteJob *job)
+{
+	GError *error = NULL;
+
+	g_string_truncate (job->buffer, 0);
+	if (g_cancellable_set_error_if_cancelled (job->cancellable, &error) ||
+	    !_vte_ring_writer_read (job->writer, job->buffer,
+				    VTE_RING_WRITER_CHUNK_SIZE, &error) ||
+	    job->buffer->len == 0) {
+		vte_terminal_write_job_complete (job, error);
+		return;
+	}
+
+	job->written = 0;
+	g_output_stream_write_async (job->stream,
+				     job->buffer->str, job->buffer->len,
+				     job->io_priority, job->cancellable,
+				     vte_terminal_write_job_written, job);
+}
+
+static void
+vte_terminal_write_job_written (GObject *source, GAsyncResult *res, gpointer data)
+{
+	VteWriteJob *job = data;
+	GError *error = NULL;
+	gssize n;
+
+	n = g_output_stream_write_finish (job->stream, res, &error);
+	if (n < 0) {
+		vte_terminal_write_job_complete (job, error);
+		return;
+	}
+
+	job->written += n;
+	if (job->written < job->buffer->len)
+		g_output_stream_write_async (job->stream,
+					     job->buffer->str + job->written,
+					     job->buffer->len - job->written,
+					     job->io_priority, job->cancellable,
+					     vte_terminal_write_job_written, job);
+	else
+		vte_terminal_write_job_next (job);
+}
+
+/**
+ * vte_terminal_write_contents_async:
+ * @terminal: a #VteTerminal
+ * @stream: a #GOutputStream to write to
+ * @start_row: the first row to write
+ * @end_row: the last row to write
+ * @flags: a set of #VteTerminalWriteFlags
+ * @io_priority: the I/O priority of the writes
+ * @cancellable: (allow-none): a #GCancellable object, or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the contents are written
+ * @user_data: data to pass to @callback
+ *
+ * Like vte_terminal_write_contents(), but writes only the rows from
+ * @start_row to @end_row, and without blocking the widget.  Rows count from
+ * the start of the scrollback buffer, like the value of the terminal's
+ * adjustment; the range is clipped to the rows in the buffer.
+ *
+ * The contents are those of the rows when the call is made.  They are read
+ * a chunk at a time from the main loop and written to @stream
+ * asynchronously.  If the scrollback is trimmed past the rows not yet
+ * written, the operation fails with %G_IO_ERROR_FAILED.
+ *
+ * Call vte_terminal_write_contents_finish() from @callback to get the
+ * result of the operation.
+ *
+ * Since: 0.32
+ */
+void
+vte_terminal_write_contents_async (VteTerminal *terminal,
+				   GOutputStream *stream,
+				   glong start_row,
+				   glong end_row,
+				   VteTerminalWriteFlags flags,
+				   int io_priority,
+				   GCancellable *cancellable,
+				   GAsyncReadyCallback callback,
+				   gpointer user_data)
+{
+	VteRing *ring;
+	VteWriteJob *job;
+
+	g_return_if_fail(VTE_IS_TERMINAL(terminal));
+	g_return_if_fail(G_IS_OUTPUT_STREAM(stream));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	ring = terminal->pvt->screen->row_data;
+	start_row = MAX (start_row, _vte_ring_delta (ring));
+	/* end_row may well be G_MAXLONG */
+	end_row = MAX (start_row, end_row < _vte_ring_next (ring) ? end_row + 1 : _vte_ring_next (ring));
+
+	job = g_slice_new0 (VteWriteJob);
+	job->result = g_simple_async_result_new (G_OBJECT (terminal),
+						 callback, user_data,
+						 vte_terminal_write_contents_async);
+	job->stream = g_object_ref (stream);
+	job->io_priority = io_priority;
+	if (cancellable)
+		job->cancellable = g_object_ref (cancellable);
+	job->writer = _vte_ring_writer_new (ring, start_row, end_row, flags);
+	job->buffer = g_string_sized_new (VTE_RING_WRITER_CHUNK_SIZE);
+
+	vte_terminal_write_job_next (job);
+}
+
+/**
+ * vte_terminal_write_contents_finish:
+ * @terminal: a #VteTerminal
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes a write started with vte_terminal_write_contents_async().
+ *
+ * Returns: %TRUE on success, %FALSE if there was an error
+ *
+ * Since: 0.32
+ */
+gboolean
+vte_terminal_write_contents_finish (VteTerminal *terminal,
+				    GAsyncResult *result,
+				    GError **error)
+{
+	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
+	g_return_val_if_fail(g_simple_async_result_is_valid (result, G_OBJECT (terminal),
+							     vte_terminal_write_contents_async), FALSE);
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+
+/*
+ * Buffer search
+ */
+
+/* TODO Add properties & signals */
+
+/* The longest run of text every match of @regex contains, for the ring's
+ * search index to look for. */
+static char *
+vte_terminal_search_regex_literal (GRegex *regex, gboolean *caseless)
+{
+	*caseless = (g_regex_get_compile_flags (regex) & G_REGEX_CASELESS) != 0;
+	if (g_regex_get_compile_flags (regex) & G_REGEX_EXTENDED)
+		return NULL;
+
+	return _vte_ring_search_literal (g_regex_get_pattern (regex));
+}
+
+/**
+ * vte_terminal_search_set_gregex:
+ * @terminal: a #VteTerminal
+ * @regex: (allow-none): a #GRegex, or %NULL
+ *
+ * Sets the #GRegex regex to search for. Unsets the search regex when passed %NULL.
+ *
+ * Since: 0.26
+ */
 void
 vte_terminal_search_set_gregex (VteTerminal *terminal,
 				GRegex      *regex)
@@ -15141,9 +16754,14 @@ vte_terminal_search_set_gregex (VteTerminal *terminal,
 		g_regex_unref (terminal->pvt->search_regex);
 		terminal->pvt->search_regex = NULL;
 	}
+	g_free (terminal->pvt->search_literal);
+	terminal->pvt->search_literal = NULL;
 
-	if (regex)
+	if (regex) {
 		terminal->pvt->search_regex = g_regex_ref (regex);
+		terminal->pvt->search_literal =
+			vte_terminal_search_regex_literal (regex, &terminal->pvt->search_caseless);
+	}
 
 	_vte_invalidate_all (terminal);
 }
@@ -15199,113 +16817,273 @@ vte_terminal_search_get_wrap_around (VteTerminal *terminal)
 	return terminal->pvt->search_wrap_around;
 }
 
+/* A search through the buffer.  vte_terminal_search_find() runs one to the
+ * end at once; the async variants run it in idle slices. */
+typedef struct _VteSearchJob {
+	GRegex *regex;
+	char *literal;
+	gboolean caseless;
+	gboolean backward;
+
+	long row;		/* where the walk over the lines stands */
+	VteSearchMatch match;	/* the first match found */
+	GArray *matches;	/* all the matches, or NULL to stop at the first */
+
+	/* Async only */
+	VteTerminal *terminal;
+	VteScreen *screen;	/* the screen being searched */
+	GSimpleAsyncResult *result;
+	GCancellable *cancellable;
+	long ranges[2][2];
+	guint n_ranges, range;
+	gboolean indexing;
+} VteSearchJob;
+
+/* Matches the logical line in rows [@start_row, @end_row) against the
+ * job's regex.  Returns whether it matched. */
 static gboolean
 vte_terminal_search_rows (VteTerminal *terminal,
+			  VteSearchJob *job,
 			  long start_row,
 			  long end_row,
-			  gboolean backward)
+			  GError **error)
 {
         VteTerminalPrivate *pvt;
 	char *row_text;
 	GMatchInfo *match_info;
-	GError *error = NULL;
 	int start, end;
-	long start_col, end_col;
-	gchar *word;
 	VteCharAttributes *ca;
+	VteSearchMatch match;
 	GArray *attrs;
-	gdouble value, page_size;
+	gboolean found = FALSE;
 
 	pvt = terminal->pvt;
 
-	row_text = vte_terminal_get_text_range (terminal, start_row, 0, end_row, -1, NULL, NULL, NULL);
-
-	g_regex_match_full (pvt->search_regex, row_text, -1, 0, G_REGEX_MATCH_NOTEMPTY, &match_info, &error);
-	if (error) {
-		g_printerr ("Error while matching: %s\n", error->message);
-		g_error_free (error);
-		g_match_info_free (match_info);
-		g_free (row_text);
-		return TRUE;
-	}
+	row_text = vte_terminal_get_text_range (terminal, start_row, 0, end_row - 1, G_MAXLONG, NULL, NULL, NULL);
 
+	g_regex_match_full (job->regex, row_text, -1, 0, G_REGEX_MATCH_NOTEMPTY, &match_info, error);
 	if (!g_match_info_matches (match_info)) {
 		g_match_info_free (match_info);
 		g_free (row_text);
 		return FALSE;
 	}
 
-	word = g_match_info_fetch (match_info, 0);
-
 	/* Fetch text again, with attributes */
 	g_free (row_text);
 	if (!pvt->search_attrs)
 		pvt->search_attrs = g_array_new (FALSE, TRUE, sizeof (VteCharAttributes));
 	attrs = pvt->search_attrs;
-	row_text = vte_terminal_get_text_range (terminal, start_row, 0, end_row, -1, NULL, NULL, attrs);
+	row_text = vte_terminal_get_text_range (terminal, start_row, 0, end_row - 1, G_MAXLONG, NULL, NULL, attrs);
+
+	do {
+		/* This gives us the offset in the buffer */
+		g_match_info_fetch_pos (match_info, 0, &start, &end);
+
+		ca = &g_array_index (attrs, VteCharAttributes, start);
+		match.start_row = ca->row;
+		match.start_col = ca->column;
+		ca = &g_array_index (attrs, VteCharAttributes, end - 1);
+		match.end_row = ca->row;
+		match.end_col = ca->column;
 
-	/* This gives us the offset in the buffer */
-	g_match_info_fetch_pos (match_info, 0, &start, &end);
+		if (!found)
+			job->match = match;
+		found = TRUE;
 
-	ca = &g_array_index (attrs, VteCharAttributes, start);
-	start_row = ca->row;
-	start_col = ca->column;
-	ca = &g_array_index (attrs, VteCharAttributes, end - 1);
-	end_row = ca->row;
-	end_col = ca->column;
+		if (!job->matches)
+			break;
+		g_array_append_val (job->matches, match);
+	} while (g_match_info_next (match_info, error));
 
-	g_free (word);
 	g_free (row_text);
 	g_match_info_free (match_info);
 
-	_vte_terminal_select_text (terminal, start_col, start_row, end_col, end_row, 0, 0);
-	/* Quite possibly the math here should not access adjustment directly... */
-	value = gtk_adjustment_get_value(terminal->adjustment);
-	page_size = gtk_adjustment_get_page_size(terminal->adjustment);
-	if (backward) {
-		if (end_row < value || end_row >= value + page_size)
-			vte_terminal_queue_adjustment_value_changed_clamped (terminal, end_row - page_size + 1);
+	return found;
+}
+
+/* Matches a line of frozen text, read from the ring at @offset, against
+ * the job's regex.  The line lies in the rows [@first, @last), which are
+ * thawed only to place the matches. */
+static gboolean
+vte_terminal_search_text (VteTerminal *terminal,
+			  VteSearchJob *job,
+			  const char *text,
+			  gssize len,
+			  gsize offset,
+			  gulong first,
+			  gulong last,
+			  GError **error)
+{
+	VteRing *ring = terminal->pvt->screen->row_data;
+	GMatchInfo *match_info;
+	VteSearchMatch match;
+	gulong row;
+	int start, end;
+	gboolean found = FALSE;
+
+	g_regex_match_full (job->regex, text, len, 0, G_REGEX_MATCH_NOTEMPTY, &match_info, error);
+	while (g_match_info_matches (match_info)) {
+		g_match_info_fetch_pos (match_info, 0, &start, &end);
+
+		if (!_vte_ring_find_cell (ring, first, last, offset + start, &row, &match.start_col))
+			break;
+		match.start_row = row;
+		if (!_vte_ring_find_cell (ring, first, last, offset + end - 1, &row, &match.end_col))
+			break;
+		match.end_row = row;
+		/* Like vte_terminal_get_text_range() places the newline */
+		if (text[end - 1] == '\n')
+			match.end_col = MAX (terminal->column_count, match.end_col);
+
+		if (!found)
+			job->match = match;
+		found = TRUE;
+
+		if (!job->matches)
+			break;
+		g_array_append_val (job->matches, match);
+
+		g_match_info_next (match_info, error);
+	}
+	g_match_info_free (match_info);
+
+	return found;
+}
+
+/* Searches the whole logical lines in the next VTE_SEARCH_CHUNK_ROWS rows
+ * from job->row towards @limit that are frozen, reading their text straight
+ * from the ring instead of thawing them.  Leaves job->row alone if there
+ * are none. */
+static gboolean
+vte_terminal_search_frozen_lines (VteTerminal *terminal,
+				  VteSearchJob *job,
+				  long limit,
+				  GError **error)
+{
+        VteTerminalPrivate *pvt = terminal->pvt;
+	VteRing *ring = pvt->screen->row_data;
+	GString *text;
+	gulong first, last, row, end_row;
+	gsize offset;
+	const char *p, *line, *line_end, *end;
+	glong column;
+
+	if (job->backward) {
+		first = MAX (limit, job->row - VTE_SEARCH_CHUNK_ROWS);
+		last = job->row;
 	} else {
-		if (start_row < value || start_row >= value + page_size)
-			vte_terminal_queue_adjustment_value_changed_clamped (terminal, start_row);
+		first = job->row;
+		last = MIN (limit, job->row + VTE_SEARCH_CHUNK_ROWS);
 	}
 
-	return TRUE;
+	if (!pvt->search_text)
+		pvt->search_text = g_string_new (NULL);
+	text = pvt->search_text;
+	if (!_vte_ring_read_lines (ring, &first, &last, text, &offset) ||
+	    (gulong) job->row != (job->backward ? last : first))
+		return FALSE;
+
+	end = text->str + text->len;
+	for (p = job->backward ? end : text->str; ; ) {
+		if (job->backward) {
+			if (p == text->str)
+				break;
+			line_end = p;
+			for (line = line_end - 1; line > text->str && line[-1] != '\n'; line--)
+				;
+			p = line;
+		} else {
+			if (p == end)
+				break;
+			line = p;
+			line_end = (const char *) memchr (line, '\n', end - line) + 1;
+			p = line_end;
+		}
+
+		/* Empty cells read as NULs, which the regular path turns into
+		 * spaces or trims */
+		if (G_UNLIKELY (memchr (line, '\0', line_end - line))) {
+			_vte_ring_find_cell (ring, first, last, offset + (line - text->str), &row, &column);
+			_vte_ring_find_cell (ring, first, last, offset + (line_end - 1 - text->str), &end_row, &column);
+			if (vte_terminal_search_rows (terminal, job, row, end_row + 1, error) &&
+			    !job->matches)
+				return TRUE;
+		} else if (vte_terminal_search_text (terminal, job, line, line_end - line,
+						     offset + (line - text->str),
+						     first, last, error) &&
+			   !job->matches)
+			return TRUE;
+		if (*error)
+			return TRUE;
+	}
+
+	job->row = job->backward ? first : last;
+
+	return FALSE;
 }
 
+/* Walks the logical lines from job->row towards @limit, skipping those the
+ * search index rules out.  A line that starts on the near side of @limit
+ * is searched whole.  Stops at the first match unless the job collects
+ * them all, or on error. */
 static gboolean
 vte_terminal_search_rows_iter (VteTerminal *terminal,
-			       long start_row,
-			       long end_row,
-			       gboolean backward)
+			       VteSearchJob *job,
+			       long limit,
+			       GError **error)
 {
+	VteRing *ring = terminal->pvt->screen->row_data;
 	const VteRowData *row;
 	long iter_start_row, iter_end_row;
+	gboolean found;
+
+	if (job->backward) {
+		while (job->row > limit) {
+			if (job->literal) {
+				job->row = _vte_ring_search_skip (ring, job->row, limit, TRUE,
+								  job->literal, job->caseless);
+				if (job->row <= limit)
+					break;
+			}
+			iter_end_row = job->row;
+			if (vte_terminal_search_frozen_lines (terminal, job, limit, error))
+				return TRUE;
+			if (job->row != iter_end_row)
+				continue;
 
-	if (backward) {
-		iter_start_row = end_row;
-		while (iter_start_row > start_row) {
-			iter_end_row = iter_start_row;
-
-			do {
+			iter_start_row = iter_end_row - 1;
+			while ((row = _vte_terminal_find_row_data (terminal, iter_start_row - 1)) &&
+			       row->attr.soft_wrapped)
 				iter_start_row--;
-				row = _vte_terminal_find_row_data (terminal, iter_start_row);
-			} while (row && row->attr.soft_wrapped);
+			job->row = iter_start_row;
 
-			if (vte_terminal_search_rows (terminal, iter_start_row, iter_end_row, backward))
+			found = vte_terminal_search_rows (terminal, job, iter_start_row, iter_end_row, error);
+			if (*error || (found && !job->matches))
 				return TRUE;
 		}
 	} else {
-		iter_end_row = start_row;
-		while (iter_end_row < end_row) {
-			iter_start_row = iter_end_row;
+		while (job->row < limit) {
+			if (job->literal) {
+				job->row = _vte_ring_search_skip (ring, job->row, limit, FALSE,
+								  job->literal, job->caseless);
+				if (job->row >= limit)
+					break;
+			}
+			iter_start_row = job->row;
+			if (vte_terminal_search_frozen_lines (terminal, job, limit, error))
+				return TRUE;
+			if (job->row != iter_start_row)
+				continue;
 
+			iter_end_row = iter_start_row;
 			do {
 				row = _vte_terminal_find_row_data (terminal, iter_end_row);
 				iter_end_row++;
 			} while (row && row->attr.soft_wrapped);
+			job->row = iter_end_row;
 
-			if (vte_terminal_search_rows (terminal, iter_start_row, iter_end_row, backward))
+			found = vte_terminal_search_rows (terminal, job, iter_start_row, iter_end_row, error);
+			if (*error || (found && !job->matches))
 				return TRUE;
 		}
 	}
@@ -15313,13 +17091,123 @@ vte_terminal_search_rows_iter (VteTerminal *terminal,
 	return FALSE;
 }
 
+/* Gets the row ranges to search, in order, for vte_terminal_search_find() */
+static guint
+vte_terminal_search_get_ranges (VteTerminal *terminal,
+				gboolean backward,
+				long ranges[2][2])
+{
+        VteTerminalPrivate *pvt = terminal->pvt;
+	long buffer_start_row, buffer_end_row;
+	long last_start_row, last_end_row;
+
+	buffer_start_row = _vte_ring_delta (pvt->screen->row_data);
+	buffer_end_row = _vte_ring_next (pvt->screen->row_data);
+
+	if (pvt->has_selection) {
+		last_start_row = pvt->selection_start.row;
+		last_end_row = pvt->selection_end.row + 1;
+	} else {
+		last_start_row = pvt->screen->scroll_delta + terminal->row_count;
+		last_end_row = pvt->screen->scroll_delta;
+	}
+	last_start_row = MAX (buffer_start_row, last_start_row);
+	last_end_row = MIN (buffer_end_row, last_end_row);
+
+	if (backward) {
+		ranges[0][0] = buffer_start_row;
+		ranges[0][1] = last_start_row;
+		ranges[1][0] = last_end_row;
+		ranges[1][1] = buffer_end_row;
+	} else {
+		ranges[0][0] = last_end_row;
+		ranges[0][1] = buffer_end_row;
+		ranges[1][0] = buffer_start_row;
+		ranges[1][1] = last_start_row;
+	}
+
+	return pvt->search_wrap_around ? 2 : 1;
+}
+
+/* Selects @match and scrolls it into view */
+static void
+vte_terminal_search_select (VteTerminal *terminal,
+			    const VteSearchMatch *match,
+			    gboolean backward)
+{
+	gdouble value, page_size;
+
+	_vte_terminal_select_text (terminal,
+				   match->start_col, match->start_row,
+				   match->end_col, match->end_row,
+				   0, 0);
+	/* Quite possibly the math here should not access adjustment directly... */
+	value = gtk_adjustment_get_value(terminal->adjustment);
+	page_size = gtk_adjustment_get_page_size(terminal->adjustment);
+	if (backward) {
+		if (match->end_row < value || match->end_row >= value + page_size)
+			vte_terminal_queue_adjustment_value_changed_clamped (terminal, match->end_row - page_size + 1);
+	} else {
+		if (match->start_row < value || match->start_row >= value + page_size)
+			vte_terminal_queue_adjustment_value_changed_clamped (terminal, match->start_row);
+	}
+}
+
+/* If search fails, we make an empty selection at the last searched
+ * position... */
+static void
+vte_terminal_search_select_not_found (VteTerminal *terminal,
+				      gboolean backward)
+{
+        VteTerminalPrivate *pvt = terminal->pvt;
+
+	if (!pvt->has_selection)
+		return;
+
+	if (backward) {
+		if (pvt->search_wrap_around)
+		    _vte_terminal_select_empty_at (terminal,
+						   pvt->selection_start.col,
+						   pvt->selection_start.row);
+		else
+		    _vte_terminal_select_empty_at (terminal,
+						   -1,
+						   _vte_ring_delta (pvt->screen->row_data) - 1);
+	} else {
+		if (pvt->search_wrap_around)
+		    _vte_terminal_select_empty_at (terminal,
+						   pvt->selection_end.col + 1,
+						   pvt->selection_end.row);
+		else
+		    _vte_terminal_select_empty_at (terminal,
+						   -1,
+						   _vte_ring_next (pvt->screen->row_data));
+	}
+}
+
+static void
+vte_terminal_search_prepare (VteTerminal *terminal)
+{
+	/* Matches are reported at the current width */
+	vte_terminal_reflow_rows (terminal,
+				  _vte_ring_delta (terminal->pvt->screen->row_data),
+				  _vte_ring_next (terminal->pvt->screen->row_data));
+
+	/* Only terminals that get searched pay for the index; it catches up
+	 * with the frozen text on the first search */
+	if (terminal->pvt->search_literal)
+		_vte_ring_set_search_index (terminal->pvt->screen->row_data, TRUE);
+}
+
 static gboolean
 vte_terminal_search_find (VteTerminal *terminal,
 			  gboolean     backward)
 {
         VteTerminalPrivate *pvt;
-	long buffer_start_row, buffer_end_row;
-	long last_start_row, last_end_row;
+	VteSearchJob job;
+	long ranges[2][2];
+	guint n_ranges, i;
+	GError *error = NULL;
 
 	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
 
@@ -15329,58 +17217,32 @@ vte_terminal_search_find (VteTerminal *terminal,
 
 	/* TODO
 	 * Currently We only find one result per extended line, and ignore columns
-	 * Moreover, the whole search thing is implemented very inefficiently.
 	 */
 
-	buffer_start_row = _vte_ring_delta (terminal->pvt->screen->row_data);
-	buffer_end_row = _vte_ring_next (terminal->pvt->screen->row_data);
+	vte_terminal_search_prepare (terminal);
 
-	if (pvt->has_selection) {
-		last_start_row = pvt->selection_start.row;
-		last_end_row = pvt->selection_end.row + 1;
-	} else {
-		last_start_row = pvt->screen->scroll_delta + terminal->row_count;
-		last_end_row = pvt->screen->scroll_delta;
-	}
-	last_start_row = MAX (buffer_start_row, last_start_row);
-	last_end_row = MIN (buffer_end_row, last_end_row);
+	memset (&job, 0, sizeof (job));
+	job.regex = pvt->search_regex;
+	job.literal = pvt->search_literal;
+	job.caseless = pvt->search_caseless;
+	job.backward = backward;
 
-	/* If search fails, we make an empty selection at the last searched
-	 * position... */
-	if (backward) {
-		if (vte_terminal_search_rows_iter (terminal, buffer_start_row, last_start_row, backward))
-			return TRUE;
-		if (pvt->search_wrap_around &&
-		    vte_terminal_search_rows_iter (terminal, last_end_row, buffer_end_row, backward))
-			return TRUE;
-		if (pvt->has_selection) {
-			if (pvt->search_wrap_around)
-			    _vte_terminal_select_empty_at (terminal,
-							   pvt->selection_start.col,
-							   pvt->selection_start.row);
-			else
-			    _vte_terminal_select_empty_at (terminal,
-							   -1,
-							   buffer_start_row - 1);
-		}
-	} else {
-		if (vte_terminal_search_rows_iter (terminal, last_end_row, buffer_end_row, backward))
-			return TRUE;
-		if (pvt->search_wrap_around &&
-		    vte_terminal_search_rows_iter (terminal, buffer_start_row, last_start_row, backward))
-			return TRUE;
-		if (pvt->has_selection) {
-			if (pvt->search_wrap_around)
-			    _vte_terminal_select_empty_at (terminal,
-							   pvt->selection_end.col + 1,
-							   pvt->selection_end.row);
-			else
-			    _vte_terminal_select_empty_at (terminal,
-							   -1,
-							   buffer_end_row);
-		}
+	n_ranges = vte_terminal_search_get_ranges (terminal, backward, ranges);
+	for (i = 0; i < n_ranges; i++) {
+		job.row = ranges[i][backward ? 1 : 0];
+		if (!vte_terminal_search_rows_iter (terminal, &job, ranges[i][backward ? 0 : 1], &error))
+			continue;
+
+		if (error) {
+			g_printerr ("Error while matching: %s\n", error->message);
+			g_error_free (error);
+		} else
+			vte_terminal_search_select (terminal, &job.match, backward);
+		return TRUE;
 	}
 
+	vte_terminal_search_select_not_found (terminal, backward);
+
 	return FALSE;
 }
 
@@ -15417,3 +17279,297 @@ vte_terminal_search_find_next (VteTerminal *terminal)
 {
 	return vte_terminal_search_find (terminal, FALSE);
 }
+
+static void
+vte_terminal_search_job_free (VteSearchJob *job)
+{
+	if (job->regex)
+		g_regex_unref (job->regex);
+	g_free (job->literal);
+	if (job->matches)
+		g_array_unref (job->matches);
+	if (job->cancellable)
+		g_object_unref (job->cancellable);
+	g_object_unref (job->result);
+	g_slice_free (VteSearchJob, job);
+}
+
+static void
+vte_terminal_search_job_complete (VteSearchJob *job,
+				  gboolean found,
+				  GError *error)
+{
+	if (error) {
+		g_simple_async_result_set_from_error (job->result, error);
+		g_error_free (error);
+	} else if (job->matches) {
+		g_simple_async_result_set_op_res_gpointer (job->result,
+							   g_array_ref (job->matches),
+							   (GDestroyNotify) g_array_unref);
+	} else {
+		/* The rows are those of the screen searched */
+		if (job->terminal->pvt->screen == job->screen) {
+			if (found)
+				vte_terminal_search_select (job->terminal, &job->match, job->backward);
+			else
+				vte_terminal_search_select_not_found (job->terminal, job->backward);
+		}
+		g_simple_async_result_set_op_res_gboolean (job->result, found);
+	}
+
+	g_simple_async_result_complete (job->result);
+	vte_terminal_search_job_free (job);
+}
+
+/* Runs a slice of an async search */
+static gboolean
+vte_terminal_search_job_step (gpointer data)
+{
+	VteSearchJob *job = data;
+	VteTerminalPrivate *pvt = job->terminal->pvt;
+	VteScreen *screen;
+	VteRing *ring;
+	GError *error = NULL;
+	gboolean found;
+	long start_row, end_row, limit;
+
+	GDK_THREADS_ENTER();
+
+	if (g_cancellable_set_error_if_cancelled (job->cancellable, &error)) {
+		vte_terminal_search_job_complete (job, FALSE, error);
+		goto done;
+	}
+
+	ring = job->screen->row_data;
+	if (job->indexing) {
+		job->indexing = !_vte_ring_update_search_index (ring, VTE_SEARCH_SLICE_INDEX_BYTES);
+		GDK_THREADS_LEAVE();
+		return TRUE;
+	}
+
+	/* History may have been trimmed since the last slice */
+	start_row = MAX (job->ranges[job->range][0], _vte_ring_delta (ring));
+	end_row = MAX (start_row, MIN (job->ranges[job->range][1], _vte_ring_next (ring)));
+	job->row = CLAMP (job->row, start_row, end_row);
+
+	if (job->backward)
+		limit = MAX (start_row, job->row - VTE_SEARCH_SLICE_ROWS);
+	else
+		limit = MIN (end_row, job->row + VTE_SEARCH_SLICE_ROWS);
+
+	/* The rows are read through the screen shown; if the application
+	 * switched screens since the search started, go on with the old one
+	 * for the slice */
+	screen = pvt->screen;
+	pvt->screen = job->screen;
+	found = vte_terminal_search_rows_iter (job->terminal, job, limit, &error);
+	pvt->screen = screen;
+	if (found) {
+		vte_terminal_search_job_complete (job, error == NULL, error);
+		goto done;
+	}
+
+	if (job->backward ? job->row <= start_row : job->row >= end_row) {
+		if (++job->range == job->n_ranges) {
+			vte_terminal_search_job_complete (job, FALSE, NULL);
+			goto done;
+		}
+		job->row = job->ranges[job->range][job->backward ? 1 : 0];
+	}
+
+	GDK_THREADS_LEAVE();
+	return TRUE;
+
+done:
+	GDK_THREADS_LEAVE();
+	return FALSE;
+}
+
+static void
+vte_terminal_search_start (VteTerminal *terminal,
+			   gboolean backward,
+			   gboolean all,
+			   GCancellable *cancellable,
+			   GAsyncReadyCallback callback,
+			   gpointer user_data,
+			   gpointer source_tag)
+{
+        VteTerminalPrivate *pvt = terminal->pvt;
+	VteSearchJob *job;
+
+	job = g_slice_new0 (VteSearchJob);
+	job->terminal = terminal;
+	job->screen = pvt->screen;
+	job->result = g_simple_async_result_new (G_OBJECT (terminal),
+						 callback, user_data,
+						 source_tag);
+	if (cancellable)
+		job->cancellable = g_object_ref (cancellable);
+	job->backward = backward;
+	if (all)
+		job->matches = g_array_new (FALSE, FALSE, sizeof (VteSearchMatch));
+
+	if (!pvt->search_regex) {
+		if (all)
+			g_simple_async_result_set_op_res_gpointer (job->result,
+								   g_array_ref (job->matches),
+								   (GDestroyNotify) g_array_unref);
+		else
+			g_simple_async_result_set_op_res_gboolean (job->result, FALSE);
+		g_simple_async_result_complete_in_idle (job->result);
+		vte_terminal_search_job_free (job);
+		return;
+	}
+
+	vte_terminal_search_prepare (terminal);
+
+	/* The job keeps its own copy of the search, so that changing the
+	 * regex doesn't affect it */
+	job->regex = g_regex_ref (pvt->search_regex);
+	job->literal = g_strdup (pvt->search_literal);
+	job->caseless = pvt->search_caseless;
+	job->indexing = job->literal != NULL;
+
+	if (all) {
+		job->ranges[0][0] = _vte_ring_delta (pvt->screen->row_data);
+		job->ranges[0][1] = _vte_ring_next (pvt->screen->row_data);
+		job->n_ranges = 1;
+	} else
+		job->n_ranges = vte_terminal_search_get_ranges (terminal, backward, job->ranges);
+	job->row = job->ranges[0][backward ? 1 : 0];
+
+	g_idle_add_full (VTE_SEARCH_PRIORITY,
+			 vte_terminal_search_job_step, job,
+			 NULL);
+}
+
+/**
+ * vte_terminal_search_find_async:
+ * @terminal: a #VteTerminal
+ * @backward: whether to search for the previous match instead of the next
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the search is done
+ * @user_data: data to pass to @callback
+ *
+ * Like vte_terminal_search_find_next() or
+ * vte_terminal_search_find_previous(), but searches in slices from the
+ * main loop instead of blocking it until a match is found.  The match is
+ * selected when the search completes.
+ *
+ * The search covers the rows in the buffer of the screen shown when it
+ * starts, with the regex set with vte_terminal_search_set_gregex() at that
+ * time.  If the terminal switches to its other screen meanwhile, nothing
+ * is selected.  Call vte_terminal_search_find_finish() from @callback to
+ * get its result.
+ *
+ * Since: 0.32
+ */
+void
+vte_terminal_search_find_async (VteTerminal *terminal,
+				gboolean backward,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	g_return_if_fail(VTE_IS_TERMINAL(terminal));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	vte_terminal_search_start (terminal, backward, FALSE,
+				   cancellable, callback, user_data,
+				   vte_terminal_search_find_async);
+}
+
+/**
+ * vte_terminal_search_find_finish:
+ * @terminal: a #VteTerminal
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes a search started with vte_terminal_search_find_async().
+ *
+ * Returns: %TRUE if a match was found, %FALSE if none was or if the search
+ *   was cancelled or failed, in which case @error is set
+ *
+ * Since: 0.32
+ */
+gboolean
+vte_terminal_search_find_finish (VteTerminal *terminal,
+				 GAsyncResult *result,
+				 GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
+	g_return_val_if_fail(g_simple_async_result_is_valid (result, G_OBJECT (terminal),
+							     vte_terminal_search_find_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return FALSE;
+
+	return g_simple_async_result_get_op_res_gboolean (simple);
+}
+
+/**
+ * vte_terminal_search_find_all_async:
+ * @terminal: a #VteTerminal
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the search is done
+ * @user_data: data to pass to @callback
+ *
+ * Finds every match of the regex set with vte_terminal_search_set_gregex()
+ * in the buffer, searching in slices from the main loop.  Unlike
+ * vte_terminal_search_find_async(), this leaves the selection alone, and
+ * finds all the matches in each line.
+ *
+ * The search covers the rows in the buffer of the screen shown when it
+ * starts, and the matches are in that screen's rows.  Call
+ * vte_terminal_search_find_all_finish() from @callback to get its result.
+ *
+ * Since: 0.32
+ */
+void
+vte_terminal_search_find_all_async (VteTerminal *terminal,
+				    GCancellable *cancellable,
+				    GAsyncReadyCallback callback,
+				    gpointer user_data)
+{
+	g_return_if_fail(VTE_IS_TERMINAL(terminal));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	vte_terminal_search_start (terminal, FALSE, TRUE,
+				   cancellable, callback, user_data,
+				   vte_terminal_search_find_all_async);
+}
+
+/**
+ * vte_terminal_search_find_all_finish:
+ * @terminal: a #VteTerminal
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes a search started with vte_terminal_search_find_all_async().
+ *
+ * Returns: (transfer full) (element-type Vte.SearchMatch): a #GArray of
+ *   #VteSearchMatch in buffer order, or %NULL if the search was cancelled
+ *   or failed, in which case @error is set.  Free it with g_array_unref().
+ *
+ * Since: 0.32
+ */
+GArray *
+vte_terminal_search_find_all_finish (VteTerminal *terminal,
+				     GAsyncResult *result,
+				     GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail(VTE_IS_TERMINAL(terminal), NULL);
+	g_return_val_if_fail(g_simple_async_result_is_valid (result, G_OBJECT (terminal),
+							     vte_terminal_search_find_all_async), NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	return g_array_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
@@ -376,6 +376,9 @@ VteTerminalCursorShape vte_terminal_get_cursor_shape(VteTerminal *terminal);
 
 /* Set the number of scrollback lines, above or at an internal minimum. */
 void vte_terminal_set_scrollback_lines(VteTerminal *terminal, glong lines);
+gsize vte_terminal_get_scrollback_disk_usage(VteTerminal *terminal);
+void vte_terminal_set_global_scrollback_budget(gsize bytes);
+gsize vte_terminal_get_global_scrollback_budget(void);
 
 /* Append the input method menu items to a given shell. */
 void vte_terminal_im_append_menuitems(VteTerminal *terminal,
@@ -433,6 +436,34 @@ char *vte_terminal_get_text_range(VteTerminal *terminal,
 				  VteSelectionFunc is_selected,
 				  gpointer user_data,
 				  GArray *attributes);
+void vte_terminal_append_text_range(VteTerminal *terminal,
+				    glong start_row, glong start_col,
+				    glong end_row, glong end_col,
+				    GString *string);
+
+/**
+ * VteTerminalLineIter:
+ *
+ * An iterator over the lines of text of a #VteTerminal.  It is meant to be
+ * allocated on the stack and initialized with vte_terminal_line_iter_init().
+ *
+ * Since: 0.32
+ */
+typedef struct _VteTerminalLineIter VteTerminalLineIter;
+struct _VteTerminalLineIter {
+        /*< private >*/
+	gpointer dummy1;
+	glong dummy2;
+	glong dummy3;
+	gpointer dummy4;
+};
+
+void vte_terminal_line_iter_init(VteTerminalLineIter *iter,
+				 VteTerminal *terminal,
+				 glong start_row, glong end_row);
+gboolean vte_terminal_line_iter_next(VteTerminalLineIter *iter,
+				     GString *line, glong *row);
+
 void vte_terminal_get_cursor_position(VteTerminal *terminal,
 				      glong *column, glong *row);
 /* Display string matching:  clear all matching expressions. */
@@ -467,6 +498,41 @@ gboolean  vte_terminal_search_get_wrap_around (VteTerminal *terminal);
 gboolean  vte_terminal_search_find_previous   (VteTerminal *terminal);
 gboolean  vte_terminal_search_find_next       (VteTerminal *terminal);
 
+/**
+ * VteSearchMatch:
+ * @start_row: the row of the first character of the match
+ * @start_col: the column of the first character of the match
+ * @end_row: the row of the last character of the match
+ * @end_col: the column of the last character of the match
+ *
+ * A match found by vte_terminal_search_find_all_async().  Rows count from
+ * the start of the scrollback buffer, like the value of the terminal's
+ * adjustment.
+ *
+ * Since: 0.32
+ */
+typedef struct _VteSearchMatch VteSearchMatch;
+struct _VteSearchMatch {
+	glong start_row, start_col;
+	glong end_row, end_col;
+};
+
+void      vte_terminal_search_find_async      (VteTerminal *terminal,
+					       gboolean     backward,
+					       GCancellable *cancellable,
+					       GAsyncReadyCallback callback,
+					       gpointer     user_data);
+gboolean  vte_terminal_search_find_finish     (VteTerminal *terminal,
+					       GAsyncResult *result,
+					       GError     **error);
+void      vte_terminal_search_find_all_async  (VteTerminal *terminal,
+					       GCancellable *cancellable,
+					       GAsyncReadyCallback callback,
+					       gpointer     user_data);
+GArray   *vte_terminal_search_find_all_finish (VteTerminal *terminal,
+					       GAsyncResult *result,
+					       GError     **error);
+
 
 /* Set the emulation type.  Most of the time you won't need this. */
 void vte_terminal_set_emulation(VteTerminal *terminal, const char *emulation);
@@ -505,12 +571,15 @@ int vte_terminal_get_child_exit_status(VteTerminal *terminal);
 /**
  * VteTerminalWriteFlags:
  * @VTE_TERMINAL_WRITE_DEFAULT: Write contents as UTF-8 text.  This is the default.
+ * @VTE_TERMINAL_WRITE_ATTRIBUTES: Write SGR escape sequences for the colors
+ *   and attributes of the text too.  Since: 0.32
  *
  * A flag type to determine how terminal contents should be written
  * to an output stream.
  */
 typedef enum {
-  VTE_TERMINAL_WRITE_DEFAULT = 0
+  VTE_TERMINAL_WRITE_DEFAULT = 0,
+  VTE_TERMINAL_WRITE_ATTRIBUTES = 1 << 0
 } VteTerminalWriteFlags;
 
 gboolean vte_terminal_write_contents (VteTerminal *terminal,
@@ -518,6 +587,18 @@ gboolean vte_terminal_write_contents (VteTerminal *terminal,
 				      VteTerminalWriteFlags flags,
 				      GCancellable *cancellable,
 				      GError **error);
+void vte_terminal_write_contents_async (VteTerminal *terminal,
+					GOutputStream *stream,
+					glong start_row,
+					glong end_row,
+					VteTerminalWriteFlags flags,
+					int io_priority,
+					GCancellable *cancellable,
+					GAsyncReadyCallback callback,
+					gpointer user_data);
+gboolean vte_terminal_write_contents_finish (VteTerminal *terminal,
+					     GAsyncResult *result,
+					     GError **error);
 
 #undef _VTE_SEAL
 #undef _VTE_DEPRECATED
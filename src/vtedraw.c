@@ -20,6 +20,7 @@
 #include <config.h>
 
 #include <sys/param.h>
+#include <math.h>
 #include <string.h>
 #include <gtk/gtk.h>
 #include <glib.h>
@@ -48,7 +49,8 @@
  *     information needed to quickly draw a single vteunistr.  The font_info
  *     creates those unistr_font_info structs on demand and caches them
  *     indefinitely.  It uses a direct array for the ASCII range and a hash
- *     table for the rest.
+ *     table for the rest.  The characters of a text request it doesn't know
+ *     yet are shaped together in a single layout, one paragraph each.
  *
  *
  * Fast rendering of unistrs:
@@ -110,15 +112,77 @@
  * letters if we can do that easily using COVERAGE_USE_CAIRO_GLYPH.  This
  * means that we precache all ASCII letters without any extra pango shaping
  * involved.
+ *
+ *
+ * Glyph atlas:
+ *
+ * When VTE_GLYPH_ATLAS=1 is set in the environment, COVERAGE_USE_CAIRO_GLYPH
+ * characters are rasterized once per font info into a slot of an A8 image
+ * surface, the atlas.  A text request then composes the slots of its glyphs
+ * into a mask per row of cells on our side, and composites the color through
+ * that mask.  That is a single request to the X server per row however many
+ * glyphs and scaled fonts are involved, instead of one cairo_show_glyphs()
+ * per run of MAX_RUN_LENGTH glyphs of a scaled font.  Glyphs whose ink doesn't fit a
+ * slot fall back to cairo_show_glyphs().  The atlas is grayscale, so this
+ * mode gives up subpixel antialiasing.
+ *
+ *
+ * Persistent cache:
+ *
+ * Measuring the font and shaping each new character through Pango is most
+ * of the startup cost of a short-lived terminal.  So the cell metrics and
+ * the glyph index of every character drawn with COVERAGE_USE_CAIRO_GLYPH
+ * using the primary font are saved to a file in the user cache directory,
+ * named after a checksum of everything in the font info's key plus the
+ * fontconfig timestamp.  The file repeats the key and the name of the
+ * primary font, and is only used if both still match.  Characters drawn
+ * with another font or through Pango are not saved and get shaped on first
+ * use.  New characters are written back a few seconds after they were
+ * first seen, asynchronously, and when the font info is freed.
+ *
+ *
+ * Prewarming:
+ *
+ * The cache file also lists the other characters seen with the font.  A new
+ * font info shapes those, or the ranges given in VTE_PREWARM_RANGES as in
+ * "2500-257f,e0a0-e0b3", from a low priority idle, a few at a time, so that
+ * a prompt full of box drawing or Powerline symbols doesn't stall the first
+ * paint.  Being an idle, it only runs while there is nothing else to do.
+ *
+ *
+ * Banded rendering:
+ *
+ * When VTE_RENDER_THREADS=n is set in the environment, a large repaint is
+ * split into n horizontal bands of whole rows.  While painting, the draw
+ * only records what it is asked to do: every font_info lookup and Pango
+ * call still happens on the main thread, and what is left are plain cairo
+ * operations on scaled fonts, colors and image surfaces.  Those are then
+ * run for each band they reach into an image surface of its own, one band
+ * per thread, and the bands are copied into the window in order.  Each
+ * operation runs in each band exactly as it would have on the window, so
+ * the result is the same to the pixel as drawing into an image surface
+ * directly.  A frame that needs Pango to draw a character, a background
+ * image, or the glyph atlas is drawn on the main thread as usual.  Threads
+ * have to be initialized by the application.
  */
 
 
 
 #define FONT_CACHE_TIMEOUT (30) /* seconds */
+#define FONT_INFO_SAVE_TIMEOUT (5) /* seconds */
+#define FONT_INFO_PREWARM_CHUNK (16) /* characters per idle iteration */
+#define FONT_INFO_PREWARM_MAX (0x10000) /* characters */
+
+/* Bump when the contents of the persistent cache change meaning */
+#define FONT_INFO_CACHE_VERSION 2
+/* key, primary font, width, height, ascent, (character, width, glyph)s,
+ * other characters seen */
+#define FONT_INFO_CACHE_TYPE "(ssiiia(uqu)au)"
 
 
 /* All shared data structures are implicitly protected by GDK mutex, because
- * that's how vte.c works and we only get called from there. */
+ * that's how vte.c works and we only get called from there.  Band threads
+ * only get to see recorded drawing operations, never a font_info. */
 
 
 /* cairo_show_glyphs accepts runs up to 102 glyphs before it allocates a
@@ -132,6 +196,21 @@
  */
 #define MAX_RUN_LENGTH 100
 
+/* Atlas slots are laid out in rows of this many; the atlas grows by doubling
+ * the number of rows, up to ATLAS_MAX_SLOTS slots. */
+#define ATLAS_SLOTS_PER_ROW 32
+#define ATLAS_MAX_SLOTS (ATLAS_SLOTS_PER_ROW * 256)
+#define ATLAS_SLOT_NONE G_MAXUINT32
+
+/* Cell masks extend this far around the cell, as some of the graphics in
+ * vte.c draw a pixel beyond it; and there are at most this many of them. */
+#define CELL_MASK_PAD 2
+#define CELL_MASK_MAX 512
+
+/* Repaints smaller than this are not worth splitting into bands */
+#define BAND_MIN_PIXELS (256 * 256)
+#define BAND_MAX_THREADS 16
+
 
 enum unistr_coverage {
 	/* in increasing order of speed */
@@ -155,6 +234,7 @@ union unistr_font_info {
 	struct {
 		cairo_scaled_font_t *scaled_font;
 		unsigned int glyph_index;
+		guint32 atlas_slot; /* slot + 1, 0 if not rasterized yet, or ATLAS_SLOT_NONE */
 	} using_cairo_glyph;
 };
 
@@ -162,6 +242,7 @@ struct unistr_info {
 	guchar coverage;
 	guchar has_unknown_chars;
 	guint16 width;
+	guchar queued; /* waiting in font_info_cache_unistrs() */
 	union unistr_font_info ufi;
 };
 
@@ -226,6 +307,24 @@ struct font_info {
 	/* reusable string for UTF-8 conversion */
 	GString *string;
 
+	/* reusable list of characters being shaped together */
+	GPtrArray *queued; /* struct unistr_info */
+
+	/* glyph atlas */
+	cairo_surface_t *atlas;
+	gint atlas_pad, atlas_slot_width, atlas_slot_height;
+	guint atlas_n_slots;
+
+	/* persistent cache */
+	PangoFont *primary_font; /* the font whose glyphs are saved */
+	guint save_timeout;
+	gboolean cache_dirty;
+
+	/* idle prewarming */
+	GArray *prewarm; /* vteunistr */
+	guint prewarm_pos;
+	guint prewarm_source;
+
 #ifdef VTE_DEBUG
 	/* profiling info */
 	int coverage_count[4];
@@ -350,6 +449,8 @@ font_info_cache_ascii (struct font_info *info)
 #endif
 	}
 
+	info->primary_font = g_object_ref (pango_font);
+
 #ifdef VTE_DEBUG
 	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
 			  "vtepangocairo: %p cached %d ASCII letters\n",
@@ -389,6 +490,347 @@ font_info_measure_font (struct font_info *info)
 }
 
 
+static guint vte_pango_context_get_fontconfig_timestamp (PangoContext *context);
+static void font_info_queue_prewarm (struct font_info *info, vteunistr c);
+
+static char *
+font_info_cache_key (PangoContext *context)
+{
+	const cairo_font_options_t *font_options;
+	PangoLanguage *language;
+	char *desc, *key;
+
+	font_options = pango_cairo_context_get_font_options (context);
+	language = pango_context_get_language (context);
+	desc = pango_font_description_to_string (pango_context_get_font_description (context));
+	key = g_strdup_printf ("%d %d %s|%s|%g %d %d %d %d|%u",
+			       FONT_INFO_CACHE_VERSION, G_BYTE_ORDER,
+			       desc,
+			       language ? pango_language_to_string (language) : "",
+			       pango_cairo_context_get_resolution (context),
+			       font_options ? cairo_font_options_get_antialias (font_options) : -1,
+			       font_options ? cairo_font_options_get_subpixel_order (font_options) : -1,
+			       font_options ? cairo_font_options_get_hint_style (font_options) : -1,
+			       font_options ? cairo_font_options_get_hint_metrics (font_options) : -1,
+			       vte_pango_context_get_fontconfig_timestamp (context));
+	g_free (desc);
+
+	return key;
+}
+
+static char *
+font_info_cache_path (const char *key)
+{
+	char *checksum, *path;
+
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+	path = g_build_filename (g_get_user_cache_dir (), "vte", "fonts", checksum, NULL);
+	g_free (checksum);
+
+	return path;
+}
+
+static char *
+font_info_describe_font (PangoFont *font)
+{
+	PangoFontDescription *desc;
+	char *name;
+
+	desc = pango_font_describe (font);
+	name = pango_font_description_to_string (desc);
+	pango_font_description_free (desc);
+
+	return name;
+}
+
+/* Fill in metrics and glyphs saved by an earlier process.  Returns FALSE
+ * if there is no usable cache, in which case @info is left untouched. */
+static gboolean
+font_info_load_cache (struct font_info *info,
+		      PangoContext     *context)
+{
+	GVariant *variant = NULL, *entries = NULL, *seen = NULL;
+	GVariantIter iter;
+	PangoFont *font = NULL;
+	cairo_scaled_font_t *scaled_font;
+	const char *file_key, *file_font;
+	char *key, *path, *data, *font_name = NULL;
+	gsize length;
+	gint32 width, height, ascent;
+	guint32 c, glyph;
+	guint16 glyph_width;
+	gboolean ret = FALSE;
+
+	key = font_info_cache_key (context);
+	path = font_info_cache_path (key);
+	if (!g_file_get_contents (path, &data, &length, NULL))
+		goto out;
+
+	variant = g_variant_ref_sink (g_variant_new_from_data (G_VARIANT_TYPE (FONT_INFO_CACHE_TYPE),
+							       data, length, FALSE,
+							       g_free, data));
+	/* Don't trust anything found on disk */
+	if (!g_variant_is_normal_form (variant))
+		goto out;
+
+	g_variant_get (variant, "(&s&siii@a(uqu)@au)",
+		       &file_key, &file_font, &width, &height, &ascent, &entries, &seen);
+	if (strcmp (file_key, key) != 0 || width <= 0 || height <= 0)
+		goto out;
+
+	/* The glyph indices are only good for the same primary font */
+	font = pango_context_load_font (context, pango_context_get_font_description (context));
+	if (!font)
+		goto out;
+	scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *) font);
+	font_name = font_info_describe_font (font);
+	if (!scaled_font || strcmp (font_name, file_font) != 0)
+		goto out;
+
+	info->width = width;
+	info->height = height;
+	info->ascent = ascent;
+
+	g_variant_iter_init (&iter, entries);
+	while (g_variant_iter_next (&iter, "(uqu)", &c, &glyph_width, &glyph)) {
+		struct unistr_info *uinfo;
+
+		if (c > 0x10FFFF)
+			continue;
+		uinfo = font_info_find_unistr_info (info, c);
+		if (uinfo->coverage != COVERAGE_UNKNOWN)
+			continue;
+
+		uinfo->width = glyph_width;
+		uinfo->has_unknown_chars = FALSE;
+		uinfo->coverage = COVERAGE_USE_CAIRO_GLYPH;
+		uinfo->ufi.using_cairo_glyph.scaled_font = cairo_scaled_font_reference (scaled_font);
+		uinfo->ufi.using_cairo_glyph.glyph_index = glyph;
+
+#ifdef VTE_DEBUG
+		info->coverage_count[0]++;
+		info->coverage_count[uinfo->coverage]++;
+#endif
+	}
+
+	/* and shape the rest of the characters from last time when idle */
+	g_variant_iter_init (&iter, seen);
+	while (g_variant_iter_next (&iter, "u", &c)) {
+		if (c <= 0x10FFFF)
+			font_info_queue_prewarm (info, c);
+	}
+
+	info->primary_font = font;
+	font = NULL;
+	ret = TRUE;
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p loaded font_info from %s\n",
+			  info, path);
+
+out:
+	if (font)
+		g_object_unref (font);
+	if (entries)
+		g_variant_unref (entries);
+	if (seen)
+		g_variant_unref (seen);
+	if (variant)
+		g_variant_unref (variant);
+	g_free (font_name);
+	g_free (path);
+	g_free (key);
+
+	return ret;
+}
+
+static void
+font_info_cache_saved_cb (GObject      *file,
+			  GAsyncResult *result,
+			  gpointer      variant)
+{
+	GError *error = NULL;
+
+	if (!g_file_replace_contents_finish (G_FILE (file), result, NULL, &error)) {
+		_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+				  "vtepangocairo: failed to save font_info: %s\n",
+				  error->message);
+		g_error_free (error);
+	}
+	g_variant_unref (variant);
+}
+
+static void
+font_info_cache_add_entry (GVariantBuilder     *builder,
+			   GVariantBuilder     *seen,
+			   cairo_scaled_font_t *scaled_font,
+			   vteunistr            c,
+			   struct unistr_info  *uinfo)
+{
+	if (c > 0x10FFFF || uinfo->coverage == COVERAGE_UNKNOWN)
+		return;
+
+	if (uinfo->coverage == COVERAGE_USE_CAIRO_GLYPH &&
+	    uinfo->ufi.using_cairo_glyph.scaled_font == scaled_font)
+		g_variant_builder_add (builder, "(uqu)",
+				       (guint32) c,
+				       (guint16) uinfo->width,
+				       (guint32) uinfo->ufi.using_cairo_glyph.glyph_index);
+	else
+		g_variant_builder_add (seen, "u", (guint32) c);
+}
+
+/* Write the metrics and the primary font glyphs out to the cache. */
+static gboolean
+font_info_save_cache (struct font_info *info)
+{
+	PangoContext *context;
+	GVariantBuilder builder, seen;
+	GVariant *variant;
+	GHashTableIter iter;
+	gpointer c, uinfo;
+	cairo_scaled_font_t *scaled_font;
+	GFile *file;
+	char *key, *path, *dir, *font_name;
+	vteunistr i;
+
+	info->save_timeout = 0;
+
+	if (!info->cache_dirty || !info->primary_font)
+		return FALSE;
+	info->cache_dirty = FALSE;
+
+	scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *) info->primary_font);
+	if (!scaled_font)
+		return FALSE;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uqu)"));
+	g_variant_builder_init (&seen, G_VARIANT_TYPE ("au"));
+	for (i = 0; i < G_N_ELEMENTS (info->ascii_unistr_info); i++)
+		font_info_cache_add_entry (&builder, &seen, scaled_font, i,
+					   &info->ascii_unistr_info[i]);
+	if (info->other_unistr_info) {
+		g_hash_table_iter_init (&iter, info->other_unistr_info);
+		while (g_hash_table_iter_next (&iter, &c, &uinfo))
+			font_info_cache_add_entry (&builder, &seen, scaled_font,
+						   GPOINTER_TO_INT (c), uinfo);
+	}
+	/* keep what we didn't get around to prewarming for next time */
+	if (info->prewarm) {
+		for (i = info->prewarm_pos; i < info->prewarm->len; i++)
+			g_variant_builder_add (&seen, "u",
+					       (guint32) g_array_index (info->prewarm, vteunistr, i));
+	}
+
+	context = pango_layout_get_context (info->layout);
+	key = font_info_cache_key (context);
+	path = font_info_cache_path (key);
+	font_name = font_info_describe_font (info->primary_font);
+	variant = g_variant_ref_sink (g_variant_new (FONT_INFO_CACHE_TYPE,
+						     key, font_name,
+						     info->width, info->height, info->ascent,
+						     &builder, &seen));
+
+	dir = g_path_get_dirname (path);
+	g_mkdir_with_parents (dir, 0700);
+	file = g_file_new_for_path (path);
+	/* the variant keeps the data alive until the write is done */
+	g_file_replace_contents_async (file,
+				       g_variant_get_data (variant),
+				       g_variant_get_size (variant),
+				       NULL, FALSE, G_FILE_CREATE_PRIVATE,
+				       NULL, font_info_cache_saved_cb, variant);
+	g_object_unref (file);
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p saving font_info to %s\n",
+			  info, path);
+
+	g_free (dir);
+	g_free (font_name);
+	g_free (path);
+	g_free (key);
+
+	return FALSE;
+}
+
+static void
+font_info_schedule_save (struct font_info *info)
+{
+	info->cache_dirty = TRUE;
+	if (!info->save_timeout)
+		info->save_timeout = gdk_threads_add_timeout_seconds (FONT_INFO_SAVE_TIMEOUT,
+								      (GSourceFunc) font_info_save_cache,
+								      info);
+}
+
+static gboolean font_info_prewarm (struct font_info *info);
+
+static void
+font_info_queue_prewarm (struct font_info *info,
+			 vteunistr         c)
+{
+	if (G_UNLIKELY (info->prewarm == NULL))
+		info->prewarm = g_array_new (FALSE, FALSE, sizeof (vteunistr));
+	if (info->prewarm->len >= FONT_INFO_PREWARM_MAX)
+		return;
+
+	g_array_append_val (info->prewarm, c);
+}
+
+/* Queue the ranges from VTE_PREWARM_RANGES, hexadecimal first-last pairs
+ * or single characters separated by commas.  NUL and surrogates are not
+ * characters and are skipped. */
+static void
+font_info_queue_prewarm_ranges (struct font_info *info)
+{
+	const char *env;
+	char **ranges;
+	int i;
+
+	env = g_getenv ("VTE_PREWARM_RANGES");
+	if (!env)
+		return;
+
+	ranges = g_strsplit (env, ",", -1);
+	for (i = 0; ranges[i] != NULL; i++) {
+		char *end;
+		gunichar first, last, c;
+
+		first = last = g_ascii_strtoull (ranges[i], &end, 16);
+		if (end == ranges[i])
+			continue;
+		if (*end == '-')
+			last = g_ascii_strtoull (end + 1, NULL, 16);
+		last = MIN (last, 0x10FFFF);
+		if (first > last)
+			continue;
+		/* no point in walking more than the queue takes */
+		last = MIN (last, first + (FONT_INFO_PREWARM_MAX - 1));
+		for (c = first; c <= last; c++) {
+			if (c == 0 || (c >= 0xD800 && c <= 0xDFFF))
+				continue;
+			font_info_queue_prewarm (info, c);
+		}
+	}
+	g_strfreev (ranges);
+}
+
+static void
+font_info_start_prewarm (struct font_info *info)
+{
+	if (!info->prewarm || info->prewarm_pos >= info->prewarm->len || info->prewarm_source)
+		return;
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p prewarming %u characters\n",
+			  info, info->prewarm->len - info->prewarm_pos);
+
+	info->prewarm_source = gdk_threads_add_idle_full (G_PRIORITY_LOW,
+							  (GSourceFunc) font_info_prewarm,
+							  info, NULL);
+}
+
 static struct font_info *
 font_info_allocate (PangoContext *context)
 {
@@ -407,8 +849,14 @@ font_info_allocate (PangoContext *context)
 	pango_tab_array_free (tabs);
 
 	info->string = g_string_sized_new (VTE_UTF8_BPC+1);
+	info->queued = g_ptr_array_new ();
 
-	font_info_measure_font (info);
+	if (!font_info_load_cache (info, context)) {
+		font_info_measure_font (info);
+		font_info_schedule_save (info);
+	}
+	font_info_queue_prewarm_ranges (info);
+	font_info_start_prewarm (info);
 
 	return info;
 }
@@ -428,9 +876,24 @@ font_info_free (struct font_info *info)
 			  info->coverage_count[3]);
 #endif
 
+	if (info->save_timeout) {
+		g_source_remove (info->save_timeout);
+		font_info_save_cache (info);
+	}
+	if (info->primary_font)
+		g_object_unref (info->primary_font);
+	if (info->prewarm_source)
+		g_source_remove (info->prewarm_source);
+	if (info->prewarm)
+		g_array_free (info->prewarm, TRUE);
+
 	g_string_free (info->string, TRUE);
+	g_ptr_array_free (info->queued, TRUE);
 	g_object_unref (info->layout);
 
+	if (info->atlas)
+		cairo_surface_destroy (info->atlas);
+
 	for (i = 0; i < G_N_ELEMENTS (info->ascii_unistr_info); i++)
 		unistr_info_finish (&info->ascii_unistr_info[i]);
 		
@@ -741,9 +1204,306 @@ font_info_get_unistr_info (struct font_info *info,
 	info->coverage_count[uinfo->coverage]++;
 #endif
 
+	/* remember it for the persistent cache */
+	font_info_schedule_save (info);
+
 	return uinfo;
 }
 
+/* Shape all the characters in @requests we don't know about yet at once,
+ * instead of setting up a layout for each in font_info_get_unistr_info().
+ * Every character gets a paragraph of its own, so it is shaped exactly as
+ * it would be alone.  Characters which need a PangoLayoutLine are left
+ * for font_info_get_unistr_info(). */
+static void
+font_info_cache_unistrs (struct font_info                    *info,
+			 const struct _vte_draw_text_request *requests,
+			 gsize                                n_requests)
+{
+	GPtrArray *queued = info->queued;
+	GSList *lines;
+	const char *text;
+	gsize i, n_queued;
+
+	/* Usually everything is known already */
+	for (i = 0; i < n_requests; i++)
+		if (font_info_find_unistr_info (info, requests[i].c)->coverage == COVERAGE_UNKNOWN)
+			break;
+	if (n_requests - i < 2)
+		return;
+
+	g_ptr_array_set_size (queued, 0);
+	g_string_set_size (info->string, 0);
+	for (; i < n_requests; i++) {
+		struct unistr_info *uinfo = font_info_find_unistr_info (info, requests[i].c);
+
+		if (uinfo->coverage != COVERAGE_UNKNOWN || uinfo->queued)
+			continue;
+		uinfo->queued = TRUE;
+		g_ptr_array_add (queued, uinfo);
+		if (info->string->len)
+			g_string_append_c (info->string, '\n');
+		_vte_unistr_append_to_string (requests[i].c, info->string);
+	}
+	n_queued = queued->len;
+
+	/* Not worth it for one */
+	if (n_queued < 2)
+		goto out;
+
+	pango_layout_set_text (info->layout, info->string->str, info->string->len);
+	text = pango_layout_get_text (info->layout);
+
+	i = 0;
+	for (lines = pango_layout_get_lines_readonly (info->layout);
+	     lines != NULL && i < n_queued;
+	     lines = lines->next, i++) {
+		PangoLayoutLine *line = lines->data;
+		struct unistr_info *uinfo = g_ptr_array_index (queued, i);
+		union unistr_font_info *ufi = &uinfo->ufi;
+		PangoGlyphItem *glyph_item;
+		PangoGlyphString *glyph_string;
+		PangoFont *pango_font;
+		PangoRectangle logical;
+		cairo_scaled_font_t *scaled_font;
+		int k;
+
+		/* Paragraphs and characters must stay in step */
+		if (line->start_index > 0 && text[line->start_index - 1] != '\n')
+			break;
+
+		/* multiple fonts need the layout line */
+		if (!line->runs || line->runs->next)
+			continue;
+
+		glyph_item = line->runs->data;
+		glyph_string = glyph_item->glyphs;
+		pango_font = glyph_item->item->analysis.font;
+
+		pango_layout_line_get_extents (line, NULL, &logical);
+		uinfo->width = PANGO_PIXELS_CEIL (logical.width);
+		uinfo->has_unknown_chars = FALSE;
+		for (k = 0; k < glyph_string->num_glyphs; k++)
+			if (glyph_string->glyphs[k].glyph & PANGO_GLYPH_UNKNOWN_FLAG)
+				uinfo->has_unknown_chars = TRUE;
+
+		/* same checks as font_info_cache_ascii() */
+		if (!uinfo->has_unknown_chars &&
+		    glyph_string->num_glyphs == 1 && glyph_string->glyphs[0].glyph <= 0xFFFF &&
+		    (glyph_string->glyphs[0].geometry.x_offset |
+		     glyph_string->glyphs[0].geometry.y_offset) == 0 &&
+		    pango_font != NULL &&
+		    (scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *) pango_font)) != NULL) {
+			uinfo->coverage = COVERAGE_USE_CAIRO_GLYPH;
+
+			ufi->using_cairo_glyph.scaled_font = cairo_scaled_font_reference (scaled_font);
+			ufi->using_cairo_glyph.glyph_index = glyph_string->glyphs[0].glyph;
+		} else {
+			uinfo->coverage = COVERAGE_USE_PANGO_GLYPH_STRING;
+
+			ufi->using_pango_glyph_string.font = pango_font ? g_object_ref (pango_font) : NULL;
+			ufi->using_pango_glyph_string.glyph_string = pango_glyph_string_copy (glyph_string);
+		}
+
+#ifdef VTE_DEBUG
+		info->coverage_count[0]++;
+		info->coverage_count[uinfo->coverage]++;
+#endif
+	}
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p shaped %" G_GSIZE_FORMAT " characters at once\n",
+			  info, i);
+	font_info_schedule_save (info);
+
+	/* release internal layout resources */
+	pango_layout_set_text (info->layout, "", -1);
+
+out:
+	for (i = 0; i < n_queued; i++)
+		((struct unistr_info *) g_ptr_array_index (queued, i))->queued = FALSE;
+}
+
+/* Shape a few of the characters queued for prewarming.  The idle runs at
+ * low priority, so it is not dispatched while there are events, input from
+ * the child or repaints to process. */
+static gboolean
+font_info_prewarm (struct font_info *info)
+{
+	struct _vte_draw_text_request requests[FONT_INFO_PREWARM_CHUNK];
+	gsize i, n = 0;
+
+	while (n < G_N_ELEMENTS (requests) && info->prewarm_pos < info->prewarm->len) {
+		vteunistr c = g_array_index (info->prewarm, vteunistr, info->prewarm_pos++);
+
+		if (font_info_find_unistr_info (info, c)->coverage != COVERAGE_UNKNOWN)
+			continue;
+		requests[n].c = c;
+		requests[n].columns = 1;
+		requests[n].x = requests[n].y = 0;
+		n++;
+	}
+
+	font_info_cache_unistrs (info, requests, n);
+	/* whatever needs a layout line of its own */
+	for (i = 0; i < n; i++)
+		font_info_get_unistr_info (info, requests[i].c);
+
+	if (info->prewarm_pos < info->prewarm->len)
+		return TRUE;
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p done prewarming\n", info);
+
+	g_array_free (info->prewarm, TRUE);
+	info->prewarm = NULL;
+	info->prewarm_pos = 0;
+	info->prewarm_source = 0;
+
+	return FALSE;
+}
+
+static void
+font_info_grow_atlas (struct font_info *info)
+{
+	cairo_surface_t *atlas;
+	cairo_t *cr;
+	int rows = 8;
+
+	if (info->atlas)
+		rows = 2 * cairo_image_surface_get_height (info->atlas) / info->atlas_slot_height;
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p growing glyph atlas to %d slots\n",
+			  info, rows * ATLAS_SLOTS_PER_ROW);
+
+	atlas = cairo_image_surface_create (CAIRO_FORMAT_A8,
+					    ATLAS_SLOTS_PER_ROW * info->atlas_slot_width,
+					    rows * info->atlas_slot_height);
+
+	if (info->atlas) {
+		cr = cairo_create (atlas);
+		cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_surface (cr, info->atlas, 0, 0);
+		cairo_paint (cr);
+		cairo_destroy (cr);
+		cairo_surface_destroy (info->atlas);
+	}
+
+	info->atlas = atlas;
+}
+
+static void
+font_info_ensure_atlas_geometry (struct font_info *info)
+{
+	if (G_LIKELY (info->atlas_slot_width))
+		return;
+
+	/* Leave room for a double width glyph and some overhang */
+	info->atlas_pad = MAX (info->height / 4, 2);
+	info->atlas_slot_width = 2 * info->width + 2 * info->atlas_pad;
+	info->atlas_slot_height = info->height + 2 * info->atlas_pad;
+}
+
+/* Finds the atlas slot of a COVERAGE_USE_CAIRO_GLYPH character, rasterizing
+ * its glyph on first use.  Returns FALSE if the glyph has to be drawn with
+ * cairo_show_glyphs() instead. */
+static gboolean
+font_info_get_atlas_slot (struct font_info   *info,
+			  struct unistr_info *uinfo,
+			  guint              *slot)
+{
+	cairo_scaled_font_t *scaled_font = uinfo->ufi.using_cairo_glyph.scaled_font;
+	guint32 *atlas_slot = &uinfo->ufi.using_cairo_glyph.atlas_slot;
+	cairo_text_extents_t extents;
+	cairo_glyph_t glyph;
+	cairo_t *cr;
+	int pad;
+
+	if (G_LIKELY (*atlas_slot)) {
+		*slot = *atlas_slot - 1;
+		return *atlas_slot != ATLAS_SLOT_NONE;
+	}
+
+	*atlas_slot = ATLAS_SLOT_NONE;
+	if (info->atlas_n_slots == ATLAS_MAX_SLOTS)
+		return FALSE;
+
+	font_info_ensure_atlas_geometry (info);
+	pad = info->atlas_pad;
+
+	glyph.index = uinfo->ufi.using_cairo_glyph.glyph_index;
+	glyph.x = glyph.y = 0;
+	cairo_scaled_font_glyph_extents (scaled_font, &glyph, 1, &extents);
+	if (extents.width > 0 && extents.height > 0 &&
+	    (extents.x_bearing < -pad ||
+	     extents.x_bearing + extents.width > info->atlas_slot_width - pad ||
+	     extents.y_bearing < -(pad + info->ascent) ||
+	     extents.y_bearing + extents.height > info->atlas_slot_height - pad - info->ascent))
+		return FALSE;
+
+	*slot = info->atlas_n_slots++;
+	if (!info->atlas ||
+	    *slot >= ATLAS_SLOTS_PER_ROW * (cairo_image_surface_get_height (info->atlas) / info->atlas_slot_height))
+		font_info_grow_atlas (info);
+
+	glyph.x = *slot % ATLAS_SLOTS_PER_ROW * info->atlas_slot_width + pad;
+	glyph.y = *slot / ATLAS_SLOTS_PER_ROW * info->atlas_slot_height + pad + info->ascent;
+
+	cr = cairo_create (info->atlas);
+	cairo_set_scaled_font (cr, scaled_font);
+	cairo_show_glyphs (cr, &glyph, 1);
+	cairo_destroy (cr);
+	cairo_surface_flush (info->atlas);
+
+	*atlas_slot = *slot + 1;
+	return TRUE;
+}
+
+/* A drawing operation, run on the draw's cairo context right away, or
+ * recorded to be run later in each band it reaches */
+enum draw_op_type {
+	DRAW_OP_CLEAR,
+	DRAW_OP_FILL,
+	DRAW_OP_STROKE,
+	DRAW_OP_GLYPHS,
+	DRAW_OP_PANGO_GLYPH_STRING,
+	DRAW_OP_PANGO_LAYOUT_LINE,
+	DRAW_OP_MASK
+};
+
+struct draw_op {
+	enum draw_op_type type;
+	PangoColor color;
+	guchar alpha;
+	gint x, y, width, height;
+	/* the pixel rows its ink may reach */
+	gint y0, y1;
+	union {
+		struct {
+			cairo_scaled_font_t *scaled_font;
+			const cairo_glyph_t *glyphs;
+			guint offset; /* into the recorded glyphs */
+			int n_glyphs;
+		} glyphs;
+		struct {
+			PangoFont *font;
+			PangoGlyphString *glyph_string;
+		} glyph_string;
+		PangoLayoutLine *line;
+		cairo_surface_t *mask;
+	} u;
+};
+
+struct band_job {
+	struct _vte_draw *draw;
+	VteRegionRectangle rect;
+	cairo_surface_t *surface;
+	GAsyncQueue *done;
+};
+
+static GThreadPool *band_pool;
+
 struct _vte_draw {
 	GtkWidget *widget;
 
@@ -754,8 +1514,187 @@ struct _vte_draw {
 	cairo_pattern_t *bg_pattern;
 
 	cairo_t *cr;
+
+	/* glyph atlas mode, and the mask text is composed into */
+	gboolean use_atlas;
+	guchar *mask_data;
+	gsize mask_size;
+
+	/* cached cell masks, and the cell being recorded into one */
+	GHashTable *cell_masks;
+	cairo_t *cell_mask_saved_cr;
+	gint cell_mask_x, cell_mask_y, cell_mask_width, cell_mask_height;
+
+	/* banded rendering: the operations recorded since
+	 * _vte_draw_begin_bands(), and the bands to run them in */
+	gint render_threads;
+	gboolean recording;
+	gboolean record_direct; /* something needs the main thread */
+	cairo_format_t band_format;
+	GArray *ops;
+	GArray *op_glyphs;
+	GArray *bands;
 };
 
+struct cell_mask_key {
+	guint32 key;
+	gint width, height;
+};
+
+static guint
+cell_mask_key_hash (gconstpointer v)
+{
+	const struct cell_mask_key *k = v;
+
+	return k->key ^ (k->width << 16) ^ (k->height << 24);
+}
+
+static gboolean
+cell_mask_key_equal (gconstpointer a, gconstpointer b)
+{
+	const struct cell_mask_key *ka = a, *kb = b;
+
+	return ka->key == kb->key &&
+	       ka->width == kb->width &&
+	       ka->height == kb->height;
+}
+
+static void
+cell_mask_key_free (gpointer v)
+{
+	g_slice_free (struct cell_mask_key, v);
+}
+
+static void
+set_source_color_alpha (cairo_t        *cr,
+			const PangoColor *color,
+			guchar alpha)
+{
+	cairo_set_source_rgba (cr,
+			      color->red / 65535.,
+			      color->green / 65535.,
+			      color->blue / 65535.,
+			      alpha / 255.);
+}
+
+static void
+_vte_draw_run_op (struct _vte_draw *draw, cairo_t *cr, const struct draw_op *op)
+{
+	if (op->type == DRAW_OP_CLEAR) {
+		cairo_rectangle (cr, op->x, op->y, op->width, op->height);
+		cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source (cr, draw->bg_pattern);
+		cairo_fill (cr);
+		return;
+	}
+
+	cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+	set_source_color_alpha (cr, &op->color, op->alpha);
+
+	switch (op->type) {
+	default:
+		g_assert_not_reached ();
+		break;
+	case DRAW_OP_FILL:
+		cairo_rectangle (cr, op->x, op->y, op->width, op->height);
+		cairo_fill (cr);
+		break;
+	case DRAW_OP_STROKE:
+		cairo_rectangle (cr, op->x+VTE_LINE_WIDTH/2., op->y+VTE_LINE_WIDTH/2., op->width-VTE_LINE_WIDTH, op->height-VTE_LINE_WIDTH);
+		cairo_set_line_width (cr, VTE_LINE_WIDTH);
+		cairo_stroke (cr);
+		break;
+	case DRAW_OP_GLYPHS:
+		cairo_set_scaled_font (cr, op->u.glyphs.scaled_font);
+		cairo_show_glyphs (cr, op->u.glyphs.glyphs, op->u.glyphs.n_glyphs);
+		break;
+	case DRAW_OP_PANGO_GLYPH_STRING:
+		cairo_move_to (cr, op->x, op->y);
+		pango_cairo_show_glyph_string (cr,
+					       op->u.glyph_string.font,
+					       op->u.glyph_string.glyph_string);
+		break;
+	case DRAW_OP_PANGO_LAYOUT_LINE:
+		cairo_move_to (cr, op->x, op->y);
+		pango_cairo_show_layout_line (cr, op->u.line);
+		break;
+	case DRAW_OP_MASK:
+		cairo_mask_surface (cr, op->u.mask, op->x, op->y);
+		break;
+	}
+}
+
+/* Runs @op on the draw's context, or records it between
+ * _vte_draw_begin_bands() and _vte_draw_end_bands().  Drawing into a cell
+ * mask is never recorded. */
+static void
+_vte_draw_emit (struct _vte_draw *draw, struct draw_op *op)
+{
+	if (!draw->recording || draw->cell_mask_saved_cr != NULL) {
+		_vte_draw_run_op (draw, draw->cr, op);
+		return;
+	}
+
+	switch (op->type) {
+	case DRAW_OP_GLYPHS:
+		op->u.glyphs.offset = draw->op_glyphs->len;
+		g_array_append_vals (draw->op_glyphs,
+				     op->u.glyphs.glyphs, op->u.glyphs.n_glyphs);
+		op->u.glyphs.glyphs = NULL;
+		break;
+	case DRAW_OP_PANGO_GLYPH_STRING:
+	case DRAW_OP_PANGO_LAYOUT_LINE:
+		/* Pango may only be used from the main thread */
+		draw->record_direct = TRUE;
+		break;
+	case DRAW_OP_MASK:
+		cairo_surface_reference (op->u.mask);
+		break;
+	default:
+		break;
+	}
+
+	g_array_append_val (draw->ops, *op);
+}
+
+static void
+_vte_draw_emit_rectangle (struct _vte_draw *draw, enum draw_op_type type,
+			  gint x, gint y, gint width, gint height,
+			  const PangoColor *color, guchar alpha)
+{
+	struct draw_op op;
+
+	op.type = type;
+	if (color != NULL)
+		op.color = *color;
+	op.alpha = alpha;
+	op.x = x;
+	op.y = op.y0 = y;
+	op.width = width;
+	op.height = height;
+	op.y1 = y + height;
+
+	_vte_draw_emit (draw, &op);
+}
+
+static void
+_vte_draw_emit_mask (struct _vte_draw *draw, cairo_surface_t *mask,
+		     gint x, gint y,
+		     const PangoColor *color, guchar alpha)
+{
+	struct draw_op op;
+
+	op.type = DRAW_OP_MASK;
+	op.color = *color;
+	op.alpha = alpha;
+	op.x = x;
+	op.y = op.y0 = y;
+	op.y1 = y + cairo_image_surface_get_height (mask);
+	op.u.mask = mask;
+
+	_vte_draw_emit (draw, &op);
+}
+
 struct _vte_draw *
 _vte_draw_new (GtkWidget *widget)
 {
@@ -764,6 +1703,9 @@ _vte_draw_new (GtkWidget *widget)
 	/* Create the structure. */
 	draw = g_slice_new0 (struct _vte_draw);
 	draw->widget = g_object_ref (widget);
+	draw->use_atlas = g_strcmp0 (g_getenv ("VTE_GLYPH_ATLAS"), "1") == 0;
+	if (g_getenv ("VTE_RENDER_THREADS") != NULL)
+		_vte_draw_set_render_threads (draw, atoi (g_getenv ("VTE_RENDER_THREADS")));
 
 	_vte_debug_print (VTE_DEBUG_DRAW, "draw_new\n");
 
@@ -789,6 +1731,17 @@ _vte_draw_free (struct _vte_draw *draw)
 		g_object_unref (draw->widget);
 	}
 
+	g_free (draw->mask_data);
+
+	if (draw->cell_masks != NULL)
+		g_hash_table_destroy (draw->cell_masks);
+
+	if (draw->ops != NULL) {
+		g_array_free (draw->ops, TRUE);
+		g_array_free (draw->op_glyphs, TRUE);
+		g_array_free (draw->bands, TRUE);
+	}
+
 	g_slice_free (struct _vte_draw, draw);
 }
 
@@ -904,10 +1857,8 @@ _vte_draw_clear (struct _vte_draw *draw, gint x, gint y, gint width, gint height
 	_vte_debug_print (VTE_DEBUG_DRAW, "draw_clear (%d, %d, %d, %d)\n",
 			  x,y,width, height);
 
-	cairo_rectangle (draw->cr, x, y, width, height);
-	cairo_set_operator (draw->cr, CAIRO_OPERATOR_SOURCE);
-	cairo_set_source (draw->cr, draw->bg_pattern);
-	cairo_fill (draw->cr);
+	_vte_draw_emit_rectangle (draw, DRAW_OP_CLEAR, x, y, width, height,
+				  NULL, 0);
 }
 
 void
@@ -925,6 +1876,10 @@ _vte_draw_set_text_font (struct _vte_draw *draw,
 	font_info_destroy (draw->font);
 	draw->font = font_info_create_for_widget (draw->widget, fontdesc, antialias);
 
+	/* cells are sized after the font */
+	if (draw->cell_masks != NULL)
+		g_hash_table_remove_all (draw->cell_masks);
+
 	/* calculate bold font desc */
 	bolddesc = pango_font_description_copy (fontdesc);
 	pango_font_description_set_weight (bolddesc, PANGO_WEIGHT_BOLD);
@@ -974,16 +1929,158 @@ _vte_draw_has_bold (struct _vte_draw *draw)
 	return (draw->font != draw->font_bold);
 }
 
+/* The mask the atlas glyphs of a row of requests are composed into */
+struct atlas_mask {
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	int x, y, width, height, stride;
+};
+
+/* Starts a mask for the requests from @requests on that share its row,
+ * and returns how many there are */
+static gsize
+_vte_draw_atlas_mask_begin (struct _vte_draw *draw, struct font_info *font,
+			    struct atlas_mask *mask,
+			    const struct _vte_draw_text_request *requests, gsize n_requests)
+{
+	int x1 = requests[0].x;
+	gsize n, size;
+
+	mask->x = requests[0].x;
+	for (n = 1; n < n_requests && requests[n].y == requests[0].y; n++) {
+		mask->x = MIN (mask->x, requests[n].x);
+		x1 = MAX (x1, requests[n].x);
+	}
+	mask->x -= font->atlas_pad;
+	mask->y = requests[0].y - font->atlas_pad;
+	mask->width = x1 + font->atlas_slot_width - font->atlas_pad - mask->x;
+	mask->height = font->atlas_slot_height;
+	mask->stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, mask->width);
+
+	size = (gsize) mask->stride * mask->height;
+	if (size > draw->mask_size) {
+		g_free (draw->mask_data);
+		draw->mask_data = g_malloc (size);
+		draw->mask_size = size;
+	}
+	mask->surface = NULL;
+	mask->cr = NULL;
+
+	return n;
+}
+
+/* Adds the atlas @slot of @font into @mask for the request at @x, @y */
 static void
-set_source_color_alpha (cairo_t        *cr,
-			const PangoColor *color,
-			guchar alpha)
+_vte_draw_atlas_mask_add_slot (struct _vte_draw *draw, struct font_info *font,
+			       struct atlas_mask *mask, guint slot, int x, int y)
 {
-	cairo_set_source_rgba (cr,
-			      color->red / 65535.,
-			      color->green / 65535.,
-			      color->blue / 65535.,
-			      alpha / 255.);
+	int dx = x - font->atlas_pad - mask->x;
+	int dy = y - font->atlas_pad - mask->y;
+
+	if (!mask->cr) {
+		memset (draw->mask_data, 0, (gsize) mask->stride * mask->height);
+		mask->surface = cairo_image_surface_create_for_data (draw->mask_data, CAIRO_FORMAT_A8,
+								     mask->width, mask->height,
+								     mask->stride);
+		mask->cr = cairo_create (mask->surface);
+	}
+
+	/* Overlapping ink composes with CAIRO_OPERATOR_OVER */
+	cairo_set_source_surface (mask->cr, font->atlas,
+				  dx - (int) (slot % ATLAS_SLOTS_PER_ROW) * font->atlas_slot_width,
+				  dy - (int) (slot / ATLAS_SLOTS_PER_ROW) * font->atlas_slot_height);
+	cairo_rectangle (mask->cr, dx, dy, font->atlas_slot_width, font->atlas_slot_height);
+	cairo_fill (mask->cr);
+}
+
+/* Composites the color through @mask, if any glyph went into it */
+static void
+_vte_draw_atlas_mask_end (struct _vte_draw *draw, struct atlas_mask *mask,
+			  const PangoColor *color, guchar alpha)
+{
+	if (!mask->cr)
+		return;
+
+	cairo_destroy (mask->cr);
+	cairo_surface_flush (mask->surface);
+
+	/* Never recorded: the atlas turns bands off */
+	cairo_set_operator (draw->cr, CAIRO_OPERATOR_OVER);
+	set_source_color_alpha (draw->cr, color, alpha);
+	cairo_mask_surface (draw->cr, mask->surface, mask->x, mask->y);
+	cairo_surface_destroy (mask->surface);
+
+	mask->cr = NULL;
+	mask->surface = NULL;
+}
+
+static void
+_vte_draw_show_glyphs (struct _vte_draw *draw, struct font_info *font,
+		       cairo_scaled_font_t *scaled_font,
+		       const cairo_glyph_t *glyphs, int n_glyphs,
+		       const PangoColor *color, guchar alpha)
+{
+	struct draw_op op;
+	double y0, y1;
+	int i;
+
+	y0 = y1 = glyphs[0].y;
+	for (i = 1; i < n_glyphs; i++) {
+		y0 = MIN (y0, glyphs[i].y);
+		y1 = MAX (y1, glyphs[i].y);
+	}
+
+	op.type = DRAW_OP_GLYPHS;
+	op.color = *color;
+	op.alpha = alpha;
+	op.y0 = y0 - font->ascent;
+	op.y1 = y1 - font->ascent + font->height;
+	/* Only bands look at these: make them cover all of the ink, plus a
+	 * pixel either way for antialiasing */
+	if (draw->recording) {
+		cairo_text_extents_t ink;
+
+		cairo_scaled_font_glyph_extents (scaled_font, glyphs, n_glyphs, &ink);
+		if (ink.width > 0 && ink.height > 0) {
+			op.y0 = MIN (op.y0, (int) floor (glyphs[0].y + ink.y_bearing) - 1);
+			op.y1 = MAX (op.y1, (int) ceil (glyphs[0].y + ink.y_bearing + ink.height) + 1);
+		}
+	}
+	op.u.glyphs.scaled_font = scaled_font;
+	op.u.glyphs.glyphs = glyphs;
+	op.u.glyphs.n_glyphs = n_glyphs;
+
+	_vte_draw_emit (draw, &op);
+}
+
+/* Emits @op, a Pango drawing of a character with its baseline at @x, @y */
+static void
+_vte_draw_emit_pango (struct _vte_draw *draw, struct font_info *font,
+		      struct draw_op *op, int x, int y,
+		      const PangoColor *color, guchar alpha)
+{
+	op->color = *color;
+	op->alpha = alpha;
+	op->x = x;
+	op->y = y;
+	op->y0 = y - font->ascent;
+	op->y1 = y - font->ascent + font->height;
+	if (draw->recording) {
+		PangoRectangle ink;
+
+		if (op->type == DRAW_OP_PANGO_LAYOUT_LINE)
+			pango_layout_line_get_extents (op->u.line, &ink, NULL);
+		else
+			pango_glyph_string_extents (op->u.glyph_string.glyph_string,
+						    op->u.glyph_string.font,
+						    &ink, NULL);
+		if (ink.width > 0 && ink.height > 0) {
+			op->y0 = MIN (op->y0, y + PANGO_PIXELS_FLOOR (ink.y) - 1);
+			op->y1 = MAX (op->y1, y + PANGO_PIXELS_CEIL (ink.y + ink.height) + 1);
+		}
+	}
+
+	_vte_draw_emit (draw, op);
 }
 
 static void
@@ -996,11 +2093,16 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 	int n_cr_glyphs = 0;
 	cairo_glyph_t cr_glyphs[MAX_RUN_LENGTH];
 	struct font_info *font = bold ? draw->font_bold : draw->font;
+	struct atlas_mask mask = { NULL, NULL, 0, 0, 0, 0, 0 };
+	gsize mask_end = 0;
+	guint slot;
 
 	g_return_if_fail (font != NULL);
 
-	set_source_color_alpha (draw->cr, color, alpha);
-	cairo_set_operator (draw->cr, CAIRO_OPERATOR_OVER);
+	font_info_cache_unistrs (font, requests, n_requests);
+
+	if (draw->use_atlas)
+		font_info_ensure_atlas_geometry (font);
 
 	for (i = 0; i < n_requests; i++) {
 		vteunistr c = requests[i].c;
@@ -1008,6 +2110,23 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 		int y = requests[i].y + font->ascent;
 		struct unistr_info *uinfo = font_info_get_unistr_info (font, c);
 		union unistr_font_info *ufi = &uinfo->ufi;
+		struct draw_op op;
+
+		/* A mask per row of requests, so that one spanning rows
+		 * doesn't cover the whole screen */
+		if (draw->use_atlas && i == mask_end) {
+			_vte_draw_atlas_mask_end (draw, &mask, color, alpha);
+			mask_end = i + _vte_draw_atlas_mask_begin (draw, font, &mask,
+								   requests + i, n_requests - i);
+		}
+
+		if (draw->use_atlas &&
+		    uinfo->coverage == COVERAGE_USE_CAIRO_GLYPH &&
+		    font_info_get_atlas_slot (font, uinfo, &slot)) {
+			_vte_draw_atlas_mask_add_slot (draw, font, &mask, slot,
+						       requests[i].x, requests[i].y);
+			continue;
+		}
 
 		switch (uinfo->coverage) {
 		default:
@@ -1015,23 +2134,22 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 			g_assert_not_reached ();
 			break;
 		case COVERAGE_USE_PANGO_LAYOUT_LINE:
-			cairo_move_to (draw->cr, x, y);
-			pango_cairo_show_layout_line (draw->cr,
-						      ufi->using_pango_layout_line.line);
+			op.type = DRAW_OP_PANGO_LAYOUT_LINE;
+			op.u.line = ufi->using_pango_layout_line.line;
+			_vte_draw_emit_pango (draw, font, &op, x, y, color, alpha);
 			break;
 		case COVERAGE_USE_PANGO_GLYPH_STRING:
-			cairo_move_to (draw->cr, x, y);
-			pango_cairo_show_glyph_string (draw->cr,
-						       ufi->using_pango_glyph_string.font,
-						       ufi->using_pango_glyph_string.glyph_string);
+			op.type = DRAW_OP_PANGO_GLYPH_STRING;
+			op.u.glyph_string.font = ufi->using_pango_glyph_string.font;
+			op.u.glyph_string.glyph_string = ufi->using_pango_glyph_string.glyph_string;
+			_vte_draw_emit_pango (draw, font, &op, x, y, color, alpha);
 			break;
 		case COVERAGE_USE_CAIRO_GLYPH:
 			if (last_scaled_font != ufi->using_cairo_glyph.scaled_font || n_cr_glyphs == MAX_RUN_LENGTH) {
 				if (n_cr_glyphs) {
-					cairo_set_scaled_font (draw->cr, last_scaled_font);
-					cairo_show_glyphs (draw->cr,
-							   cr_glyphs,
-							   n_cr_glyphs);
+					_vte_draw_show_glyphs (draw, font, last_scaled_font,
+							       cr_glyphs, n_cr_glyphs,
+							       color, alpha);
 					n_cr_glyphs = 0;
 				}
 				last_scaled_font = ufi->using_cairo_glyph.scaled_font;
@@ -1044,12 +2162,20 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 		}
 	}
 	if (n_cr_glyphs) {
-		cairo_set_scaled_font (draw->cr, last_scaled_font);
-		cairo_show_glyphs (draw->cr,
-				   cr_glyphs,
-				   n_cr_glyphs);
+		_vte_draw_show_glyphs (draw, font, last_scaled_font,
+				       cr_glyphs, n_cr_glyphs,
+				       color, alpha);
 		n_cr_glyphs = 0;
 	}
+	_vte_draw_atlas_mask_end (draw, &mask, color, alpha);
+}
+
+void
+_vte_draw_set_glyph_atlas (struct _vte_draw *draw, gboolean use_atlas)
+{
+	_vte_debug_print (VTE_DEBUG_DRAW, "draw_set_glyph_atlas (%d)\n", use_atlas);
+
+	draw->use_atlas = use_atlas;
 }
 
 void
@@ -1139,11 +2265,8 @@ _vte_draw_draw_rectangle (struct _vte_draw *draw,
 			color->red, color->green, color->blue,
 			alpha);
 
-	cairo_set_operator (draw->cr, CAIRO_OPERATOR_OVER);
-	cairo_rectangle (draw->cr, x+VTE_LINE_WIDTH/2., y+VTE_LINE_WIDTH/2., width-VTE_LINE_WIDTH, height-VTE_LINE_WIDTH);
-	set_source_color_alpha (draw->cr, color, alpha);
-	cairo_set_line_width (draw->cr, VTE_LINE_WIDTH);
-	cairo_stroke (draw->cr);
+	_vte_draw_emit_rectangle (draw, DRAW_OP_STROKE, x, y, width, height,
+				  color, alpha);
 }
 
 void
@@ -1159,8 +2282,515 @@ _vte_draw_fill_rectangle (struct _vte_draw *draw,
 			color->red, color->green, color->blue,
 			alpha);
 
-	cairo_set_operator (draw->cr, CAIRO_OPERATOR_OVER);
-	cairo_rectangle (draw->cr, x, y, width, height);
-	set_source_color_alpha (draw->cr, color, alpha);
-	cairo_fill (draw->cr);
+	_vte_draw_emit_rectangle (draw, DRAW_OP_FILL, x, y, width, height,
+				  color, alpha);
 }
+
+gboolean
+_vte_draw_cell_mask (struct _vte_draw *draw, guint32 key,
+		     gint x, gint y, gint width, gint height,
+		     const PangoColor *color, guchar alpha)
+{
+	struct cell_mask_key k;
+	cairo_surface_t *mask;
+
+	g_return_val_if_fail (draw->started, FALSE);
+
+	if (draw->cell_masks == NULL)
+		return FALSE;
+
+	k.key = key;
+	k.width = width;
+	k.height = height;
+	mask = g_hash_table_lookup (draw->cell_masks, &k);
+	if (mask == NULL)
+		return FALSE;
+
+	_vte_draw_emit_mask (draw, mask, x - CELL_MASK_PAD, y - CELL_MASK_PAD,
+			     color, alpha);
+
+	return TRUE;
+}
+
+void
+_vte_draw_begin_cell_mask (struct _vte_draw *draw,
+			   gint x, gint y, gint width, gint height)
+{
+	cairo_surface_t *mask;
+
+	g_return_if_fail (draw->started);
+	g_return_if_fail (draw->cell_mask_saved_cr == NULL);
+
+	_vte_debug_print (VTE_DEBUG_DRAW,
+			"draw_begin_cell_mask (%d, %d, %d, %d)\n",
+			x, y, width, height);
+
+	mask = cairo_image_surface_create (CAIRO_FORMAT_A8,
+					   width + 2 * CELL_MASK_PAD,
+					   height + 2 * CELL_MASK_PAD);
+
+	/* Drawing goes to the mask until _vte_draw_end_cell_mask() */
+	draw->cell_mask_saved_cr = draw->cr;
+	draw->cr = cairo_create (mask);
+	cairo_translate (draw->cr, CELL_MASK_PAD - x, CELL_MASK_PAD - y);
+	cairo_surface_destroy (mask);
+
+	draw->cell_mask_x = x;
+	draw->cell_mask_y = y;
+	draw->cell_mask_width = width;
+	draw->cell_mask_height = height;
+}
+
+void
+_vte_draw_end_cell_mask (struct _vte_draw *draw, guint32 key, gboolean keep,
+			 const PangoColor *color, guchar alpha)
+{
+	cairo_surface_t *mask;
+
+	g_return_if_fail (draw->cell_mask_saved_cr != NULL);
+
+	mask = cairo_surface_reference (cairo_get_target (draw->cr));
+	cairo_destroy (draw->cr);
+	draw->cr = draw->cell_mask_saved_cr;
+	draw->cell_mask_saved_cr = NULL;
+
+	if (keep) {
+		struct cell_mask_key *k;
+
+		if (draw->cell_masks == NULL)
+			draw->cell_masks = g_hash_table_new_full (cell_mask_key_hash,
+								  cell_mask_key_equal,
+								  cell_mask_key_free,
+								  (GDestroyNotify) cairo_surface_destroy);
+		/* Sizes changing a lot; start over */
+		if (g_hash_table_size (draw->cell_masks) >= CELL_MASK_MAX)
+			g_hash_table_remove_all (draw->cell_masks);
+
+		k = g_slice_new (struct cell_mask_key);
+		k->key = key;
+		k->width = draw->cell_mask_width;
+		k->height = draw->cell_mask_height;
+		g_hash_table_replace (draw->cell_masks, k, cairo_surface_reference (mask));
+
+		_vte_draw_emit_mask (draw, mask,
+				     draw->cell_mask_x - CELL_MASK_PAD,
+				     draw->cell_mask_y - CELL_MASK_PAD,
+				     color, alpha);
+	}
+
+	cairo_surface_destroy (mask);
+}
+
+void
+_vte_draw_set_render_threads (struct _vte_draw *draw, gint n_threads)
+{
+	_vte_debug_print (VTE_DEBUG_DRAW, "draw_set_render_threads (%d)\n", n_threads);
+
+	draw->render_threads = CLAMP (n_threads, 0, BAND_MAX_THREADS);
+}
+
+void
+_vte_draw_begin_bands (struct _vte_draw *draw, GdkRegion *region,
+		       gint row_height)
+{
+	VteRegionRectangle clip, band;
+	gint height;
+
+	g_return_if_fail (draw->started);
+	g_return_if_fail (!draw->recording);
+
+	if (draw->render_threads < 2 || draw->use_atlas || !g_thread_supported ())
+		return;
+	/* Image backgrounds may live on the X server */
+	if (cairo_pattern_get_type (draw->bg_pattern) != CAIRO_PATTERN_TYPE_SOLID)
+		return;
+
+	gdk_region_get_clipbox (region, &clip);
+	if (clip.width * clip.height < BAND_MIN_PIXELS)
+		return;
+
+	/* Whole rows per band */
+	row_height = MAX (row_height, 1);
+	height = howmany (howmany (clip.height, draw->render_threads), row_height) * row_height;
+	if (height >= clip.height)
+		return;
+
+	if (draw->ops == NULL) {
+		draw->ops = g_array_new (FALSE, FALSE, sizeof (struct draw_op));
+		draw->op_glyphs = g_array_new (FALSE, FALSE, sizeof (cairo_glyph_t));
+		draw->bands = g_array_new (FALSE, FALSE, sizeof (VteRegionRectangle));
+	}
+
+	band.x = clip.x;
+	band.width = clip.width;
+	for (band.y = clip.y; band.y < clip.y + clip.height; band.y += height) {
+		band.height = MIN (height, clip.y + clip.height - band.y);
+		g_array_append_val (draw->bands, band);
+	}
+
+	/* Bands are composited with CAIRO_OPERATOR_SOURCE, so they have to
+	 * hold what the window would */
+	if (cairo_surface_get_content (cairo_get_target (draw->cr)) == CAIRO_CONTENT_COLOR)
+		draw->band_format = CAIRO_FORMAT_RGB24;
+	else
+		draw->band_format = CAIRO_FORMAT_ARGB32;
+
+	_vte_debug_print (VTE_DEBUG_DRAW, "draw_begin_bands (%u bands of %d rows)\n",
+			  draw->bands->len, height / row_height);
+
+	draw->recording = TRUE;
+	draw->record_direct = FALSE;
+}
+
+/* Runs the recorded operations that reach a band into an image surface */
+static void
+_vte_draw_band_run (gpointer data, gpointer user_data)
+{
+	struct band_job *job = data;
+	struct _vte_draw *draw = job->draw;
+	cairo_t *cr;
+	guint i;
+
+	job->surface = cairo_image_surface_create (draw->band_format,
+						   job->rect.width,
+						   job->rect.height);
+	cairo_surface_set_device_offset (job->surface, -job->rect.x, -job->rect.y);
+
+	cr = cairo_create (job->surface);
+	cairo_rectangle (cr, job->rect.x, job->rect.y, job->rect.width, job->rect.height);
+	cairo_clip (cr);
+	for (i = 0; i < draw->ops->len; i++) {
+		const struct draw_op *op = &g_array_index (draw->ops, struct draw_op, i);
+
+		if (op->y1 > job->rect.y && op->y0 < job->rect.y + job->rect.height)
+			_vte_draw_run_op (draw, cr, op);
+	}
+	cairo_destroy (cr);
+
+	g_async_queue_push (job->done, job);
+}
+
+void
+_vte_draw_end_bands (struct _vte_draw *draw)
+{
+	struct band_job *jobs;
+	GAsyncQueue *done;
+	guint i, n_bands;
+
+	if (!draw->recording)
+		return;
+	draw->recording = FALSE;
+
+	n_bands = draw->bands->len;
+
+	for (i = 0; i < draw->ops->len; i++) {
+		struct draw_op *op = &g_array_index (draw->ops, struct draw_op, i);
+
+		if (op->type == DRAW_OP_GLYPHS)
+			op->u.glyphs.glyphs = &g_array_index (draw->op_glyphs, cairo_glyph_t,
+							      op->u.glyphs.offset);
+	}
+
+	if (draw->record_direct) {
+		_vte_debug_print (VTE_DEBUG_DRAW, "draw_end_bands (on the main thread)\n");
+		for (i = 0; i < draw->ops->len; i++)
+			_vte_draw_run_op (draw, draw->cr,
+					  &g_array_index (draw->ops, struct draw_op, i));
+		goto out;
+	}
+
+	if (band_pool == NULL)
+		band_pool = g_thread_pool_new (_vte_draw_band_run, NULL,
+					       -1, FALSE, NULL);
+
+	done = g_async_queue_new ();
+	jobs = g_new0 (struct band_job, n_bands);
+	for (i = 0; i < n_bands; i++) {
+		jobs[i].draw = draw;
+		jobs[i].rect = g_array_index (draw->bands, VteRegionRectangle, i);
+		jobs[i].done = done;
+	}
+
+	/* The main thread takes the first band itself */
+	for (i = 1; i < n_bands; i++)
+		g_thread_pool_push (band_pool, &jobs[i], NULL);
+	_vte_draw_band_run (&jobs[0], NULL);
+	for (i = 0; i < n_bands; i++)
+		g_async_queue_pop (done);
+
+	cairo_save (draw->cr);
+	cairo_set_operator (draw->cr, CAIRO_OPERATOR_SOURCE);
+	for (i = 0; i < n_bands; i++) {
+		cairo_set_source_surface (draw->cr, jobs[i].surface, 0, 0);
+		cairo_rectangle (draw->cr, jobs[i].rect.x, jobs[i].rect.y,
+				 jobs[i].rect.width, jobs[i].rect.height);
+		cairo_fill (draw->cr);
+		cairo_surface_destroy (jobs[i].surface);
+	}
+	cairo_restore (draw->cr);
+
+	g_free (jobs);
+	g_async_queue_unref (done);
+
+	_vte_debug_print (VTE_DEBUG_DRAW, "draw_end_bands (%u operations)\n",
+			  draw->ops->len);
+
+out:
+	for (i = 0; i < draw->ops->len; i++) {
+		struct draw_op *op = &g_array_index (draw->ops, struct draw_op, i);
+
+		if (op->type == DRAW_OP_MASK)
+			cairo_surface_destroy (op->u.mask);
+	}
+	g_array_set_size (draw->ops, 0);
+	g_array_set_size (draw->op_glyphs, 0);
+	g_array_set_size (draw->bands, 0);
+}
+
+#ifdef VTEDRAW_MAIN
+/* Checks that banded rendering gives the same pixels as drawing directly.
+ * Given a number of frames, then draws that many full frames of text and
+ * reports frames per second with and without the glyph atlas and bands.
+ * Without a display there is nothing to check, and the test is skipped. */
+
+/* Text in a few colors, bold, a selection, a cursor, and a cached cell
+ * mask; @hexbox adds a character that needs Pango */
+static void
+draw_check_frame (struct _vte_draw *draw, gint columns, gint rows,
+		  gboolean hexbox)
+{
+	static const PangoColor fore = { 0xc000, 0xc000, 0xc000 };
+	static const PangoColor hilite = { 0x3000, 0x6000, 0xffff };
+	struct _vte_draw_text_request request;
+	gint width, height, row, col;
+
+	_vte_draw_get_text_metrics (draw, &width, &height, NULL);
+	_vte_draw_clear (draw, 0, 0, columns * width, rows * height);
+	_vte_draw_fill_rectangle (draw, 3 * width, 2 * height,
+				  (columns - 6) * width, (rows - 4) * height,
+				  &hilite, VTE_DRAW_OPAQUE);
+	for (row = 0; row < rows; row++) {
+		for (col = 0; col < columns; col++) {
+			PangoColor color = fore;
+
+			request.c = '!' + (row * 7 + col) % 94;
+			request.x = col * width;
+			request.y = row * height;
+			request.columns = 1;
+			color.red = 0x1000 * (row % 16);
+			_vte_draw_text (draw, &request, 1, &color,
+					VTE_DRAW_OPAQUE, (row + col) % 5 == 0);
+		}
+	}
+	if (hexbox) {
+		request.c = 0x10fffd;
+		request.x = width;
+		request.y = height;
+		_vte_draw_text (draw, &request, 1, &fore, VTE_DRAW_OPAQUE, FALSE);
+	}
+	for (row = 0; row < rows; row += 3) {
+		if (!_vte_draw_cell_mask (draw, 1, 0, row * height, width, height,
+					  &fore, VTE_DRAW_OPAQUE)) {
+			_vte_draw_begin_cell_mask (draw, 0, row * height, width, height);
+			_vte_draw_fill_rectangle (draw, width / 2, row * height,
+						  1, height, &fore, VTE_DRAW_OPAQUE);
+			_vte_draw_end_cell_mask (draw, 1, TRUE, &fore, VTE_DRAW_OPAQUE);
+		}
+	}
+	_vte_draw_draw_rectangle (draw, 5 * width, (rows / 2) * height,
+				  width, height, &fore, VTE_DRAW_OPAQUE);
+}
+
+static cairo_surface_t *
+draw_check_surface (struct _vte_draw *draw, gint n_threads,
+		    gint columns, gint rows, gboolean hexbox)
+{
+	cairo_surface_t *surface;
+	VteRegionRectangle rect;
+	GdkRegion *region;
+	gint width, height;
+
+	_vte_draw_get_text_metrics (draw, &width, &height, NULL);
+	rect.x = rect.y = 0;
+	rect.width = columns * width;
+	rect.height = rows * height;
+	surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+					      rect.width, rect.height);
+	region = gdk_region_rectangle (&rect);
+
+	/* Draw into the image instead of the window */
+	_vte_draw_set_render_threads (draw, n_threads);
+	draw->cr = cairo_create (surface);
+	draw->started = 1;
+	_vte_draw_clip (draw, region);
+	_vte_draw_begin_bands (draw, region, height);
+	draw_check_frame (draw, columns, rows, hexbox);
+	_vte_draw_end_bands (draw);
+	cairo_destroy (draw->cr);
+	draw->cr = NULL;
+	draw->started = 0;
+	_vte_draw_set_render_threads (draw, 0);
+
+	gdk_region_destroy (region);
+	cairo_surface_flush (surface);
+
+	return surface;
+}
+
+static gboolean
+check_bands (struct _vte_draw *draw, gint columns, gint rows, gboolean hexbox)
+{
+	cairo_surface_t *direct, *banded;
+	gint row, size;
+	gboolean same = TRUE;
+
+	_vte_draw_set_glyph_atlas (draw, FALSE);
+	direct = draw_check_surface (draw, 0, columns, rows, hexbox);
+	banded = draw_check_surface (draw, 4, columns, rows, hexbox);
+
+	size = cairo_image_surface_get_width (direct) * 4;
+	for (row = 0; row < cairo_image_surface_get_height (direct); row++) {
+		if (memcmp (cairo_image_surface_get_data (direct) +
+			    row * cairo_image_surface_get_stride (direct),
+			    cairo_image_surface_get_data (banded) +
+			    row * cairo_image_surface_get_stride (banded),
+			    size) != 0) {
+			g_printerr ("bands%s: pixel row %d differs\n",
+				    hexbox ? " with Pango" : "", row);
+			same = FALSE;
+			break;
+		}
+	}
+
+	cairo_surface_destroy (direct);
+	cairo_surface_destroy (banded);
+
+	return same;
+}
+
+static gdouble
+bench_frames (GtkWidget *window, struct _vte_draw *draw, gboolean use_atlas,
+	      gint n_threads, gint columns, gint rows, gint frames)
+{
+	static const PangoColor colors[] = {
+		{ 0xffff, 0xffff, 0xffff },
+		{ 0xffff, 0x8000, 0x0000 },
+		{ 0x8000, 0xffff, 0x8000 }
+	};
+	struct _vte_draw_text_request *requests;
+	VteRegionRectangle rect;
+	GdkRegion *region;
+	gint width, height, frame, row, col, n, i;
+	GTimer *timer;
+	gdouble elapsed;
+
+	_vte_draw_set_glyph_atlas (draw, use_atlas);
+	_vte_draw_set_render_threads (draw, n_threads);
+	_vte_draw_get_text_metrics (draw, &width, &height, NULL);
+	requests = g_new (struct _vte_draw_text_request, columns);
+	rect.x = rect.y = 0;
+	rect.width = columns * width;
+	rect.height = rows * height;
+	region = gdk_region_rectangle (&rect);
+
+	timer = g_timer_new ();
+	/* The first frame fills the caches and is not counted */
+	for (frame = -1; frame < frames; frame++) {
+		if (frame == 0)
+			g_timer_start (timer);
+
+		_vte_draw_start (draw);
+		_vte_draw_clip (draw, region);
+		_vte_draw_begin_bands (draw, region, height);
+		_vte_draw_clear (draw, 0, 0, columns * width, rows * height);
+		for (row = 0; row < rows; row++) {
+			/* Runs of a few cells in different colors, as in a
+			 * colored directory listing */
+			for (col = 0; col < columns; col += n) {
+				n = MIN (12, columns - col);
+				for (i = 0; i < n; i++) {
+					requests[i].c = '!' + (frame + 1 + row + col + i) % 94;
+					requests[i].x = (col + i) * width;
+					requests[i].y = row * height;
+					requests[i].columns = 1;
+				}
+				_vte_draw_text (draw, requests, n,
+						&colors[(row + col / 12) % G_N_ELEMENTS (colors)],
+						VTE_DRAW_OPAQUE, FALSE);
+			}
+		}
+		_vte_draw_end_bands (draw);
+		_vte_draw_end (draw);
+		gdk_display_sync (gtk_widget_get_display (window));
+	}
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_timer_destroy (timer);
+	g_free (requests);
+	gdk_region_destroy (region);
+	_vte_draw_set_render_threads (draw, 0);
+
+	return frames / elapsed;
+}
+
+int
+main (int argc, char **argv)
+{
+	GtkWidget *window;
+	struct _vte_draw *draw;
+	PangoFontDescription *desc;
+	gint columns = 300, rows = 100, frames, width, height;
+
+#if !GLIB_CHECK_VERSION (2, 31, 0)
+	g_thread_init (NULL);
+#endif
+	if (!gtk_init_check (&argc, &argv)) {
+		g_printerr ("vtedraw: no display, skipping\n");
+		return 77;
+	}
+
+	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+	gtk_widget_set_app_paintable (window, TRUE);
+	gtk_widget_realize (window);
+
+	draw = _vte_draw_new (window);
+	desc = pango_font_description_from_string ("Monospace 10");
+	_vte_draw_set_text_font (draw, desc, VTE_ANTI_ALIAS_USE_DEFAULT);
+	pango_font_description_free (desc);
+	_vte_draw_set_background_solid (draw, 0, 0, 0, 1);
+
+	if (!check_bands (draw, 80, 24, FALSE) ||
+	    !check_bands (draw, 80, 24, TRUE)) {
+		_vte_draw_free (draw);
+		gtk_widget_destroy (window);
+		return 1;
+	}
+	g_print ("bands: same pixels as drawing directly\n");
+	if (argc < 2) {
+		_vte_draw_free (draw);
+		gtk_widget_destroy (window);
+		return 0;
+	}
+	frames = atoi (argv[1]);
+
+	_vte_draw_get_text_metrics (draw, &width, &height, NULL);
+	gtk_window_resize (GTK_WINDOW (window), columns * width, rows * height);
+	gtk_widget_show (window);
+	while (gtk_events_pending ())
+		gtk_main_iteration ();
+
+	g_print ("%dx%d cells of %dx%d pixels, %d frames\n",
+		 columns, rows, width, height, frames);
+	g_print ("cairo_show_glyphs: %.1f fps\n",
+		 bench_frames (window, draw, FALSE, 0, columns, rows, frames));
+	g_print ("glyph atlas:       %.1f fps\n",
+		 bench_frames (window, draw, TRUE, 0, columns, rows, frames));
+	g_print ("4 bands:           %.1f fps\n",
+		 bench_frames (window, draw, FALSE, 4, columns, rows, frames));
+
+	_vte_draw_free (draw);
+	gtk_widget_destroy (window);
+
+	return 0;
+}
+#endif
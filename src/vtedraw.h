@@ -95,6 +95,17 @@ void _vte_draw_get_text_metrics(struct _vte_draw *draw,
 int _vte_draw_get_char_width(struct _vte_draw *draw, vteunistr c, int columns,
 			     gboolean bold);
 
+void _vte_draw_set_glyph_atlas(struct _vte_draw *draw, gboolean use_atlas);
+
+/* Split repaints into horizontal bands rasterized on @n_threads threads.
+   Between _begin() and _end(), drawing is recorded, and _end() runs it in
+   each band and composites the bands; _begin() leaves drawing as it is if
+   banding is off or not worth it.  The clip has to be set already. */
+void _vte_draw_set_render_threads(struct _vte_draw *draw, gint n_threads);
+void _vte_draw_begin_bands(struct _vte_draw *draw, GdkRegion *region,
+			   gint row_height);
+void _vte_draw_end_bands(struct _vte_draw *draw);
+
 void _vte_draw_text(struct _vte_draw *draw,
 		    struct _vte_draw_text_request *requests, gsize n_requests,
 		    const PangoColor *color, guchar alpha, gboolean);
@@ -111,6 +122,17 @@ void _vte_draw_draw_rectangle(struct _vte_draw *draw,
 			      gint x, gint y, gint width, gint height,
 			      const PangoColor *color, guchar alpha);
 
+/* Cache what is drawn into a cell between _begin() and _end() as a mask
+   identified by @key and the cell size, and composite it in @color.  Later
+   _vte_draw_cell_mask() calls composite the cached mask and return TRUE. */
+gboolean _vte_draw_cell_mask(struct _vte_draw *draw, guint32 key,
+			     gint x, gint y, gint width, gint height,
+			     const PangoColor *color, guchar alpha);
+void _vte_draw_begin_cell_mask(struct _vte_draw *draw,
+			       gint x, gint y, gint width, gint height);
+void _vte_draw_end_cell_mask(struct _vte_draw *draw, guint32 key, gboolean keep,
+			     const PangoColor *color, guchar alpha);
+
 G_END_DECLS
 
 #endif
@@ -32,7 +32,8 @@
 
 typedef struct _VteCells VteCells;
 struct _VteCells {
-	guint32 alloc_len;
+	guint32 alloc_len : 31;
+	guint32 in_arena : 1;	/* owned by a VteRowArena, not the heap */
 	VteCell cells[1];
 };
 
@@ -53,6 +54,7 @@ _vte_cells_realloc (VteCells *cells, guint32 len)
 	_vte_debug_print(VTE_DEBUG_RING, "Enlarging cell array of %d cells to %d cells\n", cells ? cells->alloc_len : 0, alloc_len);
 	cells = g_realloc (cells, G_STRUCT_OFFSET (VteCells, cells) + alloc_len * sizeof (cells->cells[0]));
 	cells->alloc_len = alloc_len;
+	cells->in_arena = FALSE;
 
 	return cells;
 }
@@ -60,10 +62,25 @@ _vte_cells_realloc (VteCells *cells, guint32 len)
 static void
 _vte_cells_free (VteCells *cells)
 {
+	if (cells->in_arena)
+		return;
+
 	_vte_debug_print(VTE_DEBUG_RING, "Freeing cell array of %d cells\n", cells->alloc_len);
 	g_free (cells);
 }
 
+/* Moves the first @len cells of @cells out of their arena into a heap
+ * allocation with room for @alloc_len cells */
+static VteCells *
+_vte_cells_unarena (VteCells *cells, guint32 len, guint32 alloc_len)
+{
+	VteCells *new_cells = _vte_cells_realloc (NULL, alloc_len);
+
+	memcpy (new_cells->cells, cells->cells, len * sizeof (cells->cells[0]));
+
+	return new_cells;
+}
+
 
 /*
  * VteRowData: A row's data
@@ -101,7 +118,10 @@ _vte_row_data_ensure (VteRowData *row, gulong len)
 	if (G_UNLIKELY (len >= 0xFFFF))
 		return FALSE;
 
-	row->cells = _vte_cells_realloc (cells, len)->cells;
+	if (cells && cells->in_arena)
+		row->cells = _vte_cells_unarena (cells, row->len, len)->cells;
+	else
+		row->cells = _vte_cells_realloc (cells, len)->cells;
 
 	return TRUE;
 }
@@ -162,3 +182,96 @@ void _vte_row_data_shrink (VteRowData *row, gulong max_len)
 		row->len = max_len;
 }
 
+
+/*
+ * VteRowArena: Cell storage for a set of rows in a single block
+ */
+
+struct _VteRowArena {
+	gulong n_rows;
+	gulong width;
+	/* Followed by n_rows VteCells of width cells each */
+};
+
+#define _vte_row_arena_stride(width) \
+	(G_STRUCT_OFFSET (VteCells, cells) + (width) * sizeof (VteCell))
+
+static inline VteCells *
+_vte_row_arena_cells (VteRowArena *arena, gulong i)
+{
+	return (VteCells *) ((guchar *) (arena + 1) + i * _vte_row_arena_stride (arena->width));
+}
+
+/**
+ * _vte_row_arena_rebuild:
+ * @arena: the current #VteRowArena of @rows, or %NULL
+ * @rows: an array of #VteRowData
+ * @n_rows: the number of rows in @rows
+ * @width: the number of cells to reserve per row
+ *
+ * Moves the cells of @rows into a new arena that preallocates @width
+ * cells for each row in one block, and frees @arena.  Rows longer
+ * than @width keep (or get) their own heap allocation.  A @width of 0
+ * moves all rows to the heap.
+ *
+ * Return: the new arena, or %NULL if @width is 0.
+ */
+VteRowArena *
+_vte_row_arena_rebuild (VteRowArena *arena, VteRowData *rows, gulong n_rows, gulong width)
+{
+	VteRowArena *new_arena = NULL;
+	gulong i;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Rebuilding row arena for %lu rows of %lu cells\n", n_rows, width);
+
+	width = MIN (width, 0xFFFE);
+	if (width) {
+		new_arena = g_malloc (sizeof (VteRowArena) + n_rows * _vte_row_arena_stride (width));
+		new_arena->n_rows = n_rows;
+		new_arena->width = width;
+	}
+
+	for (i = 0; i < n_rows; i++) {
+		VteRowData *row = &rows[i];
+		VteCells *cells = _vte_cells_for_cell_array (row->cells);
+		VteCells *new_cells;
+
+		if (row->len > width) {
+			if (cells->in_arena)
+				row->cells = _vte_cells_unarena (cells, row->len, row->len)->cells;
+			continue;
+		}
+
+		if (!new_arena) {
+			/* width is 0, so is row->len */
+			if (cells && cells->in_arena)
+				row->cells = NULL;
+			continue;
+		}
+
+		new_cells = _vte_row_arena_cells (new_arena, i);
+		new_cells->alloc_len = width;
+		new_cells->in_arena = TRUE;
+		if (cells) {
+			memcpy (new_cells->cells, cells->cells, row->len * sizeof (cells->cells[0]));
+			_vte_cells_free (cells);
+		}
+		row->cells = new_cells->cells;
+	}
+
+	g_free (arena);
+
+	return new_arena;
+}
+
+gulong
+_vte_row_arena_get_width (VteRowArena *arena)
+{
+	return arena ? arena->width : 0;
+}
+
+void
+_vte_row_arena_free (VteRowArena *arena)
+{
+	g_free (arena);
+}
@@ -169,6 +169,17 @@ void _vte_row_data_fill (VteRowData *row, const VteCell *cell, gulong len);
 void _vte_row_data_shrink (VteRowData *row, gulong max_len);
 
 
+/*
+ * VteRowArena: Cell storage for a set of rows in a single block
+ */
+
+typedef struct _VteRowArena VteRowArena;
+
+VteRowArena *_vte_row_arena_rebuild (VteRowArena *arena, VteRowData *rows, gulong n_rows, gulong width);
+gulong _vte_row_arena_get_width (VteRowArena *arena);
+void _vte_row_arena_free (VteRowArena *arena);
+
+
 G_END_DECLS
 
 #endif
@@ -37,6 +37,8 @@ typedef struct _VteStreamClass {
 	gboolean (*read) (VteStream *stream, gsize offset, char *data, gsize len);
 	void (*truncate) (VteStream *stream, gsize offset);
 	void (*new_page) (VteStream *stream);
+	gboolean (*advance_tail) (VteStream *stream, gsize offset);
+	gsize (*tail) (VteStream *stream);
 	gsize (*head) (VteStream *stream);
 	gboolean (*write_contents) (VteStream *stream, GOutputStream *output,
 				    gsize start_offset,
@@ -89,6 +91,18 @@ _vte_stream_new_page (VteStream *stream)
 	VTE_STREAM_GET_CLASS (stream)->new_page (stream);
 }
 
+gboolean
+_vte_stream_advance_tail (VteStream *stream, gsize offset)
+{
+	return VTE_STREAM_GET_CLASS (stream)->advance_tail (stream, offset);
+}
+
+gsize
+_vte_stream_tail (VteStream *stream)
+{
+	return VTE_STREAM_GET_CLASS (stream)->tail (stream);
+}
+
 gsize
 _vte_stream_head (VteStream *stream)
 {
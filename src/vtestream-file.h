@@ -103,14 +103,26 @@ _xwrite_contents (gint fd, GOutputStream *output, GCancellable *cancellable, GEr
 
 /*
  * VteFileStream: A POSIX file-based stream
+ *
+ * The stream is kept in a ring of segments, each backed by its own unlinked
+ * temporary file.  new_page() starts a new segment at the write head, and
+ * advance_tail() drops the segments that lie entirely before the new tail,
+ * so the disk usage follows the live contents at segment granularity.
  */
 
+typedef struct _VteFileStreamSegment {
+	gint fd;
+	gsize offset;
+} VteFileStreamSegment;
+
 typedef struct _VteFileStream {
 	VteStream parent;
 
-	/* The first fd/offset is for the write head, second is for last page */
-	gint fd[2];
-	gsize offset[2];
+	/* Segments in stream order; the last one is the write head */
+	GArray *segments;
+
+	/* A released, empty fd kept around for the next segment */
+	gint spare_fd;
 } VteFileStream;
 
 typedef VteStreamClass VteFileStreamClass;
@@ -120,9 +132,16 @@ static GType _vte_file_stream_get_type (void);
 
 G_DEFINE_TYPE (VteFileStream, _vte_file_stream, VTE_TYPE_STREAM)
 
+#define _vte_file_stream_segment(stream, i) \
+	(&g_array_index ((stream)->segments, VteFileStreamSegment, (i)))
+#define _vte_file_stream_head_segment(stream) \
+	_vte_file_stream_segment ((stream), (stream)->segments->len - 1)
+
 static void
-_vte_file_stream_init (VteFileStream *stream G_GNUC_UNUSED)
+_vte_file_stream_init (VteFileStream *stream)
 {
+	stream->segments = g_array_new (FALSE, TRUE, sizeof (VteFileStreamSegment));
+	g_array_set_size (stream->segments, 1);
 }
 
 VteStream *
@@ -135,20 +154,32 @@ static void
 _vte_file_stream_finalize (GObject *object)
 {
 	VteFileStream *stream = (VteFileStream *) object;
+	guint i;
+
+	for (i = 0; i < stream->segments->len; i++)
+		if (_vte_file_stream_segment (stream, i)->fd)
+			close (_vte_file_stream_segment (stream, i)->fd);
+	g_array_free (stream->segments, TRUE);
 
-	if (stream->fd[0]) close (stream->fd[0]);
-	if (stream->fd[1]) close (stream->fd[1]);
+	if (stream->spare_fd) close (stream->spare_fd);
 
 	G_OBJECT_CLASS (_vte_file_stream_parent_class)->finalize(object);
 }
 
 static inline void
-_vte_file_stream_ensure_fd0 (VteFileStream *stream)
+_vte_file_stream_ensure_head_fd (VteFileStream *stream)
 {
+	VteFileStreamSegment *head = _vte_file_stream_head_segment (stream);
 	gint fd;
 	gchar *file_name;
-	if (G_LIKELY (stream->fd[0]))
+	if (G_LIKELY (head->fd))
+		return;
+
+	if (stream->spare_fd) {
+		head->fd = stream->spare_fd;
+		stream->spare_fd = 0;
 		return;
+	}
 
 	fd = g_file_open_tmp ("vteXXXXXX", &file_name, NULL);
 	if (fd != -1) {
@@ -156,95 +187,163 @@ _vte_file_stream_ensure_fd0 (VteFileStream *stream)
 		g_free (file_name);
 	}
 
-	stream->fd[0] = dup (fd); /* we do the dup to make sure ->fd[0] is not 0 */
+	head->fd = dup (fd); /* we do the dup to make sure ->fd is not 0 */
 
 	close (fd);
 }
 
+static void
+_vte_file_stream_release_fd (VteFileStream *stream, gint fd)
+{
+	if (!fd)
+		return;
+
+	if (stream->spare_fd) {
+		close (fd);
+		return;
+	}
+
+	_xtruncate (fd, 0);
+	stream->spare_fd = fd;
+}
+
+static gsize
+_vte_file_stream_segment_end (VteFileStreamSegment *segment)
+{
+	if (segment->fd)
+		return segment->offset + lseek (segment->fd, 0, SEEK_END);
+	else
+		return segment->offset;
+}
+
+/* Returns the index of the segment holding @offset, or -1 if it's gone */
+static gint
+_vte_file_stream_find_segment (VteFileStream *stream, gsize offset)
+{
+	gint i;
+
+	for (i = stream->segments->len - 1; i >= 0; i--)
+		if (offset >= _vte_file_stream_segment (stream, i)->offset)
+			return i;
+
+	return -1;
+}
+
 static void
 _vte_file_stream_reset (VteStream *astream, gsize offset)
 {
 	VteFileStream *stream = (VteFileStream *) astream;
+	VteFileStreamSegment *head;
 
-	if (stream->fd[0]) _xtruncate (stream->fd[0], 0);
-	if (stream->fd[1]) _xtruncate (stream->fd[1], 0);
+	while (stream->segments->len > 1) {
+		_vte_file_stream_release_fd (stream, _vte_file_stream_segment (stream, 0)->fd);
+		g_array_remove_index (stream->segments, 0);
+	}
 
-	stream->offset[0] = stream->offset[1] = offset;
+	head = _vte_file_stream_head_segment (stream);
+	if (head->fd) _xtruncate (head->fd, 0);
+	head->offset = offset;
 }
 
 static gsize
 _vte_file_stream_append (VteStream *astream, const char *data, gsize len)
 {
 	VteFileStream *stream = (VteFileStream *) astream;
+	VteFileStreamSegment *head;
 	gsize ret;
 
-	_vte_file_stream_ensure_fd0 (stream);
+	_vte_file_stream_ensure_head_fd (stream);
+	head = _vte_file_stream_head_segment (stream);
 
-	ret = lseek (stream->fd[0], 0, SEEK_END);
-	_xwrite (stream->fd[0], data, len);
+	ret = lseek (head->fd, 0, SEEK_END);
+	_xwrite (head->fd, data, len);
 
-	return stream->offset[0] + ret;
+	return head->offset + ret;
 }
 
 static gboolean
 _vte_file_stream_read (VteStream *astream, gsize offset, char *data, gsize len)
 {
 	VteFileStream *stream = (VteFileStream *) astream;
+	VteFileStreamSegment *segment;
+	gint i;
 	gsize l;
 
-	if (G_UNLIKELY (offset < stream->offset[1]))
+	i = _vte_file_stream_find_segment (stream, offset);
+	if (G_UNLIKELY (i < 0))
 		return FALSE;
 
-	if (offset < stream->offset[0]) {
-		lseek (stream->fd[1], offset - stream->offset[1], SEEK_SET);
-		l = _xread (stream->fd[1], data, len);
+	for (; (guint) i < stream->segments->len; i++) {
+		segment = _vte_file_stream_segment (stream, i);
+		if (G_UNLIKELY (!segment->fd))
+			break;
+		lseek (segment->fd, offset - segment->offset, SEEK_SET);
+		l = _xread (segment->fd, data, len);
 		offset += l; data += l; len -= l; if (!len) return TRUE;
 	}
 
-	lseek (stream->fd[0], offset - stream->offset[0], SEEK_SET);
-	l = _xread (stream->fd[0], data, len);
-	offset += l; data += l; len -= l; if (!len) return TRUE;
-
 	return FALSE;
 }
 
-static void
-_vte_file_stream_swap_fds (VteFileStream *stream)
-{
-	gint fd;
-
-	fd = stream->fd[0]; stream->fd[0] = stream->fd[1]; stream->fd[1] = fd;
-}
-
 static void
 _vte_file_stream_truncate (VteStream *astream, gsize offset)
 {
 	VteFileStream *stream = (VteFileStream *) astream;
+	VteFileStreamSegment *head;
 
-	if (G_UNLIKELY (offset < stream->offset[1])) {
-		_xtruncate (stream->fd[1], 0);
-		stream->offset[1] = offset;
+	while (stream->segments->len > 1 &&
+	       offset < _vte_file_stream_head_segment (stream)->offset) {
+		_vte_file_stream_release_fd (stream, _vte_file_stream_head_segment (stream)->fd);
+		g_array_set_size (stream->segments, stream->segments->len - 1);
 	}
 
-	if (G_UNLIKELY (offset < stream->offset[0])) {
-		_xtruncate (stream->fd[0], 0);
-		stream->offset[0] = stream->offset[1];
-		_vte_file_stream_swap_fds (stream);
+	head = _vte_file_stream_head_segment (stream);
+	if (G_UNLIKELY (offset < head->offset)) {
+		_xtruncate (head->fd, 0);
+		head->offset = offset;
 	} else {
-		_xtruncate (stream->fd[0], offset - stream->offset[0]);
+		_xtruncate (head->fd, offset - head->offset);
 	}
 }
 
 static void
 _vte_file_stream_new_page (VteStream *astream)
+{
+	VteFileStream *stream = (VteFileStream *) astream;
+	VteFileStreamSegment segment;
+
+	segment.fd = 0;
+	segment.offset = _vte_file_stream_segment_end (_vte_file_stream_head_segment (stream));
+
+	/* Don't start a new segment if the head one is still empty */
+	if (segment.offset == _vte_file_stream_head_segment (stream)->offset)
+		return;
+
+	g_array_append_val (stream->segments, segment);
+}
+
+static gboolean
+_vte_file_stream_advance_tail (VteStream *astream, gsize offset)
+{
+	VteFileStream *stream = (VteFileStream *) astream;
+	gboolean released = FALSE;
+
+	while (stream->segments->len > 1 &&
+	       offset >= _vte_file_stream_segment (stream, 1)->offset) {
+		_vte_file_stream_release_fd (stream, _vte_file_stream_segment (stream, 0)->fd);
+		g_array_remove_index (stream->segments, 0);
+		released = TRUE;
+	}
+
+	return released;
+}
+
+static gsize
+_vte_file_stream_tail (VteStream *astream)
 {
 	VteFileStream *stream = (VteFileStream *) astream;
 
-	stream->offset[1] = stream->offset[0];
-	if (stream->fd[0])
-		stream->offset[0] += lseek (stream->fd[0], 0, SEEK_END);
-	_vte_file_stream_swap_fds (stream);
-	_xtruncate (stream->fd[0], 0);
+	return _vte_file_stream_segment (stream, 0)->offset;
 }
 
 static gsize
@@ -252,10 +351,7 @@ _vte_file_stream_head (VteStream *astream)
 {
 	VteFileStream *stream = (VteFileStream *) astream;
 
-	if (stream->fd[0])
-		return stream->offset[0] + lseek (stream->fd[0], 0, SEEK_END);
-	else
-		return stream->offset[0];
+	return _vte_file_stream_segment_end (_vte_file_stream_head_segment (stream));
 }
 
 static gboolean
@@ -264,19 +360,24 @@ _vte_file_stream_write_contents (VteStream *astream, GOutputStream *output,
 				 GCancellable *cancellable, GError **error)
 {
 	VteFileStream *stream = (VteFileStream *) astream;
+	VteFileStreamSegment *segment;
+	gint i;
 
-	if (G_UNLIKELY (offset < stream->offset[1]))
+	i = _vte_file_stream_find_segment (stream, offset);
+	if (G_UNLIKELY (i < 0))
 		return FALSE;
 
-	if (offset < stream->offset[0]) {
-		lseek (stream->fd[1], offset - stream->offset[1], SEEK_SET);
-		if (!_xwrite_contents (stream->fd[1], output, cancellable, error))
+	for (; (guint) i < stream->segments->len; i++) {
+		segment = _vte_file_stream_segment (stream, i);
+		if (G_UNLIKELY (!segment->fd))
+			break;
+		lseek (segment->fd, offset - segment->offset, SEEK_SET);
+		if (!_xwrite_contents (segment->fd, output, cancellable, error))
 			return FALSE;
-		offset = stream->offset[0];
+		offset = _vte_file_stream_segment_end (segment);
 	}
 
-	lseek (stream->fd[0], offset - stream->offset[0], SEEK_SET);
-	return _xwrite_contents (stream->fd[0], output, cancellable, error);
+	return TRUE;
 }
 
 static void
@@ -291,6 +392,8 @@ _vte_file_stream_class_init (VteFileStreamClass *klass)
 	klass->read = _vte_file_stream_read;
 	klass->truncate = _vte_file_stream_truncate;
 	klass->new_page = _vte_file_stream_new_page;
+	klass->advance_tail = _vte_file_stream_advance_tail;
+	klass->tail = _vte_file_stream_tail;
 	klass->head = _vte_file_stream_head;
 	klass->write_contents = _vte_file_stream_write_contents;
 }
@@ -22,6 +22,7 @@
 #include <config.h>
 
 #include "vteunistr.h"
+#include "debug.h"
 
 #include <string.h>
 
@@ -173,3 +174,334 @@ _vte_unistr_strlen (vteunistr s)
 	}
 	return len;
 }
+
+
+/* Word characters:
+ *
+ * Selecting by words asks whether each character of a line is a word
+ * character, so the set is compiled into a bitmap of the answers for the
+ * BMP, and a sorted table of the ranges outside of it, which are rare.
+ * The answers that come from the Unicode properties are the same for
+ * every set, so they are worked out once.
+ */
+
+#define VTE_WORD_CHARS_BMP 0x10000
+
+struct _VteWordChars {
+	guint32 bmp[VTE_WORD_CHARS_BMP / 32];
+	GArray *ranges;
+};
+
+static gboolean
+word_chars_is_graphic (gunichar c)
+{
+	return g_unichar_isgraph (c) &&
+	       !g_unichar_ispunct (c) &&
+	       !g_unichar_isspace (c) &&
+	       (c != '\0');
+}
+
+static const guint32 *
+word_chars_graphic_bmp (void)
+{
+	static guint32 *bmp;
+	gunichar c;
+
+	if (G_LIKELY (bmp))
+		return bmp;
+
+	bmp = g_new0 (guint32, VTE_WORD_CHARS_BMP / 32);
+	for (c = 0; c < VTE_WORD_CHARS_BMP; c++)
+		if (word_chars_is_graphic (c))
+			bmp[c / 32] |= 1u << (c % 32);
+	return bmp;
+}
+
+static gint
+word_chars_range_compare (gconstpointer a, gconstpointer b)
+{
+	const VteWordCharRange *ra = a, *rb = b;
+
+	return ra->start < rb->start ? -1 : ra->start > rb->start;
+}
+
+VteWordChars *
+_vte_word_chars_new (const VteWordCharRange *ranges, guint n_ranges)
+{
+	VteWordChars *word_chars = g_slice_new (VteWordChars);
+	guint i, j;
+	gunichar c;
+
+	memcpy (word_chars->bmp, word_chars_graphic_bmp (), sizeof (word_chars->bmp));
+	word_chars->ranges = g_array_new (FALSE, FALSE, sizeof (VteWordCharRange));
+
+	/* With a spec, only the ASCII characters in it count */
+	if (n_ranges)
+		memset (word_chars->bmp, 0, 0x80 / 8);
+
+	for (i = 0; i < n_ranges; i++) {
+		VteWordCharRange range = ranges[i];
+
+		for (c = range.start; c <= MIN (range.end, VTE_WORD_CHARS_BMP - 1); c++)
+			word_chars->bmp[c / 32] |= 1u << (c % 32);
+		if (range.end >= VTE_WORD_CHARS_BMP && range.start <= range.end) {
+			range.start = MAX (range.start, VTE_WORD_CHARS_BMP);
+			g_array_append_val (word_chars->ranges, range);
+		}
+	}
+
+	/* Sort the ranges and merge those that overlap */
+	g_array_sort (word_chars->ranges, word_chars_range_compare);
+	for (i = j = 0; i < word_chars->ranges->len; i++) {
+		VteWordCharRange *range = &g_array_index (word_chars->ranges, VteWordCharRange, i);
+		VteWordCharRange *last = j ? &g_array_index (word_chars->ranges, VteWordCharRange, j - 1) : NULL;
+
+		if (last && range->start <= last->end + 1)
+			last->end = MAX (last->end, range->end);
+		else
+			g_array_index (word_chars->ranges, VteWordCharRange, j++) = *range;
+	}
+	g_array_set_size (word_chars->ranges, j);
+
+	return word_chars;
+}
+
+void
+_vte_word_chars_free (VteWordChars *word_chars)
+{
+	g_array_free (word_chars->ranges, TRUE);
+	g_slice_free (VteWordChars, word_chars);
+}
+
+gboolean
+_vte_word_chars_contains (const VteWordChars *word_chars, gunichar c)
+{
+	const VteWordCharRange *ranges;
+	guint lo, hi, mid;
+
+	if (G_LIKELY (c < VTE_WORD_CHARS_BMP))
+		return (word_chars->bmp[c / 32] >> (c % 32)) & 1;
+
+	ranges = (const VteWordCharRange *) word_chars->ranges->data;
+	lo = 0;
+	hi = word_chars->ranges->len;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (c < ranges[mid].start)
+			hi = mid;
+		else if (c > ranges[mid].end)
+			lo = mid + 1;
+		else
+			return TRUE;
+	}
+
+	return word_chars_is_graphic (c);
+}
+
+VteWordChars *
+_vte_word_chars_new_from_spec (const char *spec)
+{
+	VteWordChars *word_chars;
+	VteWordCharRange range;
+	GArray *ranges;
+	const char *end;
+	gunichar *wbuf;
+	glong i, len;
+
+	if (spec == NULL)
+		spec = "";
+
+	ranges = g_array_new (FALSE, FALSE, sizeof (VteWordCharRange));
+	g_utf8_validate (spec, -1, &end);
+	wbuf = g_utf8_to_ucs4_fast (spec, end - spec, &len);
+	for (i = 0; i < len; i++) {
+		/* The hyphen character. */
+		if (wbuf[i] == '-') {
+			range.start = range.end = wbuf[i];
+			g_array_append_val (ranges, range);
+			_vte_debug_print (VTE_DEBUG_MISC,
+					  "Word charset includes hyphen.\n");
+			continue;
+		}
+		/* A single character, not the start of a range. */
+		if (wbuf[i + 1] != '-') {
+			range.start = range.end = wbuf[i];
+			g_array_append_val (ranges, range);
+			_vte_debug_print (VTE_DEBUG_MISC,
+					  "Word charset includes U+%04X.\n",
+					  wbuf[i]);
+			continue;
+		}
+		/* The start of a range. */
+		if (wbuf[i + 2] != '-' && wbuf[i + 2] != 0) {
+			range.start = wbuf[i];
+			range.end = wbuf[i + 2];
+			g_array_append_val (ranges, range);
+			_vte_debug_print (VTE_DEBUG_MISC,
+					  "Word charset includes range from "
+					  "U+%04X to U+%04X.\n",
+					  wbuf[i], wbuf[i + 2]);
+			i += 2;
+			continue;
+		}
+	}
+	g_free (wbuf);
+
+	word_chars = _vte_word_chars_new ((VteWordCharRange *) ranges->data, ranges->len);
+	g_array_free (ranges, TRUE);
+
+	return word_chars;
+}
+
+gboolean
+_vte_word_chars_same_word (const VteWordChars *word_chars, vteunistr a, vteunistr b)
+{
+	/* Lets not group non-wordchars together (bug #25290) */
+	return a != 0 && b != 0 &&
+	       _vte_word_chars_contains (word_chars, _vte_unistr_get_base (a)) &&
+	       _vte_word_chars_contains (word_chars, _vte_unistr_get_base (b));
+}
+
+#ifdef VTEUNISTR_MAIN
+/* Checks which characters a few specs make word characters, and which
+ * cells selecting by words groups together.  Given a number of cells, then
+ * also times going over a word that long. */
+
+static gboolean
+check_spec (const char *spec, const gunichar *words, const gunichar *others)
+{
+	VteWordChars *word_chars = _vte_word_chars_new_from_spec (spec);
+	gboolean ok = TRUE;
+
+	for (; *words; words++) {
+		if (!_vte_word_chars_contains (word_chars, *words)) {
+			g_printerr ("spec \"%s\": U+%04X is not a word character\n",
+				    spec, *words);
+			ok = FALSE;
+		}
+	}
+	for (; *others; others++) {
+		if (_vte_word_chars_contains (word_chars, *others)) {
+			g_printerr ("spec \"%s\": U+%04X is a word character\n",
+				    spec, *others);
+			ok = FALSE;
+		}
+	}
+
+	_vte_word_chars_free (word_chars);
+
+	return ok;
+}
+
+static gboolean
+check_specs (void)
+{
+	static const gunichar default_words[] = { 'a', 'Z', '5', 0xe9, 0x436, 0x20000, 0 };
+	static const gunichar default_others[] = { ' ', '-', '_', '.', 0x3000, 0xe0001, 0 };
+	static const gunichar url_words[] = { 'a', 'Z', '5', '-', '_', '~', 0xe9, 0x10400, 0 };
+	static const gunichar url_others[] = { ' ', '!', '(', '"', 0xa0, 0 };
+	static const gunichar range_words[] = { 'b', '-', 'x', 0x10001, 0 };
+	static const gunichar range_others[] = { 'a', 'd', '+', 0 };
+	static const gunichar invalid_words[] = { 'a', 'b', 0 };
+	static const gunichar invalid_others[] = { 'c', 'd', 0 };
+	gboolean ok = TRUE;
+
+	ok &= check_spec (NULL, default_words, default_others);
+	ok &= check_spec ("", default_words, default_others);
+	ok &= check_spec ("-A-Za-z0-9,./?%&#:_=+@~", url_words, url_others);
+	ok &= check_spec ("b-c--x\xf0\x90\x80\x80-\xf0\x90\x80\x82", range_words, range_others);
+	ok &= check_spec ("ab\xff" "cd", invalid_words, invalid_others);
+
+	return ok;
+}
+
+static gboolean
+check_same_word (void)
+{
+	static const struct {
+		vteunistr a, b;
+		gboolean same;
+	} tests[] = {
+		{ 'a', 'b', TRUE },
+		{ 'a', 0xe9, TRUE },
+		{ 'a', ' ', FALSE },
+		{ ' ', 'a', FALSE },
+		{ ' ', ' ', FALSE },
+		{ '.', '.', FALSE },
+		{ 'a', 0, FALSE },
+		{ 0, 'a', FALSE },
+	};
+	VteWordChars *word_chars = _vte_word_chars_new_from_spec (NULL);
+	vteunistr accented = _vte_unistr_append_unichar ('e', 0x301);
+	gboolean ok = TRUE;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		if (_vte_word_chars_same_word (word_chars, tests[i].a, tests[i].b) != tests[i].same) {
+			g_printerr ("same word: U+%04X and U+%04X %s\n",
+				    tests[i].a, tests[i].b,
+				    tests[i].same ? "are apart" : "are together");
+			ok = FALSE;
+		}
+	}
+	/* Combining marks go with the character they are on */
+	if (!_vte_word_chars_same_word (word_chars, 'a', accented) ||
+	    !_vte_word_chars_same_word (word_chars, accented, 'a')) {
+		g_printerr ("same word: accented letter is apart\n");
+		ok = FALSE;
+	}
+
+	_vte_word_chars_free (word_chars);
+
+	return ok;
+}
+
+/* Walks a word of @n_cells letters, some of them outside of ASCII, from its
+ * middle to both ends like a double click does */
+static void
+bench_word (gulong n_cells)
+{
+	vteunistr *cells = g_new (vteunistr, n_cells);
+	VteWordChars *word_chars;
+	GTimer *timer = g_timer_new ();
+	gdouble compile, walk;
+	gulong i, start, end;
+
+	for (i = 0; i < n_cells; i++)
+		cells[i] = i % 7 == 0 ? 0xe9 : i % 101 == 0 ? 0x436 : i % 13 == 0 ? '_' : 'a' + i % 26;
+
+	word_chars = _vte_word_chars_new_from_spec ("-A-Za-z0-9,./?%&#:_=+@~");
+	compile = g_timer_elapsed (timer, NULL);
+
+	g_timer_start (timer);
+	start = end = n_cells / 2;
+	while (start > 0 && _vte_word_chars_same_word (word_chars, cells[start - 1], cells[start]))
+		start--;
+	while (end + 1 < n_cells && _vte_word_chars_same_word (word_chars, cells[end], cells[end + 1]))
+		end++;
+	walk = g_timer_elapsed (timer, NULL);
+
+	g_print ("select a word of %lu cells: %.2f ms, spec compiled in %.2f ms\n",
+		 end - start + 1, walk * 1000, compile * 1000);
+
+	_vte_word_chars_free (word_chars);
+	g_timer_destroy (timer);
+	g_free (cells);
+}
+
+int
+main (int argc, char **argv)
+{
+	if (!check_specs ())
+		return 1;
+	g_print ("specs: word characters as expected\n");
+	if (!check_same_word ())
+		return 1;
+	g_print ("same word: cells grouped as expected\n");
+
+	if (argc > 1)
+		bench_word (g_ascii_strtoull (argv[1], NULL, 10));
+
+	return 0;
+}
+#endif
@@ -82,6 +82,61 @@ _vte_unistr_append_to_string (vteunistr s, GString *gs);
 int
 _vte_unistr_strlen (vteunistr s);
 
+
+/* Word characters */
+
+typedef struct _VteWordCharRange {
+	gunichar start, end;
+} VteWordCharRange;
+
+typedef struct _VteWordChars VteWordChars;
+
+/**
+ * _vte_word_chars_new:
+ * @ranges: the ranges of characters to count as word characters
+ * @n_ranges: the number of @ranges
+ *
+ * Compiles a set of word characters for _vte_word_chars_contains(): the
+ * characters in @ranges, and the graphic non-punctuation non-space ones
+ * outside of ASCII.  If @n_ranges is zero, the ASCII ones count too.
+ *
+ * Returns: a new #VteWordChars, to free with _vte_word_chars_free()
+ **/
+VteWordChars *
+_vte_word_chars_new (const VteWordCharRange *ranges, guint n_ranges);
+
+void
+_vte_word_chars_free (VteWordChars *word_chars);
+
+gboolean
+_vte_word_chars_contains (const VteWordChars *word_chars, gunichar c);
+
+/**
+ * _vte_word_chars_new_from_spec:
+ * @spec: (allow-none): a spec as taken by vte_terminal_set_word_chars()
+ *
+ * Compiles the word characters of @spec: its characters, and ranges of
+ * them separated by a hyphen.  Parsing stops at invalid UTF-8.
+ *
+ * Returns: a new #VteWordChars, to free with _vte_word_chars_free()
+ **/
+VteWordChars *
+_vte_word_chars_new_from_spec (const char *spec);
+
+/**
+ * _vte_word_chars_same_word:
+ * @word_chars: the word characters
+ * @a: a cell's character, or 0 if there is none
+ * @b: the character of the cell next to it, or 0 if there is none
+ *
+ * Whether selecting by words extends from @a over @b: both have to be word
+ * characters, so that separators are never grouped together.
+ *
+ * Returns: %TRUE if @a and @b belong to the same word
+ **/
+gboolean
+_vte_word_chars_same_word (const VteWordChars *word_chars, vteunistr a, vteunistr b);
+
 G_END_DECLS
 
 #endif